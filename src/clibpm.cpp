@@ -1,46 +1,51 @@
 // clibpm
 
+#include <cpuid.h>
+#include <algorithm>
+#include <thread>
+#include <vector>
+#include <atomic>
+#include <chrono>
+
 #include "clibpm.h"
+#include "vmem.h"
 
 std::mutex pmp_mutex;
 
 // Global new and delete
 
 void* operator new(size_t sz) throw (std::bad_alloc) {
-    void* ret = calloc(1, sz);
-    return ret;
+    return storage::vmem_alloc(sz);
 }
 
 void operator delete(void *p) throw () {
-    if (LIBPM <= (unsigned long long) p && (unsigned long long) p <= LIBPM + PMSIZE)
+    if (storage::pmem_in_pool(p))
 	pfree(p);
+    else if (storage::vmem_in_heap(p))
+	storage::vmem_free(p);
     else
     	free(p);
 }
 
 void *operator new[](std::size_t sz) throw (std::bad_alloc) {
-    void* ret = calloc(1, sz);
-    return ret;
+    return storage::vmem_alloc(sz);
 }
 
 void operator delete[](void *p) throw () {
-    if (LIBPM <= (unsigned long long) p && (unsigned long long) p <= LIBPM + PMSIZE)
+    if (storage::pmem_in_pool(p))
 	pfree(p);
+    else if (storage::vmem_in_heap(p))
+	storage::vmem_free(p);
     else
     	free(p);
 }
 
 void* pmalloc(size_t sz) {
-  pmp_mutex.lock();
-  void* ret = storage::pmemalloc_reserve(sz);
-  pmp_mutex.unlock();
-  return ret;
+  return storage::pmemalloc_arena_reserve(sz);
 }
 
 void pfree(void *p) {
-  pmp_mutex.lock();
-  storage::pmemalloc_free(p);
-  pmp_mutex.unlock();
+  storage::pmemalloc_arena_free(p);
 }
 
 namespace storage {
@@ -57,6 +62,41 @@ struct static_info *sp;
 int pmem_debug;
 size_t pmem_orig_size;
 
+const char* pmem_flush_names[PMEM_FLUSH_TYPES] = { "clflush", "clflushopt",
+    "clwb" };
+
+// pmem_flush_supported -- check CPUID for a cache line write back primitive
+bool pmem_flush_supported(int type) {
+  unsigned int eax, ebx, ecx, edx;
+
+  if (type == PMEM_FLUSH_CLFLUSH)
+    return true;
+
+  if (__get_cpuid_max(0, NULL) < 7)
+    return false;
+
+  __cpuid_count(7, 0, eax, ebx, ecx, edx);
+
+  if (type == PMEM_FLUSH_CLFLUSHOPT)
+    return (ebx & bit_CLFLUSHOPT) != 0;
+  if (type == PMEM_FLUSH_CLWB)
+    return (ebx & (1 << 24)) != 0;
+
+  return false;
+}
+
+// pmem_flush_detect -- pick the cheapest primitive this CPU supports
+int pmem_flush_detect() {
+  if (pmem_flush_supported(PMEM_FLUSH_CLWB))
+    return PMEM_FLUSH_CLWB;
+  if (pmem_flush_supported(PMEM_FLUSH_CLFLUSHOPT))
+    return PMEM_FLUSH_CLFLUSHOPT;
+
+  return PMEM_FLUSH_CLFLUSH;
+}
+
+int pmem_flush_type = pmem_flush_detect();
+
 // debug -- printf-like debug messages
 void debug(const char *file, int line, const char *func, const char *fmt, ...) {
   va_list ap;
@@ -98,22 +138,39 @@ void fatal(int err, const char *file, int line, const char *func,
 struct clump {
   size_t size;  // size of the clump
   size_t prevsize;  // size of previous (lower) clump
-  struct {
-    off_t off;
-    void *ptr_;
-  } ons[PMEM_NUM_ON];
+  union {
+    struct {
+      off_t off;
+      void *ptr_;
+    } ons[PMEM_NUM_ON];
+    // size class links, only meaningful while the clump is free
+    // never persisted, rebuilt from the clump chain in pmemalloc_init
+    struct {
+      struct clump *next;
+      struct clump *prev;
+    } fl;
+  };
 };
 
 // pool header kept at a known location in each memory-mapped file
 struct pool_header {
   char signature[16]; /* must be PMEM_SIGNATURE */
   size_t totalsize; /* total file size */
-  char padding[4096 - 16 - sizeof(size_t)];
+  size_t nextents; /* extent files mapped after this one, in order */
+  size_t extsize[PMEM_MAX_EXTENTS]; /* size of each extent file */
+  char padding[4096 - 16 - sizeof(size_t) * (2 + PMEM_MAX_EXTENTS)];
 };
 
 // Global memory pool
 void* pmp;
 
+// mapped size of the pool, extents included, and the path they hang off
+size_t pmem_size;
+static char pmem_path[PATH_MAX];
+
+// differs on every pool open, volatile copies of pool data check it
+unsigned long pmem_boot;
+
 // definitions used internally by this implementation
 #define PMEM_SIGNATURE "*PMEMALLOC_POOL"
 #define PMEM_PAGE_SIZE 4096 /* size of next three sections */
@@ -130,6 +187,122 @@ void* pmp;
 #define PMEM_STATE_ACTIVE 2 /* active (allocated) clump */
 #define PMEM_STATE_UNUSED 3 /* must be highest value + 1 */
 
+// size classes for free clumps
+#define PMEM_NUM_SMALL_CLASSES 64 /* exact classes, one per chunk up to 4KB */
+#define PMEM_SMALL_MAX (PMEM_NUM_SMALL_CLASSES * PMEM_CHUNK_SIZE)
+#define PMEM_NUM_CLASSES 128  /* power of two classes above PMEM_SMALL_MAX */
+#define PMEM_CLASS_WORDS (PMEM_NUM_CLASSES / 64)
+
+// free lists per size class and a bitmap of the non-empty ones
+struct clump* free_lists[PMEM_NUM_CLASSES];
+uint64_t free_map[PMEM_CLASS_WORDS];
+
+// live counters, all but pmem_active_bytes are guarded by pmp_mutex
+static size_t pmem_free_bytes;
+static size_t pmem_free_clumps;
+static std::atomic<size_t> pmem_active_bytes(0);
+static unsigned long pmem_allocs[PMEM_STAT_BUCKETS];
+static unsigned long pmem_searches;
+static unsigned long pmem_probes;
+
+// next clump the defragmenter looks at, NULL for the first clump
+static struct clump* defrag_cursor;
+static unsigned long defrag_passes;
+static unsigned long defrag_merges;
+
+// pmemalloc_defrag_moved -- keep the cursor off a clump merged into another
+static inline void pmemalloc_defrag_moved(struct clump* gone,
+                                          struct clump* into) {
+  if (defrag_cursor == gone)
+    defrag_cursor = into;
+}
+
+// pmemalloc_stat_bucket -- size bucket of an allocation request
+static inline unsigned int pmemalloc_stat_bucket(size_t size) {
+  unsigned int bucket;
+
+  if (size <= 64)
+    return 0;
+
+  bucket = 64 - __builtin_clzl(size - 1) - 6;
+  if (bucket >= PMEM_STAT_BUCKETS)
+    bucket = PMEM_STAT_BUCKETS - 1;
+
+  return bucket;
+}
+
+// pmemalloc_class -- size class of a clump of the given size
+static inline unsigned int pmemalloc_class(size_t sz) {
+  unsigned int cls;
+
+  if (sz <= PMEM_SMALL_MAX)
+    return sz / PMEM_CHUNK_SIZE - 1;
+
+  // floor(log2(sz)) is at least 12 here
+  cls = PMEM_NUM_SMALL_CLASSES + (63 - __builtin_clzl(sz)) - 12;
+  if (cls >= PMEM_NUM_CLASSES)
+    cls = PMEM_NUM_CLASSES - 1;
+
+  return cls;
+}
+
+// pmemalloc_fl_insert -- push a free clump on its size class list
+static inline void pmemalloc_fl_insert(struct clump* clp) {
+  unsigned int cls = pmemalloc_class(clp->size & ~PMEM_STATE_MASK);
+  struct clump* head = free_lists[cls];
+
+  clp->fl.prev = NULL;
+  clp->fl.next = head;
+  if (head != NULL)
+    head->fl.prev = clp;
+  free_lists[cls] = clp;
+
+  free_map[cls / 64] |= (1UL << (cls % 64));
+
+  pmem_free_bytes += clp->size & ~PMEM_STATE_MASK;
+  pmem_free_clumps++;
+}
+
+// pmemalloc_fl_remove -- unlink a free clump from its size class list
+static inline void pmemalloc_fl_remove(struct clump* clp) {
+  unsigned int cls = pmemalloc_class(clp->size & ~PMEM_STATE_MASK);
+
+  if (clp->fl.prev != NULL)
+    clp->fl.prev->fl.next = clp->fl.next;
+  else
+    free_lists[cls] = clp->fl.next;
+
+  if (clp->fl.next != NULL)
+    clp->fl.next->fl.prev = clp->fl.prev;
+
+  if (free_lists[cls] == NULL)
+    free_map[cls / 64] &= ~(1UL << (cls % 64));
+
+  pmem_free_bytes -= clp->size & ~PMEM_STATE_MASK;
+  pmem_free_clumps--;
+}
+
+// pmemalloc_next_class -- first non-empty class above cls, or -1
+static inline int pmemalloc_next_class(unsigned int cls) {
+  unsigned int word;
+  uint64_t bits;
+
+  cls++;
+  if (cls >= PMEM_NUM_CLASSES)
+    return -1;
+
+  word = cls / 64;
+  bits = free_map[word] & (~0UL << (cls % 64));
+
+  while (1) {
+    if (bits)
+      return word * 64 + __builtin_ctzl(bits);
+    if (++word == PMEM_CLASS_WORDS)
+      return -1;
+    bits = free_map[word];
+  }
+}
+
 // display pmem pool
 void pmemalloc_display() {
   struct clump* clp;
@@ -186,7 +359,7 @@ void check() {
 
   lastclp =
       ABS_PTR(
-          (struct clump *) (pmem_orig_size & ~(PMEM_CHUNK_SIZE - 1)) - PMEM_CHUNK_SIZE);
+          (struct clump *) (pmem_size & ~(PMEM_CHUNK_SIZE - 1)) - PMEM_CHUNK_SIZE);
 
   if (clp->size == 0)
     FATAL("no clumps found");
@@ -205,7 +378,8 @@ void check() {
 
 // pmemalloc_recover -- recover after a possible crash
 static void pmemalloc_recover(void* pmp) {
-  struct clump *clp;
+  struct clump *clp, *lastclp;
+  size_t prevsz = 0;
 
   DEBUG("pmp=0x%lx", pmp);
 
@@ -220,13 +394,38 @@ static void pmemalloc_recover(void* pmp) {
       case PMEM_STATE_RESERVED:
         /* return the clump to the FREE pool */
         clp->size = sz | PMEM_STATE_FREE;
-        pmem_persist(clp, sizeof(*clp), 0);
+        pmem_flush(clp, sizeof(*clp));
         break;
     }
 
+    /* a split or batch reserve may have been torn before the size flip */
+    if (clp->prevsize != prevsz) {
+      clp->prevsize = prevsz;
+      pmem_flush(clp, sizeof(*clp));
+    }
+
+    prevsz = sz;
     clp = (struct clump *) ((uintptr_t) clp + sz);
     DEBUG("next clp %lx, offset 0x%lx", clp, REL_PTR(clp));
   }
+
+  /* a growth was torn before the old end clump turned into a free clump */
+  lastclp = ABS_PTR((struct clump *) ((pmem_size & ~(PMEM_CHUNK_SIZE - 1))
+      - PMEM_CHUNK_SIZE));
+  if (clp != lastclp) {
+    prevsz = (uintptr_t) lastclp - (uintptr_t) clp;
+    clp->size = prevsz | PMEM_STATE_FREE;
+    pmem_flush(clp, sizeof(*clp));
+    clp = lastclp;
+  }
+
+  if (clp->prevsize != prevsz) {
+    clp->prevsize = prevsz;
+    pmem_flush(clp, sizeof(*clp));
+  }
+
+  /* every fix above is idempotent, so one drain for the whole pass */
+  pmem_drain();
 }
 
 // pmemalloc_coalesce -- find adjacent free blocks and coalesce across pool
@@ -256,7 +455,9 @@ static void pmemalloc_coalesce(void* pmp) {
       csize += sz;
     } else if (firstfree != NULL && lastfree != NULL) {
       firstfree->size = csize | PMEM_STATE_FREE;
-      pmem_persist(firstfree, sizeof(*firstfree), 0);
+      pmem_flush(firstfree, sizeof(*firstfree));
+      clp->prevsize = csize;
+      pmem_flush(clp, sizeof(*clp));
       firstfree = lastfree = NULL;
       csize = 0;
     } else {
@@ -270,9 +471,153 @@ static void pmemalloc_coalesce(void* pmp) {
 
   if (firstfree != NULL && lastfree != NULL) {
     firstfree->size = csize | PMEM_STATE_FREE;
-    pmem_persist(firstfree, sizeof(*firstfree), 0);
+    pmem_flush(firstfree, sizeof(*firstfree));
+    clp->prevsize = csize;
+    pmem_flush(clp, sizeof(*clp));
+  }
+
+  pmem_drain();
+}
+
+// pmemalloc_build_free_lists -- rebuild size class lists from the clump chain
+static void pmemalloc_build_free_lists(void* pmp) {
+  struct clump *clp;
+
+  DEBUG("pmp=0x%lx", pmp);
+
+  memset(free_lists, 0, sizeof(free_lists));
+  memset(free_map, 0, sizeof(free_map));
+  pmem_free_bytes = 0;
+  pmem_free_clumps = 0;
+  pmem_active_bytes = 0;
+
+  clp = ABS_PTR((struct clump *) PMEM_CLUMP_OFFSET);
+
+  while (clp->size) {
+    size_t sz = clp->size & ~PMEM_STATE_MASK;
+    int state = clp->size & PMEM_STATE_MASK;
+
+    if (state == PMEM_STATE_FREE)
+      pmemalloc_fl_insert(clp);
+    else if (state == PMEM_STATE_ACTIVE)
+      pmem_active_bytes += sz;
+
+    clp = (struct clump *) ((uintptr_t) clp + sz);
+  }
+}
+
+// MAPPING
+
+bool pmem_huge_pages = false;
+
+#define PMEM_PREFAULT_MIN (64UL * 1024 * 1024) /* least bytes per thread */
+
+/*
+ * pmem_prefault_range -- map in every page of the range for reading. a
+ * write fault would dirty each page of the shared mapping and force a
+ * writeback of the whole pool, the first store to a page still takes a
+ * minor fault to mark it dirty.
+ */
+static void pmem_prefault_range(char *start, char *end) {
+#ifdef MADV_POPULATE_READ
+  if (madvise(start, end - start, MADV_POPULATE_READ) == 0)
+    return;
+#endif
+
+  /* older kernels, touch one byte in every page */
+  for (; start < end; start += PMEM_PAGE_SIZE)
+    (void) *(volatile char *) start;
+}
+
+// pmem_prefault -- fault in a mapping from several threads at once
+void pmem_prefault(void *addr, size_t len) {
+  std::vector<std::thread> threads;
+  char *start = (char *) addr;
+  char *end = start + len;
+  size_t nthreads, stripe, itr;
+
+  nthreads = std::max(1u, std::thread::hardware_concurrency());
+  nthreads = std::min(nthreads, len / PMEM_PREFAULT_MIN + 1);
+  stripe = (len / nthreads + PMEM_PAGE_SIZE - 1) & ~size_t(PMEM_PAGE_SIZE - 1);
+
+  for (itr = 1; itr < nthreads; itr++)
+    threads.push_back(
+        std::thread(pmem_prefault_range, start + itr * stripe,
+                    std::min(start + (itr + 1) * stripe, end)));
+
+  pmem_prefault_range(start, std::min(start + stripe, end));
+
+  for (std::thread& thread : threads)
+    thread.join();
+}
+
+// pmem_map -- map a pool file at an offset inside the reserved range
+void *pmem_map(int fd, size_t off, size_t len, int prot) {
+  void *base;
+
+  if ((base = mmap((caddr_t) LIBPM + off, len, prot, MAP_SHARED | MAP_FIXED,
+                   fd, 0)) == MAP_FAILED)
+    return NULL;
+
+  /* hugetlbfs mappings are huge already and reject the advice */
+  if (pmem_huge_pages)
+    madvise(base, len, MADV_HUGEPAGE);
+
+  pmem_prefault(base, len);
+
+  return base;
+}
+
+// pmemalloc_reserve_range -- hold the address range the pool may grow into
+static bool pmemalloc_reserve_range() {
+  static bool reserved = false;
+  void *base;
+
+  if (reserved)
+    return true;
+
+  base = mmap((caddr_t) LIBPM, PMEM_MAX_SIZE, PROT_NONE,
+  MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+              -1, 0);
+  if (base == MAP_FAILED)
+    return false;
+
+  if (base != (void *) LIBPM) {
+    munmap(base, PMEM_MAX_SIZE);
+    errno = EADDRINUSE;
+    return false;
+  }
+
+  reserved = true;
+  return true;
+}
+
+// pmemalloc_map_extents -- map the extent files listed in the pool header
+static size_t pmemalloc_map_extents(void* pmp, const char *path, size_t size,
+                                    int prot) {
+  struct pool_header *hdrp;
+  char extpath[PATH_MAX];
+  size_t itr;
+  int fd;
+
+  hdrp = ABS_PTR((struct pool_header *) PMEM_HDR_OFFSET);
+
+  for (itr = 0; itr < hdrp->nextents; itr++) {
+    snprintf(extpath, sizeof(extpath), "%s.%zu", path, itr + 1);
+
+    if ((fd = open(extpath, (prot & PROT_WRITE) ? O_RDWR : O_RDONLY)) < 0)
+      return 0;
+
+    if (pmem_map(fd, size, hdrp->extsize[itr], prot) == NULL) {
+      close(fd);
+      return 0;
+    }
+
+    close(fd);
+    size += hdrp->extsize[itr];
   }
 
+  return size;
 }
 
 // pmemalloc_init -- setup a Persistent Memory pool for use
@@ -281,15 +626,12 @@ void *pmemalloc_init(const char *path, size_t size) {
   int err;
   int fd = -1;
   struct stat stbuf;
+  size_t lastclumpoff = 0;
 
   DEBUG("path=%s size=0x%lx", path, size);
   pmem_orig_size = size;
 
   if (stat(path, &stbuf) < 0) {
-    struct clump cl = clump();
-    struct pool_header hdr = pool_header();
-    size_t lastclumpoff;
-
     if (errno != ENOENT)
       goto out;
 
@@ -303,7 +645,7 @@ void *pmemalloc_init(const char *path, size_t size) {
       goto out;
     }
 
-    ASSERTeq(sizeof(cl), PMEM_CHUNK_SIZE);ASSERTeq(sizeof(hdr), PMEM_PAGE_SIZE);
+    ASSERTeq(sizeof(struct clump), PMEM_CHUNK_SIZE);ASSERTeq(sizeof(struct pool_header), PMEM_PAGE_SIZE);
 
     if ((fd = open(path, O_CREAT | O_RDWR, 0666)) < 0)
       goto out;
@@ -320,24 +662,6 @@ void *pmemalloc_init(const char *path, size_t size) {
      */
     lastclumpoff = (size & ~(PMEM_CHUNK_SIZE - 1)) - PMEM_CHUNK_SIZE;
 
-    /*
-     * create the first clump to cover the entire pool
-     */
-    cl.size = lastclumpoff - PMEM_CLUMP_OFFSET;
-    if (pwrite(fd, &cl, sizeof(cl), PMEM_CLUMP_OFFSET) < 0)
-      goto out; DEBUG("[0x%lx] created clump, size 0x%lx", PMEM_CLUMP_OFFSET, cl.size);
-
-    /*
-     * write the pool header
-     */
-    strcpy(hdr.signature, PMEM_SIGNATURE);
-    hdr.totalsize = size;
-    if (pwrite(fd, &hdr, sizeof(hdr), PMEM_HDR_OFFSET) < 0)
-      goto out;
-
-    if (fsync(fd) < 0)
-      goto out;
-
   } else {
 
     if ((fd = open(path, O_RDWR)) < 0)
@@ -347,14 +671,56 @@ void *pmemalloc_init(const char *path, size_t size) {
   }
 
   /*
-   * map the file
+   * map the file, then any extents the pool has grown by
    */
-  if ((pmp = pmem_map(fd, size)) == NULL) {
+  if (!pmemalloc_reserve_range()) {
+    perror("reserving pool range failed ");
+    goto out;
+  }
+
+  if ((pmp = pmem_map(fd, 0, size, PROT_READ | PROT_WRITE)) == NULL) {
     DEBUG("fd : %d size : %lu \n", fd, size);
     perror("mapping failed ");
     goto out;
   }
 
+  close(fd);
+  fd = -1;
+
+  if ((pmem_size = pmemalloc_map_extents(pmp, path, size,
+                                         PROT_READ | PROT_WRITE)) == 0) {
+    perror("mapping extents failed ");
+    goto out;
+  }
+
+  snprintf(pmem_path, sizeof(pmem_path), "%s", path);
+
+  /*
+   * a new pool is set up through the mapping, as hugetlbfs files
+   * do not support write(). the signature goes last.
+   */
+  if (lastclumpoff) {
+    struct clump *clp = ABS_PTR((struct clump *) PMEM_CLUMP_OFFSET);
+    struct pool_header *hdrp = ABS_PTR((struct pool_header *) PMEM_HDR_OFFSET);
+
+    /*
+     * create the first clump to cover the entire pool
+     */
+    clp->size = lastclumpoff - PMEM_CLUMP_OFFSET;
+    pmem_flush(clp, sizeof(*clp));
+    DEBUG("[0x%lx] created clump, size 0x%lx", PMEM_CLUMP_OFFSET, clp->size);
+
+    /*
+     * write the pool header
+     */
+    hdrp->totalsize = size;
+    pmem_flush(hdrp, sizeof(*hdrp));
+    pmem_drain();
+    strcpy(hdrp->signature, PMEM_SIGNATURE);
+    pmem_flush(hdrp->signature, sizeof(hdrp->signature));
+    pmem_drain();
+  }
+
   /*
    * scan pool for recovery work, five kinds:
    *  1. pmem pool file sisn't even fully setup
@@ -365,6 +731,10 @@ void *pmemalloc_init(const char *path, size_t size) {
    */
   pmemalloc_recover(pmp);
   pmemalloc_coalesce(pmp);
+  pmemalloc_build_free_lists(pmp);
+  defrag_cursor = NULL;
+  pmem_boot = std::chrono::system_clock::now().time_since_epoch().count()
+      + pmem_boot + 1;
 
   return pmp;
 
@@ -382,114 +752,250 @@ void *pmemalloc_static_area() {
   return ABS_PTR((void *) PMEM_STATIC_OFFSET);
 }
 
-// ROTATING FIRST FIT
-struct clump* prev_clp = NULL;
+// pmemalloc_chunk_size -- clump size needed for a request, header included
+static inline size_t pmemalloc_chunk_size(size_t size) {
+  if (size <= 64)
+    return 128;
 
-// pmemalloc_reserve -- allocate memory, volatile until pmemalloc_activate()
-void *pmemalloc_reserve(size_t size) {
-  size_t nsize;
+  return 64 + ((size + 63) & ~size_t(63));
+}
 
-  if (size <= 64) {
-    nsize = 128;
-  } else {
-    nsize = 64 + ((size + 63) & ~size_t(63));
+// pmemalloc_defrag_step -- merge free runs among the next budget clumps
+// with pmp_mutex held, true once the pass has reached the end of the pool
+static bool pmemalloc_defrag_step(unsigned long budget) {
+  struct clump *clp, *next_clp, *after_clp;
+  size_t sz, next_sz;
+
+  if (defrag_cursor == NULL)
+    defrag_cursor = ABS_PTR((struct clump *) PMEM_CLUMP_OFFSET);
+  clp = defrag_cursor;
+
+  for (; budget; budget--) {
+    sz = clp->size & ~PMEM_STATE_MASK;
+
+    if (sz == 0) {
+      defrag_cursor = NULL;
+      defrag_passes++;
+      return true;
+    }
+
+    next_clp = (struct clump *) ((uintptr_t) clp + sz);
+    next_sz = next_clp->size & ~PMEM_STATE_MASK;
+
+    if ((clp->size & PMEM_STATE_MASK) == PMEM_STATE_FREE && next_sz
+        && (next_clp->size & PMEM_STATE_MASK) == PMEM_STATE_FREE) {
+      pmemalloc_fl_remove(clp);
+      pmemalloc_fl_remove(next_clp);
+
+      /*
+       * grow the first clump over its neighbour, then fix the back link
+       * of the clump after them. a crash in between leaves a stale
+       * back link that pmemalloc_recover repairs.
+       */
+      clp->size = (sz + next_sz) | PMEM_STATE_FREE;
+      pmem_flush(clp, sizeof(*clp));
+      pmem_drain();
+
+      after_clp = (struct clump *) ((uintptr_t) next_clp + next_sz);
+      after_clp->prevsize = sz + next_sz;
+      pmem_flush(after_clp, sizeof(*after_clp));
+      pmem_drain();
+
+      pmemalloc_fl_insert(clp);
+      defrag_merges++;
+
+      // the grown clump may border another free one
+      continue;
+    }
+
+    clp = next_clp;
   }
 
-  //cout<<"size :: "<<size<<" nsize :: "<<nsize<<endl;
-  struct clump *clp;
+  defrag_cursor = clp;
+  return false;
+}
+
+// pmemalloc_grow -- map one more extent file after the pool, at least nsize
+static bool pmemalloc_grow(size_t nsize) {
+  struct pool_header *hdrp;
+  struct clump *clp, *lastclp, *prevclp;
+  char extpath[PATH_MAX + 32];
+  size_t extsize, sz, align;
+  int fd;
+
+  hdrp = ABS_PTR((struct pool_header *) PMEM_HDR_OFFSET);
+
+  /* grow by the size of the first file, or enough for this request */
+  extsize = std::max(hdrp->totalsize, nsize + PMEM_CHUNK_SIZE);
+  align = pmem_huge_pages ? PMEM_HUGE_PAGE_SIZE : PMEM_PAGE_SIZE;
+  extsize = (extsize + align - 1) & ~(align - 1);
+
+  if (hdrp->nextents == PMEM_MAX_EXTENTS || pmem_size % align
+      || pmem_size + extsize > PMEM_MAX_SIZE)
+    return false;
+
+  snprintf(extpath, sizeof(extpath), "%s.%zu", pmem_path, hdrp->nextents + 1);
+  DEBUG("extent %s size 0x%lx", extpath, extsize);
+
+  if ((fd = open(extpath, O_CREAT | O_TRUNC | O_RDWR, 0666)) < 0)
+    return false;
+
+  if ((errno = posix_fallocate(fd, 0, extsize)) != 0
+      || pmem_map(fd, pmem_size, extsize, PROT_READ | PROT_WRITE) == NULL) {
+    close(fd);
+    unlink(extpath);
+    return false;
+  }
+
+  close(fd);
+
+  /*
+   * the extent is zero filled, so its last 64 bytes already read as an
+   * end clump. order here is important:
+   *  1. point the new end clump back at the space being added
+   *  2. record the extent in the pool header
+   *  3. turn the old end clump into a free clump over the extent
+   * a crash after 2 is finished by pmemalloc_recover.
+   */
+  clp = ABS_PTR((struct clump *) (pmem_size - PMEM_CHUNK_SIZE));
+  lastclp = ABS_PTR((struct clump *) (pmem_size + extsize - PMEM_CHUNK_SIZE));
+
+  lastclp->prevsize = extsize;
+  pmem_flush(lastclp, sizeof(*lastclp));
+
+  hdrp->extsize[hdrp->nextents] = extsize;
+  pmem_flush(&hdrp->extsize[hdrp->nextents], sizeof(size_t));
+  pmem_drain();
+  hdrp->nextents++;
+  pmem_flush(&hdrp->nextents, sizeof(size_t));
+  pmem_drain();
+
+  clp->size = extsize | PMEM_STATE_FREE;
+  pmem_flush(clp, sizeof(*clp));
+  pmem_drain();
+
+  pmem_size += extsize;
+
+  /* merge with a free clump at the old end of the pool */
+  sz = clp->prevsize;
+  prevclp = (struct clump *) ((uintptr_t) clp - sz);
+  if (sz && (prevclp->size & PMEM_STATE_MASK) == PMEM_STATE_FREE) {
+    pmemalloc_fl_remove(prevclp);
+    pmemalloc_defrag_moved(clp, prevclp);
+
+    prevclp->size = (sz + extsize) | PMEM_STATE_FREE;
+    pmem_flush(prevclp, sizeof(*prevclp));
+    lastclp->prevsize = sz + extsize;
+    pmem_flush(lastclp, sizeof(*lastclp));
+    pmem_drain();
+
+    clp = prevclp;
+  }
+
+  pmemalloc_fl_insert(clp);
+  return true;
+}
+
+// pmemalloc_reserve_clump -- take a clump of nsize bytes off the free lists
+static void *pmemalloc_reserve_clump(size_t nsize) {
+  struct clump *clp = NULL;
   struct clump* next_clp;
-  bool loop = false;
-  DEBUG("size= %zu", nsize);
+  unsigned int cls = pmemalloc_class(nsize);
+  int next_cls;
+  DEBUG("size= %zu class= %u", nsize, cls);
+
+  pmem_searches++;
 
-  if (prev_clp != NULL) {
-    clp = prev_clp;
+  /* small sizes have exact classes, large ones need a first fit in class */
+  if (nsize <= PMEM_SMALL_MAX) {
+    clp = free_lists[cls];
+    pmem_probes++;
   } else {
-    clp = ABS_PTR((struct clump *) PMEM_CLUMP_OFFSET);
+    for (clp = free_lists[cls]; clp != NULL; clp = clp->fl.next) {
+      pmem_probes++;
+      if (nsize <= (clp->size & ~PMEM_STATE_MASK))
+        break;
+    }
   }
 
-  DEBUG("clp= %p", clp);
+  /* any clump in a higher class fits */
+  if (clp == NULL) {
+    next_cls = pmemalloc_next_class(cls);
 
-  /* first fit */
-  check:  //unsigned int itr = 0;
-  while (clp->size) {
-    DEBUG("************** itr :: %lu ", itr++);
-    size_t sz = clp->size & ~PMEM_STATE_MASK;
-    int state = clp->size & PMEM_STATE_MASK;
-    DEBUG("size : %lu state : %d", sz, state);
-
-    if (nsize <= sz) {
-      if (state == PMEM_STATE_FREE) {
-        void *ptr = (void *) (uintptr_t) clp + PMEM_CHUNK_SIZE
-            - (uintptr_t) pmp;
-        size_t leftover = sz - nsize;
-
-        DEBUG("fit found ptr 0x%lx, leftover %lu bytes", ptr, leftover);
-        if (leftover >= PMEM_CHUNK_SIZE * 2) {
-          struct clump *newclp;
-          newclp = (struct clump *) ((uintptr_t) clp + nsize);
-
-          DEBUG("splitting: [0x%lx] new clump", REL_PTR(newclp));
-          /*
-           * can go ahead and start fiddling with
-           * this freely since it is in the middle
-           * of a free clump until we change fields
-           * in *clp.  order here is important:
-           *  1. initialize new clump
-           *  2. persist new clump
-           *  3. initialize existing clump do list
-           *  4. persist existing clump
-           *  5. set new clump size, RESERVED
-           *  6. persist existing clump
-           */
-          newclp->size = leftover | PMEM_STATE_FREE;
-          newclp->prevsize = nsize;
-          pmem_persist(newclp, sizeof(*newclp), 0);
-
-          next_clp = (struct clump *) ((uintptr_t) newclp + leftover);
-          next_clp->prevsize = leftover;
-          pmem_persist(next_clp, sizeof(*next_clp), 0);
-
-          clp->size = nsize | PMEM_STATE_RESERVED;
-          pmem_persist(clp, sizeof(*clp), 0);
-
-          //DEBUG("validate new clump %p", REL_PTR(newclp));
-          //DEBUG("validate orig clump %p", REL_PTR(clp));
-          //DEBUG("validate next clump %p", REL_PTR(next_clp));
-        } else {
-          DEBUG("no split required");
-
-          clp->size = sz | PMEM_STATE_RESERVED;
-          pmem_persist(clp, sizeof(*clp), 0);
-
-          next_clp = (struct clump *) ((uintptr_t) clp + sz);
-          next_clp->prevsize = sz;
-          pmem_persist(next_clp, sizeof(*next_clp), 0);
-
-          //DEBUG("validate orig clump %p", REL_PTR(clp));
-          //DEBUG("validate next clump %p", REL_PTR(next_clp));
-        }
-
-        prev_clp = clp;
-        return ABS_PTR(ptr);
-      }
+    if (next_cls < 0) {
+      if (pmemalloc_grow(nsize))
+        return pmemalloc_reserve_clump(nsize);
+
+      printf("no free memory of size %lu available \n", nsize);
+      //display();
+      errno = ENOMEM;
+      return NULL;
     }
 
-    clp = (struct clump *) ((uintptr_t) clp + sz);
-    DEBUG("next clump :: [0x%lx]", REL_PTR(clp));
+    clp = free_lists[next_cls];
+    pmem_probes++;
   }
 
-  if (loop == false) {
-    DEBUG("LOOP ");
-    loop = true;
-    clp = ABS_PTR((struct clump *) PMEM_CLUMP_OFFSET);
-    goto check;
+  DEBUG("clp= %p", clp);
+
+  size_t sz = clp->size & ~PMEM_STATE_MASK;
+  void *ptr = (void *) (uintptr_t) clp + PMEM_CHUNK_SIZE - (uintptr_t) pmp;
+  size_t leftover = sz - nsize;
+
+  pmemalloc_fl_remove(clp);
+
+  DEBUG("fit found ptr 0x%lx, leftover %lu bytes", ptr, leftover);
+  if (leftover >= PMEM_CHUNK_SIZE * 2) {
+    struct clump *newclp;
+    newclp = (struct clump *) ((uintptr_t) clp + nsize);
+
+    DEBUG("splitting: [0x%lx] new clump", REL_PTR(newclp));
+    /*
+     * can go ahead and start fiddling with
+     * this freely since it is in the middle
+     * of a free clump until we change fields
+     * in *clp.  order here is important:
+     *  1. initialize new clump
+     *  2. persist new clump
+     *  3. initialize existing clump do list
+     *  4. persist existing clump
+     *  5. set new clump size, RESERVED
+     *  6. persist existing clump
+     */
+    newclp->size = leftover | PMEM_STATE_FREE;
+    newclp->prevsize = nsize;
+    pmem_flush(newclp, sizeof(*newclp));
+
+    next_clp = (struct clump *) ((uintptr_t) newclp + leftover);
+    next_clp->prevsize = leftover;
+    pmem_flush(next_clp, sizeof(*next_clp));
+    pmem_drain();
+
+    clp->size = nsize | PMEM_STATE_RESERVED;
+    pmem_flush(clp, sizeof(*clp));
+    pmem_drain();
+
+    pmemalloc_fl_insert(newclp);
+  } else {
+    DEBUG("no split required");
+
+    clp->size = sz | PMEM_STATE_RESERVED;
+    pmem_flush(clp, sizeof(*clp));
+
+    next_clp = (struct clump *) ((uintptr_t) clp + sz);
+    next_clp->prevsize = sz;
+    pmem_flush(next_clp, sizeof(*next_clp));
+    pmem_drain();
   }
 
-  printf("no free memory of size %lu available \n", nsize);
-  //display();
-  errno = ENOMEM;
-  exit(EXIT_FAILURE);
-  return NULL;
+  return ABS_PTR(ptr);
+}
+
+// pmemalloc_reserve -- allocate memory, volatile until pmemalloc_activate()
+void *pmemalloc_reserve(size_t size) {
+  pmem_allocs[pmemalloc_stat_bucket(size)]++;
+
+  return pmemalloc_reserve_clump(pmemalloc_chunk_size(size));
 }
 
 // pmemalloc_activate -- atomically persist memory, mark in-use, store pointers
@@ -503,10 +1009,14 @@ void pmemalloc_activate_helper(void *abs_ptr) {
   ASSERTeq(clp->size & PMEM_STATE_MASK, PMEM_STATE_RESERVED);
   sz = clp->size & ~PMEM_STATE_MASK;
 
-  pmem_persist(abs_ptr, clp->size - PMEM_CHUNK_SIZE, 0);
+  pmem_flush(abs_ptr, sz - PMEM_CHUNK_SIZE);
+  pmem_drain();
 
   clp->size = sz | PMEM_STATE_ACTIVE;
-  pmem_persist(clp, sizeof(*clp), 0);
+  pmem_flush(clp, sizeof(*clp));
+  pmem_drain();
+
+  pmem_active_bytes += sz;
 }
 
 // pmemalloc_activate
@@ -516,6 +1026,48 @@ void pmemalloc_activate(void *abs_ptr) {
   //pmp_mutex.unlock();
 }
 
+// pmemalloc_activate_add -- queue a reserved clump for batched activation
+void pmemalloc_activate_add(struct activation* act, void *abs_ptr) {
+  if (abs_ptr == NULL)
+    return;
+
+  if (act->count == PMEM_ACTIVATE_MAX)
+    pmemalloc_activate_batch(act);
+
+  act->ptrs[act->count++] = abs_ptr;
+}
+
+// pmemalloc_activate_batch -- activate all queued clumps with two fences
+void pmemalloc_activate_batch(struct activation* act) {
+  struct clump *clp;
+  size_t sz, total = 0;
+  unsigned int itr;
+
+  if (act->count == 0)
+    return;
+
+  // payloads must be durable before any header says ACTIVE
+  for (itr = 0; itr < act->count; itr++) {
+    clp = (struct clump *) ((uintptr_t) act->ptrs[itr] - PMEM_CHUNK_SIZE);
+    sz = clp->size & ~PMEM_STATE_MASK;
+    pmem_flush(act->ptrs[itr], sz - PMEM_CHUNK_SIZE);
+  }
+  pmem_drain();
+
+  for (itr = 0; itr < act->count; itr++) {
+    clp = (struct clump *) ((uintptr_t) act->ptrs[itr] - PMEM_CHUNK_SIZE);
+    sz = clp->size & ~PMEM_STATE_MASK;
+    clp->size = sz | PMEM_STATE_ACTIVE;
+    pmem_flush(clp, sizeof(*clp));
+    total += sz;
+  }
+  pmem_drain();
+
+  pmem_active_bytes += total;
+
+  act->count = 0;
+}
+
 // pmemalloc_free -- free memory, find adjacent free blocks and coalesce them
 void pmemalloc_free(void *abs_ptr_) {
 
@@ -536,9 +1088,17 @@ void pmemalloc_free(void *abs_ptr_) {
   sz = clp->size & ~PMEM_STATE_MASK;
   DEBUG("size=%lu", sz);
 
+  // already on a free list
+  if ((clp->size & PMEM_STATE_MASK) == PMEM_STATE_FREE)
+    return;
+
+  if ((clp->size & PMEM_STATE_MASK) == PMEM_STATE_ACTIVE)
+    pmem_active_bytes -= sz;
+
   lastfree = (struct clump *) ((uintptr_t) clp + sz);
   //DEBUG("validate lastfree %p", REL_PTR(lastfree));
-  if ((lastfree->size & PMEM_STATE_MASK) != PMEM_STATE_FREE)
+  if (lastfree->size == 0
+      || (lastfree->size & PMEM_STATE_MASK) != PMEM_STATE_FREE)
     last = false;
 
   firstfree = (struct clump *) ((uintptr_t) clp - clp->prevsize);
@@ -552,46 +1112,59 @@ void pmemalloc_free(void *abs_ptr_) {
 
     size_t first_sz = firstfree->size & ~PMEM_STATE_MASK;
     size_t last_sz = lastfree->size & ~PMEM_STATE_MASK;
+    pmemalloc_fl_remove(firstfree);
+    pmemalloc_fl_remove(lastfree);
+    pmemalloc_defrag_moved(clp, firstfree);
+    pmemalloc_defrag_moved(lastfree, firstfree);
+
     csize = first_sz + sz + last_sz;
     firstfree->size = csize | PMEM_STATE_FREE;
-    pmem_persist(firstfree, sizeof(*firstfree), 0);
+    pmem_flush(firstfree, sizeof(*firstfree));
 
     next_clp = (struct clump *) ((uintptr_t) lastfree + last_sz);
     next_clp->prevsize = csize;
-    pmem_persist(next_clp, sizeof(*next_clp), 0);
+    pmem_flush(next_clp, sizeof(*next_clp));
+    pmem_drain();
 
-    prev_clp = firstfree;
+    pmemalloc_fl_insert(firstfree);
 
     //DEBUG("validate firstfree %p", REL_PTR(firstfree));
   } else if (first) {
     DEBUG("******* F C  ");
 
     size_t first_sz = firstfree->size & ~PMEM_STATE_MASK;
+    pmemalloc_fl_remove(firstfree);
+    pmemalloc_defrag_moved(clp, firstfree);
+
     csize = first_sz + sz;
     firstfree->size = csize | PMEM_STATE_FREE;
-    pmem_persist(firstfree, sizeof(*firstfree), 0);
+    pmem_flush(firstfree, sizeof(*firstfree));
 
     next_clp = lastfree;
     next_clp->prevsize = csize;
-    pmem_persist(next_clp, sizeof(*next_clp), 0);
+    pmem_flush(next_clp, sizeof(*next_clp));
+    pmem_drain();
 
-    prev_clp = firstfree;
+    pmemalloc_fl_insert(firstfree);
 
     //DEBUG("validate firstfree %p", REL_PTR(firstfree));
     //DEBUG("validate lastfree %p", REL_PTR(firstfree));
   } else if (last) {
     DEBUG("******* C L ");
     size_t last_sz = lastfree->size & ~PMEM_STATE_MASK;
+    pmemalloc_fl_remove(lastfree);
+    pmemalloc_defrag_moved(lastfree, clp);
 
     csize = sz + last_sz;
     clp->size = csize | PMEM_STATE_FREE;
-    pmem_persist(clp, sizeof(*clp), 0);
+    pmem_flush(clp, sizeof(*clp));
 
     next_clp = (struct clump *) ((uintptr_t) lastfree + last_sz);
     next_clp->prevsize = csize;
-    pmem_persist(next_clp, sizeof(*next_clp), 0);
+    pmem_flush(next_clp, sizeof(*next_clp));
+    pmem_drain();
 
-    prev_clp = clp;
+    pmemalloc_fl_insert(clp);
 
     //DEBUG("validate firstfree %p", REL_PTR(firstfree));
     //DEBUG("validate clump %p", REL_PTR(clp));
@@ -600,15 +1173,334 @@ void pmemalloc_free(void *abs_ptr_) {
 
     csize = sz;
     clp->size = csize | PMEM_STATE_FREE;
-    pmem_persist(clp, sizeof(*clp), 0);
+    pmem_flush(clp, sizeof(*clp));
+    pmem_drain();
+
+    pmemalloc_fl_insert(clp);
 
     //DEBUG("validate clump %p", REL_PTR(clp));
   }
 
 }
 
+// pmemalloc_reserve_batch -- carve count clumps of nsize bytes out of one reservation
+static bool pmemalloc_reserve_batch(size_t nsize, void** ptrs, unsigned int count) {
+  struct clump *clp, *sub, *next_clp;
+  size_t total, sz;
+  unsigned int itr;
+  void *ptr;
+
+  if ((ptr = pmemalloc_reserve_clump(nsize * count)) == NULL)
+    return false;
+
+  clp = (struct clump *) ((uintptr_t) ptr - PMEM_CHUNK_SIZE);
+  total = clp->size & ~PMEM_STATE_MASK;
+
+  /*
+   * the sub clumps are written inside the reserved clump, so they stay
+   * invisible to the clump chain until the first clump is shrunk last.
+   * a crash before that frees the whole batch on recovery.
+   */
+  for (itr = 1; itr < count; itr++) {
+    sub = (struct clump *) ((uintptr_t) clp + itr * nsize);
+    sz = (itr == count - 1) ? total - itr * nsize : nsize;
+    sub->size = sz | PMEM_STATE_RESERVED;
+    sub->prevsize = nsize;
+    pmem_flush(sub, sizeof(*sub));
+    ptrs[itr] = (void *) ((uintptr_t) sub + PMEM_CHUNK_SIZE);
+  }
+
+  next_clp = (struct clump *) ((uintptr_t) clp + total);
+  next_clp->prevsize = (count == 1) ? total : total - (count - 1) * nsize;
+  pmem_flush(next_clp, sizeof(*next_clp));
+  pmem_drain();
+
+  if (count > 1) {
+    clp->size = nsize | PMEM_STATE_RESERVED;
+    pmem_flush(clp, sizeof(*clp));
+    pmem_drain();
+  }
+
+  ptrs[0] = (void *) ((uintptr_t) clp + PMEM_CHUNK_SIZE);
+  return true;
+}
+
+// PER-THREAD ARENAS
+
+#define PMEM_ARENA_MAX_SIZE 1024  /* largest clump served by an arena */
+#define PMEM_ARENA_CLASSES (PMEM_ARENA_MAX_SIZE / PMEM_CHUNK_SIZE - 1)
+#define PMEM_ARENA_DEPTH 64 /* clumps cached per class */
+#define PMEM_ARENA_BATCH 32 /* clumps carved per refill */
+
+/*
+ * each thread caches RESERVED clumps of the small size classes. a crash
+ * returns them to the pool through pmemalloc_recover, so the arena needs
+ * no persistent metadata of its own and the fast path takes no lock.
+ * a reopen of the pool does the same, the cache is then dropped unused.
+ */
+struct arena {
+  unsigned int count[PMEM_ARENA_CLASSES];
+  void* ptrs[PMEM_ARENA_CLASSES][PMEM_ARENA_DEPTH];
+  unsigned long allocs[PMEM_STAT_BUCKETS];  // merged into pmem_allocs on flush
+  unsigned long boot;  // pmem_boot when the cache was filled
+  bool armed;
+  bool closed;
+};
+
+static thread_local struct arena local_arena;
+
+// pmemalloc_arena_check -- forget clumps cached before the pool was reopened
+static inline void pmemalloc_arena_check(struct arena* ar) {
+  if (ar->boot != pmem_boot) {
+    memset(ar->count, 0, sizeof(ar->count));
+    ar->boot = pmem_boot;
+  }
+}
+
+// pmemalloc_arena_flush -- hand every cached clump back to the shared pool
+static void pmemalloc_arena_flush(struct arena* ar) {
+  unsigned int cls, itr;
+
+  pmemalloc_arena_check(ar);
+
+  pmp_mutex.lock();
+  for (cls = 0; cls < PMEM_ARENA_CLASSES; cls++) {
+    for (itr = 0; itr < ar->count[cls]; itr++)
+      pmemalloc_free(ar->ptrs[cls][itr]);
+    ar->count[cls] = 0;
+  }
+  for (itr = 0; itr < PMEM_STAT_BUCKETS; itr++) {
+    pmem_allocs[itr] += ar->allocs[itr];
+    ar->allocs[itr] = 0;
+  }
+  pmp_mutex.unlock();
+}
+
+// flush the arena when its thread exits
+struct arena_guard {
+  ~arena_guard() {
+    pmemalloc_arena_flush(&local_arena);
+    local_arena.closed = true;
+  }
+  bool armed;
+};
+
+static thread_local struct arena_guard local_arena_guard;
+
+// pmemalloc_arena_arm -- register the exit flush on first use of the arena
+static inline void pmemalloc_arena_arm(struct arena* ar) {
+  if (!ar->armed) {
+    local_arena_guard.armed = true;
+    ar->armed = true;
+  }
+}
+
+// pmemalloc_arena_reserve -- pmemalloc_reserve through the thread arena
+void *pmemalloc_arena_reserve(size_t size) {
+  struct arena* ar = &local_arena;
+  size_t nsize = pmemalloc_chunk_size(size);
+  unsigned int cls;
+  void* ret;
+
+  if (nsize > PMEM_ARENA_MAX_SIZE || ar->closed) {
+    pmp_mutex.lock();
+    ret = pmemalloc_reserve(size);
+    pmp_mutex.unlock();
+    return ret;
+  }
+
+  cls = nsize / PMEM_CHUNK_SIZE - 2;
+  ar->allocs[pmemalloc_stat_bucket(size)]++;
+  pmemalloc_arena_check(ar);
+
+  // refill from the shared pool
+  if (ar->count[cls] == 0) {
+    pmemalloc_arena_arm(ar);
+
+    pmp_mutex.lock();
+    if (!pmemalloc_reserve_batch(nsize, ar->ptrs[cls], PMEM_ARENA_BATCH)) {
+      pmp_mutex.unlock();
+      return NULL;
+    }
+    pmp_mutex.unlock();
+    ar->count[cls] = PMEM_ARENA_BATCH;
+  }
+
+  return ar->ptrs[cls][--ar->count[cls]];
+}
+
+// pmemalloc_arena_free -- pmemalloc_free through the thread arena
+void pmemalloc_arena_free(void *abs_ptr_) {
+  struct arena* ar = &local_arena;
+  struct clump *clp;
+  size_t sz;
+  int state;
+  unsigned int cls, itr, half;
+
+  if (abs_ptr_ == NULL)
+    return;
+
+  clp = (struct clump *) ((uintptr_t) abs_ptr_ - PMEM_CHUNK_SIZE);
+  sz = clp->size & ~PMEM_STATE_MASK;
+  state = clp->size & PMEM_STATE_MASK;
+
+  if (sz > PMEM_ARENA_MAX_SIZE || ar->closed || state == PMEM_STATE_FREE) {
+    pmp_mutex.lock();
+    pmemalloc_free(abs_ptr_);
+    pmp_mutex.unlock();
+    return;
+  }
+
+  cls = sz / PMEM_CHUNK_SIZE - 2;
+  pmemalloc_arena_arm(ar);
+  pmemalloc_arena_check(ar);
+
+  // arena is full, return the older half to the shared pool
+  if (ar->count[cls] == PMEM_ARENA_DEPTH) {
+    half = PMEM_ARENA_DEPTH / 2;
+
+    pmp_mutex.lock();
+    for (itr = 0; itr < half; itr++)
+      pmemalloc_free(ar->ptrs[cls][itr]);
+    pmp_mutex.unlock();
+
+    memmove(&ar->ptrs[cls][0], &ar->ptrs[cls][half], half * sizeof(void*));
+    ar->count[cls] = half;
+  }
+
+  // an active clump must not survive a crash while it sits in the arena
+  if (state == PMEM_STATE_ACTIVE) {
+    clp->size = sz | PMEM_STATE_RESERVED;
+    pmem_flush(clp, sizeof(*clp));
+    pmem_drain();
+    pmem_active_bytes -= sz;
+  }
+
+  ar->ptrs[cls][ar->count[cls]++] = abs_ptr_;
+}
+
+// BACKGROUND DEFRAGMENTATION
+
+#define PMEM_DEFRAG_STEP 4096 /* clumps visited per hold of pmp_mutex */
+#define PMEM_DEFRAG_NAP 10 /* ms between checks for a stop while idle */
+
+static std::atomic<bool> defrag_running(false);
+static std::thread defrag_thread;
+
+// pmemalloc_defrag_loop -- walk the pool in short steps, rest between passes
+static void pmemalloc_defrag_loop(unsigned int interval) {
+  unsigned int slept;
+  bool done;
+
+  while (defrag_running) {
+    pmp_mutex.lock();
+    done = pmemalloc_defrag_step(PMEM_DEFRAG_STEP);
+    pmp_mutex.unlock();
+
+    if (!done) {
+      std::this_thread::yield();
+      continue;
+    }
+
+    for (slept = 0; slept < interval && defrag_running;
+        slept += PMEM_DEFRAG_NAP)
+      std::this_thread::sleep_for(std::chrono::milliseconds(PMEM_DEFRAG_NAP));
+  }
+}
+
+// pmemalloc_defrag_start -- merge free runs in the background, a pass
+// every interval ms, while executors keep allocating
+void pmemalloc_defrag_start(unsigned int interval) {
+  if (defrag_running)
+    return;
+
+  defrag_running = true;
+  defrag_thread = std::thread(pmemalloc_defrag_loop, interval);
+}
+
+// pmemalloc_defrag_stop -- wait for the defragmenter to leave the pool
+void pmemalloc_defrag_stop() {
+  if (!defrag_running)
+    return;
+
+  defrag_running = false;
+  defrag_thread.join();
+}
+
+// pmemalloc_stats -- snapshot of the allocator counters
+void pmemalloc_stats(struct pmem_stats* st) {
+  struct clump *clp;
+  int cls;
+  unsigned int itr;
+
+  *st = pmem_stats();
+
+  pmp_mutex.lock();
+
+  st->total_bytes = (pmem_size & ~(PMEM_CHUNK_SIZE - 1)) - PMEM_CHUNK_SIZE
+      - PMEM_CLUMP_OFFSET;
+  st->free_bytes = pmem_free_bytes;
+  st->free_clumps = pmem_free_clumps;
+  st->active_bytes = pmem_active_bytes;
+  st->reserved_bytes = st->total_bytes - st->free_bytes - st->active_bytes;
+
+  /* the largest free clump is in the highest non-empty class */
+  for (cls = PMEM_NUM_CLASSES - 1; cls >= 0; cls--)
+    if (free_lists[cls] != NULL)
+      break;
+  if (cls >= 0)
+    for (clp = free_lists[cls]; clp != NULL; clp = clp->fl.next)
+      st->largest_free = std::max(st->largest_free,
+                                  clp->size & ~PMEM_STATE_MASK);
+
+  /* this thread's arena has not been merged yet */
+  for (itr = 0; itr < PMEM_STAT_BUCKETS; itr++)
+    st->allocs[itr] = pmem_allocs[itr] + local_arena.allocs[itr];
+  st->searches = pmem_searches;
+  st->probes = pmem_probes;
+  st->defrag_passes = defrag_passes;
+  st->defrag_merges = defrag_merges;
+
+  pmp_mutex.unlock();
+}
+
+// pmemalloc_print_stats -- fragmentation report, allocation counts if any
+void pmemalloc_print_stats(const struct pmem_stats* st) {
+  unsigned int itr;
+  double frag = 0;
+
+  /* share of free space not usable by one request of the largest size */
+  if (st->free_bytes)
+    frag = 1.0 - (double) st->largest_free / st->free_bytes;
+
+  printf("Allocator stats:\n");
+  printf("Pool: %lu bytes, %lu free, %lu reserved, %lu active\n",
+         st->total_bytes, st->free_bytes, st->reserved_bytes, st->active_bytes);
+  printf("Free clumps: %lu, largest %lu, fragmentation %.4f\n",
+         st->free_clumps, st->largest_free, frag);
+  if (st->defrag_passes || st->defrag_merges)
+    printf("Defrag: %lu passes, %lu free runs merged\n", st->defrag_passes,
+           st->defrag_merges);
+
+  if (st->searches == 0)
+    return;
+
+  printf("First-fit searches: %lu, average probe length %.2f\n", st->searches,
+         (double) st->probes / st->searches);
+  printf("  Size <=     Allocations\n");
+  for (itr = 0; itr < PMEM_STAT_BUCKETS; itr++) {
+    if (st->allocs[itr] == 0)
+      continue;
+    if (itr == PMEM_STAT_BUCKETS - 1)
+      printf("%10s %15lu\n", "larger", st->allocs[itr]);
+    else
+      printf("%10lu %15lu\n", 64UL << itr, st->allocs[itr]);
+  }
+}
+
 //  pmemalloc_check -- check the consistency of a pmem pool
-void pmemalloc_check(const char *path) {
+//  returns the number of free clumps that follow another free clump
+size_t pmemalloc_check(const char *path) {
   void *pmp;
   int fd;
   struct stat stbuf;
@@ -616,6 +1508,9 @@ void pmemalloc_check(const char *path) {
   struct clump *lastclp;
   struct pool_header *hdrp;
   size_t clumptotal;
+  size_t size;
+  size_t freeruns = 0;
+  int prevstate = -1;
   /*
    * stats we keep for each type of memory:
    *  stats[PMEM_STATE_FREE] for free clumps
@@ -650,9 +1545,10 @@ void pmemalloc_check(const char *path) {
     FATAL("size %lu too small (must be at least %lu)", stbuf.st_size,
           PMEM_MIN_POOL_SIZE);
 
-  if ((pmp = mmap((caddr_t) LIBPM, stbuf.st_size, PROT_READ,
-  MAP_SHARED | MAP_POPULATE,
-                  fd, 0)) == MAP_FAILED)
+  if (!pmemalloc_reserve_range())
+    FATALSYS("reserve");
+
+  if ((pmp = pmem_map(fd, 0, stbuf.st_size, PROT_READ)) == NULL)
     FATALSYS("mmap");DEBUG("pmp %lx", pmp);
 
   close(fd);
@@ -663,6 +1559,9 @@ void pmemalloc_check(const char *path) {
   if (strcmp(hdrp->signature, PMEM_SIGNATURE))
     FATAL("failed signature check");DEBUG("signature check passed");
 
+  if ((size = pmemalloc_map_extents(pmp, path, stbuf.st_size, PROT_READ)) == 0)
+    FATALSYS("mmap extents");
+
   clp = ABS_PTR((struct clump *) PMEM_CLUMP_OFFSET);
   /*
    * location of last clump is calculated by rounding the file
@@ -672,7 +1571,7 @@ void pmemalloc_check(const char *path) {
    */
   lastclp =
       ABS_PTR(
-          (struct clump *) (stbuf.st_size & ~(PMEM_CHUNK_SIZE - 1)) - PMEM_CHUNK_SIZE);
+          (struct clump *) (size & ~(PMEM_CHUNK_SIZE - 1)) - PMEM_CHUNK_SIZE);
   DEBUG("clp 0x%lx (off 0x%lx)", clp, REL_PTR(clp));DEBUG("lastclp 0x%lx (off 0x%lx)", lastclp, REL_PTR(lastclp));
 
   clumptotal = (uintptr_t) lastclp - (uintptr_t) clp;
@@ -687,8 +1586,8 @@ void pmemalloc_check(const char *path) {
    * + any bytes we rounded off the end
    * = file size
    */
-  if ((PMEM_CLUMP_OFFSET + clumptotal + (stbuf.st_size & (PMEM_CHUNK_SIZE - 1))
-      + PMEM_CHUNK_SIZE) == (size_t) stbuf.st_size) {
+  if ((PMEM_CLUMP_OFFSET + clumptotal + (size & (PMEM_CHUNK_SIZE - 1))
+      + PMEM_CHUNK_SIZE) == (size_t) size) {
     DEBUG("section sizes correctly add up to file size");
   } else {
     FATAL(
@@ -696,10 +1595,10 @@ void pmemalloc_check(const char *path) {
         "CHUNK_SIZE %d = %lu, (not st_size %lu)",
         PMEM_CLUMP_OFFSET,
         clumptotal,
-        (stbuf.st_size & (PMEM_CHUNK_SIZE - 1)),
+        (size & (PMEM_CHUNK_SIZE - 1)),
         PMEM_CHUNK_SIZE,
-        PMEM_CLUMP_OFFSET + clumptotal + (stbuf.st_size & (PMEM_CHUNK_SIZE - 1)) + PMEM_CHUNK_SIZE,
-        stbuf.st_size);
+        PMEM_CLUMP_OFFSET + clumptotal + (size & (PMEM_CHUNK_SIZE - 1)) + PMEM_CHUNK_SIZE,
+        size);
   }
 
   if (clp->size == 0)
@@ -710,6 +1609,9 @@ void pmemalloc_check(const char *path) {
     int state = clp->size & PMEM_STATE_MASK;
 
     DEBUG("[%u]clump size %lu state %d", REL_PTR(clp), sz, state);
+    if (state == PMEM_STATE_FREE && prevstate == PMEM_STATE_FREE)
+      freeruns++;
+    prevstate = state;
     if (sz > stats[PMEM_STATE_UNUSED].largest)
       stats[PMEM_STATE_UNUSED].largest = sz;
     if (stats[PMEM_STATE_UNUSED].smallest == 0
@@ -751,19 +1653,33 @@ void pmemalloc_check(const char *path) {
   else
     FATAL("clump list stopped at %lx instead of %lx", clp, lastclp);
 
-  if (munmap(pmp, stbuf.st_size) < 0)
-    FATALSYS("munmap");
-
   // print the report
   printf("Summary of pmem pool:\n");
-  printf("File size: %lu, %lu allocatable bytes in pool\n\n", stbuf.st_size,
-         clumptotal);
+  printf("File size: %lu, %lu extents, %lu allocatable bytes in pool\n\n",
+         size, hdrp->nextents, clumptotal);
   printf("     State      Bytes     Clumps    Largest   Smallest\n");
   for (i = 0; i < PMEM_STATE_UNUSED + 1; i++) {
     printf("%10s %10lu %10u %10lu %10lu\n", names[i], stats[i].bytes,
            stats[i].count, stats[i].largest, stats[i].smallest);
   }
 
+  // counters that are not persisted are left out
+  struct pmem_stats st = pmem_stats();
+  st.total_bytes = clumptotal;
+  st.free_bytes = stats[PMEM_STATE_FREE].bytes;
+  st.reserved_bytes = stats[PMEM_STATE_RESERVED].bytes;
+  st.active_bytes = stats[PMEM_STATE_ACTIVE].bytes;
+  st.free_clumps = stats[PMEM_STATE_FREE].count;
+  st.largest_free = stats[PMEM_STATE_FREE].largest;
+
+  printf("\n");
+  pmemalloc_print_stats(&st);
+  printf("Free runs: %lu, merged when the pool is opened\n", freeruns);
+
+  if (munmap(pmp, size) < 0)
+    FATALSYS("munmap");
+
+  return freeruns;
 }
 
 }
@@ -62,14 +62,14 @@ namespace storage {
 // size of the static area returned by pmem_static_area()
 #define PMEM_STATIC_SIZE 4096
 
-/* latency in ns */
-#define PCOMMIT_LATENCY 100
-
 // number of onactive/onfree values allowed
 #define PMEM_NUM_ON 3
 
 #define MAX_PTRS 512
 
+// clumps queued per batched activation
+#define PMEM_ACTIVATE_MAX 64
+
 extern void* pmp;
 
 struct static_info {
@@ -80,6 +80,33 @@ struct static_info {
 
 extern struct static_info* sp;
 
+// changes on every pmemalloc_init, tags volatile caches of pool data
+extern unsigned long pmem_boot;
+
+// reserved clumps waiting to be activated together
+struct activation {
+  unsigned int count;
+  void* ptrs[PMEM_ACTIVATE_MAX];
+};
+
+// allocation size buckets, powers of two from 64B up
+#define PMEM_STAT_BUCKETS 24
+
+// allocator counters, see pmemalloc_stats
+struct pmem_stats {
+  size_t total_bytes;  // allocatable bytes, clump headers included
+  size_t free_bytes;
+  size_t reserved_bytes;
+  size_t active_bytes;
+  size_t free_clumps;
+  size_t largest_free;
+  unsigned long allocs[PMEM_STAT_BUCKETS];  // requests per size bucket
+  unsigned long searches;  // first-fit searches of the free lists
+  unsigned long probes;  // free clumps looked at by those searches
+  unsigned long defrag_passes;  // full walks by the defragmenter
+  unsigned long defrag_merges;  // adjacent free clumps it merged
+};
+
 #define ABS_PTR(p) ((decltype(p))(pmp + (uintptr_t)p))
 #define REL_PTR(p) ((decltype(p))((uintptr_t)p - (uintptr_t)pmp))
 
@@ -88,34 +115,89 @@ extern struct static_info* sp;
 /* To match Mnemosyne and reuse trace processing tools */
 #define LIBPM 0x0000100000000000
 #define PMSIZE (2UL * 1024 * 1024 * 1024)
+/* address range held for the pool and every extent it grows by */
+#define PMEM_MAX_SIZE (1UL << 40)
+#define PMEM_MAX_EXTENTS 64
+
+// pmem_in_pool -- true for any address in the pool range, mapped or not
+static inline bool pmem_in_pool(void *addr) {
+  return (uintptr_t) addr - LIBPM < PMEM_MAX_SIZE;
+}
+
+/* 2MB pages, for pools backed by hugetlbfs or transparent huge pages */
+#define PMEM_HUGE_PAGE_SIZE (2UL * 1024 * 1024)
+
+// back the pool with 2MB pages, set before pmemalloc_init
+extern bool pmem_huge_pages;
 
-static inline void *
-pmem_map(int fd, size_t len) {
-  void *base;
+void *pmem_map(int fd, size_t off, size_t len, int prot);
+void pmem_prefault(void *addr, size_t len);
 
-  if ((base = mmap((caddr_t) LIBPM, len, PROT_READ | PROT_WRITE,
-  MAP_SHARED | MAP_POPULATE,
-                   fd, 0)) == MAP_FAILED)
-    return NULL;
+/* cache line write back primitives, best one is picked at startup */
+#define PMEM_FLUSH_CLFLUSH 0
+#define PMEM_FLUSH_CLFLUSHOPT 1
+#define PMEM_FLUSH_CLWB 2
+#define PMEM_FLUSH_TYPES 3
 
-  return base;
+extern int pmem_flush_type;
+extern const char* pmem_flush_names[PMEM_FLUSH_TYPES];
+
+static inline void pmem_clflush(void *addr) {
+  __builtin_ia32_clflush(addr);
+}
+
+/* encoded by hand so that no -mclflushopt/-mclwb build flag is needed */
+static inline void pmem_clflushopt(void *addr) {
+  asm volatile(".byte 0x66; clflush %0" : "+m" (*(volatile char *) addr));
+}
+
+static inline void pmem_clwb(void *addr) {
+  asm volatile(".byte 0x66; xsaveopt %0" : "+m" (*(volatile char *) addr));
 }
 
-static inline void pmem_flush_cache(void *addr, size_t len,
-                                    __attribute((unused)) int flags) {
+// pmem_flush -- write back the lines covering a range, without ordering
+static inline void pmem_flush(void *addr, size_t len) {
   uintptr_t uptr = (uintptr_t) addr & ~(ALIGN - 1);
   uintptr_t end = (uintptr_t) addr + len;
 
+  nvm_write((end - uptr + ALIGN - 1) / ALIGN);
+
   /* loop through 64B-aligned chunks covering the given range */
-  for (; uptr < end; uptr += ALIGN)
-    __builtin_ia32_clflush((void *) uptr);
+  switch (pmem_flush_type) {
+    case PMEM_FLUSH_CLWB:
+      for (; uptr < end; uptr += ALIGN)
+        pmem_clwb((void *) uptr);
+      break;
+
+    case PMEM_FLUSH_CLFLUSHOPT:
+      for (; uptr < end; uptr += ALIGN)
+        pmem_clflushopt((void *) uptr);
+      break;
+
+    default:
+      for (; uptr < end; uptr += ALIGN)
+        pmem_clflush((void *) uptr);
+      break;
+  }
 }
 
-static inline void pmem_persist(void *addr, size_t len, int flags) {
-  pmem_flush_cache(addr, len, flags);
+// pmem_drain -- wait for all earlier flushes to complete
+static inline void pmem_drain() {
   __builtin_ia32_sfence();
+
+  if (nvm_emulate)
+    pcommit();
 }
 
+static inline void pmem_persist(void *addr, size_t len,
+                                __attribute((unused)) int flags) {
+  pmem_flush(addr, len);
+  pmem_drain();
+}
+
+int pmem_flush_detect();
+bool pmem_flush_supported(int type);
+
 void debug(const char *file, int line, const char *func, const char *fmt, ...);
 void fatal(int err, const char *file, int line, const char *func,
            const char *fmt, ...);
@@ -124,8 +206,16 @@ void *pmemalloc_init(const char *path, size_t size);
 void *pmemalloc_static_area();
 void *pmemalloc_reserve(size_t size);
 void pmemalloc_activate(void *abs_ptr_);
+void pmemalloc_activate_add(struct activation* act, void *abs_ptr_);
+void pmemalloc_activate_batch(struct activation* act);
 void pmemalloc_free(void *abs_ptr_);
-void pmemalloc_check(const char *path);
+void *pmemalloc_arena_reserve(size_t size);
+void pmemalloc_arena_free(void *abs_ptr_);
+size_t pmemalloc_check(const char *path);
+void pmemalloc_stats(struct pmem_stats* st);
+void pmemalloc_defrag_start(unsigned int interval);
+void pmemalloc_defrag_stop();
+void pmemalloc_print_stats(const struct pmem_stats* st);
 unsigned int get_next_pp();
 
 }
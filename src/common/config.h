@@ -79,6 +79,25 @@ class config {
 
   int test_benchmark_mode;
 
+  // nvm emulation, latencies in ns and bandwidth in MB/s
+  bool nvm_emulate;
+  unsigned long nvm_write_latency;
+  unsigned long nvm_fence_latency;
+  unsigned long nvm_read_latency;
+  unsigned long nvm_bandwidth;
+
+  // pool backed by 2MB pages
+  bool huge_pages;
+
+  // ms between background defragmenter passes, 0 disables it
+  int defrag_interval;
+
+  // persistent index leaves with inner nodes in DRAM, OPT engines only
+  bool hybrid_index;
+
+  // hash tables for indexes that are never scanned
+  bool hash_index;
+
   engine_type etype;
   benchmark_type btype;
 };
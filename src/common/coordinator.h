@@ -7,6 +7,7 @@
 #include "config.h"
 #include "engine.h"
 #include "timer.h"
+#include "perf_counter.h"
 #include "utils.h"
 #include "database.h"
 #include "libpm.h"
@@ -33,16 +34,30 @@ class coordinator {
     for (unsigned int i = 0; i < num_executors; i++) {
       tms.push_back(timer()); //volatile
       sps.push_back(static_info()); // volatile
+      dtlb_misses.push_back(0); // volatile
     }
+    dtlb_valid = true;
   }
 
-  void execute_bh(benchmark* bh) {
+  void execute_bh(benchmark* bh, unsigned int tid) {
+    perf_counter loads(PERF_TYPE_HW_CACHE,
+                       PERF_DTLB_MISS(PERF_COUNT_HW_CACHE_OP_READ));
+    perf_counter stores(PERF_TYPE_HW_CACHE,
+                        PERF_DTLB_MISS(PERF_COUNT_HW_CACHE_OP_WRITE));
+
     // Load
     bh->load();
 
     // Execute
+    loads.start();
+    stores.start();
     bh->execute();
+    loads.end();
+    stores.end();
 
+    dtlb_misses[tid] = loads.total + stores.total;
+    if (!loads.valid())
+      dtlb_valid = false;
   }
 
   void eval(const config conf) {
@@ -63,13 +78,22 @@ class coordinator {
       partitions[i] = get_benchmark(conf, i, db);
     }
 
+    struct pmem_stats st;
+    if (conf.defrag_interval > 0) {
+      pmemalloc_stats(&st);
+      pmemalloc_print_stats(&st);
+      pmemalloc_defrag_start(conf.defrag_interval);
+    }
+
     for (unsigned int i = 0; i < num_executors; i++)
       executors.push_back(
-          std::thread(&coordinator::execute_bh, this, partitions[i]));
+          std::thread(&coordinator::execute_bh, this, partitions[i], i));
 
     for (unsigned int i = 0; i < num_executors; i++)
       executors[i].join();
 
+    pmemalloc_defrag_stop();
+
     double max_dur = 0;
     for (unsigned int i = 0; i < num_executors; i++) {
       std::cout << "dur :" << i << " :: " << tms[i].duration() << std::endl;
@@ -78,6 +102,19 @@ class coordinator {
     std::cout << "max dur :" << max_dur << std::endl;
     display_stats(conf.etype, max_dur, num_txns);
 
+    if (dtlb_valid) {
+      unsigned long long misses = 0;
+      for (unsigned int i = 0; i < num_executors; i++)
+        misses += dtlb_misses[i];
+      std::cout << "dTLB misses : " << misses << " Per txn : "
+                << (double) misses / num_txns << std::endl;
+    } else {
+      std::cout << "dTLB misses : unavailable" << std::endl;
+    }
+
+    pmemalloc_stats(&st);
+    pmemalloc_print_stats(&st);
+
   }
 
   void recover(const config conf) {
@@ -130,6 +167,9 @@ class coordinator {
   std::vector<struct static_info> sps;
   std::vector<timer> tms;
 
+  std::vector<unsigned long long> dtlb_misses;
+  bool dtlb_valid;
+
 };
 
 }
@@ -21,6 +21,7 @@
 #include <sys/param.h>
 #include <sys/uio.h>
 #include <sys/file.h>
+#include <sys/mman.h>
 
 #include <assert.h>
 #include <err.h>
@@ -34,6 +35,8 @@
 #include <time.h>
 #include <unistd.h>
 #include <cstring>
+#include <condition_variable>
+#include <mutex>
 
 #include "ptree.h"
 #include "libpm.h"
@@ -182,6 +185,14 @@ struct {                \
     (head)->sqh_last = &(head)->sqh_first;      \
 } while (0)
 
+#define SIMPLEQ_CONCAT(head1, head2) do {       \
+  if (!SIMPLEQ_EMPTY((head2))) {          \
+    *(head1)->sqh_last = (head2)->sqh_first;      \
+    (head1)->sqh_last = (head2)->sqh_last;      \
+    SIMPLEQ_INIT((head2));          \
+  }               \
+} while (0)
+
 /*
  * Tail queue definitions.
  */
@@ -772,6 +783,7 @@ enum cursor_op { /* cursor operations */
 
 struct cow_btree_stat {
   unsigned long long int hits; /* cache hits */
+  unsigned long long int misses; /* cache misses */
   unsigned long long int reads; /* page reads */
   unsigned int max_cache; /* max cached pages */
   unsigned int cache_size; /* current cache size */
@@ -789,7 +801,7 @@ struct cow_btree_stat {
 #define BT_MINKEYS   2
 #define BT_MAGIC   0xB3DBB3DB
 #define BT_VERSION   4
-#define MAXKEYSIZE   31
+#define MAXKEYSIZE   63 /* table and index prefix, and an index_key */
 
 #define P_INVALID  0xFFFFFFFF
 
@@ -860,12 +872,8 @@ struct btkey {
 };
 
 struct mpage { /* an in-memory cached page */
-  RB_ENTRY(mpage)
-  entry; /* page cache entry */
   SIMPLEQ_ENTRY(mpage)
   next; /* queue of dirty pages */
-  TAILQ_ENTRY(mpage)
-  lru_next; /* LRU queue */
   struct mpage *parent; /* NULL if root */
   unsigned int parent_index; /* keep track of cow_node index */
   struct btkey prefix;
@@ -873,13 +881,23 @@ struct mpage { /* an in-memory cached page */
   pgno_t pgno; /* copy of page->pgno */
   short ref; /* increased by cursors */
   short dirty; /* 1 if on dirty queue */
+  short accessed; /* CLOCK reference bit */
+  short pending; /* 1 if committed in a group not yet written */
 };
-RB_HEAD(page_cache, mpage);
 SIMPLEQ_HEAD(dirty_queue, mpage);
-TAILQ_HEAD(lru_queue, mpage);
 
-int mpage_cmp(struct mpage *a, struct mpage *b);
-RB_PROTOTYPE(page_cache, mpage, entry, mpage_cmp);
+/* The page cache is an open addressing hash table of pages keyed by page
+ * number, with linear probing. A CLOCK hand sweeps the slots to pick
+ * pages to evict.
+ */
+struct page_cache {
+  struct mpage **slots;
+  unsigned int mask; /* number of slots less one, a power of two */
+  unsigned int count; /* cached pages */
+  unsigned int hand; /* CLOCK hand, a slot index */
+};
+
+#define BT_CACHE_SLOTS   1024   /* initial number of page cache slots */
 
 struct ppage { /* ordered list of pages */
   SLIST_ENTRY(ppage)
@@ -938,6 +956,8 @@ struct cow_btree_txn {
 
 #define BT_COMMIT_PAGES  64 /* max number of pages to write in one commit */
 #define BT_MAXCACHE_DEF  1024*1024*16 /* max number of pages to keep in cache */
+#define BT_MAPSIZE   (1UL << 36) /* address space reserved to map the file */
+#define BT_GROUP_PAGES   4096 /* pending pages that force a group flush */
 
 class cow_btree {
  public:
@@ -947,14 +967,26 @@ class cow_btree {
   // File mode
   int fd;
   char *path;
+  char *map; /* read-only mapping of the file, NULL if unmapped */
 #define BT_FIXPADDING    0x01   /* internal */
   unsigned int flags;
   bt_cmp_func cmp; /* user compare function */
   struct bt_head head;
   struct bt_meta meta;
   struct page_cache *page_cache;
-  struct lru_queue *lru_queue;
   struct cow_btree_txn *txn; /* current write transaction */
+
+  // Group commit
+  struct dirty_queue *group_queue; /* pages of commits not yet written */
+  unsigned int group_pages;
+  pgno_t group_root; /* root of the last commit, P_INVALID if written */
+  pgno_t group_next_pgno;
+  unsigned long long commit_seq; /* last commit in a group */
+  unsigned long long durable_seq; /* last commit written and synced */
+  unsigned long long lost_seq; /* last commit lost by a failed flush */
+  std::mutex group_mutex;
+  std::condition_variable group_cond;
+
   int ref; /* increased by cursors & txn */
   struct cow_btree_stat stat;
   off_t size; /* current file size */
@@ -980,6 +1012,18 @@ class cow_btree {
       }
     }
 
+    /* Clean pages are read in place from a shared mapping that covers the
+     * file as it grows by appends.
+     */
+    map = NULL;
+    if (persist == false) {
+      map = (char*) mmap(NULL, BT_MAPSIZE, PROT_READ, MAP_SHARED, _fd, 0);
+      if (map == MAP_FAILED) {
+        DPRINTF("mmap: %s", strerror(errno));
+        map = NULL;
+      }
+    }
+
     flags = 0;
     //flags = 0 | BT_NOSYNC;
     flags &= ~BT_FIXPADDING;
@@ -987,18 +1031,20 @@ class cow_btree {
     meta.root = P_INVALID;
     txn = NULL;
 
+    if ((group_queue = new dirty_queue()) == NULL)
+      return BT_FAIL;
+    SIMPLEQ_INIT(group_queue);
+    group_pages = 0;
+    group_root = P_INVALID;
+    commit_seq = durable_seq = lost_seq = 0;
+
     if ((page_cache = new struct page_cache()) == NULL)
       goto fail;
     if (persist)
       pmemalloc_activate(page_cache);
     stat.max_cache = BT_MAXCACHE_DEF;
-    RB_INIT(page_cache);
-
-    if ((lru_queue = new struct lru_queue()) == NULL)
+    if (mpage_cache_init(BT_CACHE_SLOTS) != BT_SUCCESS)
       goto fail;
-    if (persist)
-      pmemalloc_activate(lru_queue);
-    TAILQ_INIT(lru_queue);
 
     if (cow_btree_read_header() != 0) {
       if (errno != ENOENT)
@@ -1013,7 +1059,7 @@ class cow_btree {
 
     return BT_SUCCESS;
 
-    fail: delete lru_queue;
+    fail: delete[] page_cache->slots;
     delete page_cache;
     return BT_FAIL;
   }
@@ -1151,56 +1197,156 @@ class cow_btree {
     }
   }
 
+  unsigned int mpage_slot(pgno_t pgno) {
+    return (pgno * 2654435761U) & page_cache->mask;
+  }
+
+  int mpage_cache_init(unsigned int nslots) {
+    if ((page_cache->slots = new struct mpage*[nslots]()) == NULL)
+      return BT_FAIL;
+    page_cache->mask = nslots - 1;
+    page_cache->count = 0;
+    page_cache->hand = 0;
+    stat.cache_size = 0;
+
+    return BT_SUCCESS;
+  }
+
+  /* Double the number of slots and rehash the cached pages.
+   */
+  void mpage_cache_grow() {
+    struct mpage **slots = page_cache->slots;
+    unsigned int nslots = page_cache->mask + 1;
+    unsigned int i, j;
+
+    page_cache->slots = new struct mpage*[2 * nslots]();
+    page_cache->mask = 2 * nslots - 1;
+    page_cache->hand = 0;
+
+    for (i = 0; i < nslots; i++) {
+      if (slots[i] == NULL)
+        continue;
+      for (j = mpage_slot(slots[i]->pgno); page_cache->slots[j] != NULL;
+          j = (j + 1) & page_cache->mask)
+        ;
+      page_cache->slots[j] = slots[i];
+    }
+
+    delete[] slots;
+  }
+
   struct mpage* mpage_lookup(pgno_t pgno) {
-    struct mpage find, *mp;
-
-    find.pgno = pgno;
-    mp = RB_FIND(page_cache, page_cache, &find);
-    /*
-     if (mp) {
-     stat.hits++;
-     // Update LRU queue. Move page to the end.
-     TAILQ_REMOVE(lru_queue, mp, lru_next);
-     TAILQ_INSERT_TAIL(lru_queue, mp, lru_next);
-     }
-     */
-    return mp;
+    struct mpage *mp;
+    unsigned int i;
+
+    for (i = mpage_slot(pgno); (mp = page_cache->slots[i]) != NULL;
+        i = (i + 1) & page_cache->mask) {
+      if (mp->pgno == pgno) {
+        stat.hits++;
+        mp->accessed = 1;
+        return mp;
+      }
+    }
+
+    stat.misses++;
+    return NULL;
   }
 
   void mpage_add(struct mpage *mp) {
+    unsigned int i;
+
     DPRINTF("page_cache : %p ", page_cache);
 
-    assert(RB_INSERT(page_cache, page_cache, mp) == NULL);
-    stat.cache_size++;
-    TAILQ_INSERT_TAIL(lru_queue, mp, lru_next);
+    if (4 * (page_cache->count + 1) > 3 * (page_cache->mask + 1))
+      mpage_cache_grow();
+
+    for (i = mpage_slot(mp->pgno); page_cache->slots[i] != NULL;
+        i = (i + 1) & page_cache->mask)
+      assert(page_cache->slots[i]->pgno != mp->pgno);
+
+    page_cache->slots[i] = mp;
+    page_cache->count++;
+    stat.cache_size = page_cache->count;
+    mp->accessed = 1;
+  }
+
+  /* Empty slot i, and shift back the pages that probed past it so that
+   * lookups still find them.
+   */
+  void mpage_remove_slot(unsigned int i) {
+    unsigned int j, k;
+
+    for (j = (i + 1) & page_cache->mask; page_cache->slots[j] != NULL;
+        j = (j + 1) & page_cache->mask) {
+      k = mpage_slot(page_cache->slots[j]->pgno);
+      /* Leave the page if its home slot lies cyclically in (i, j]. */
+      if ((i < j) ? (i < k && k <= j) : (i < k || k <= j))
+        continue;
+      page_cache->slots[i] = page_cache->slots[j];
+      i = j;
+    }
+
+    page_cache->slots[i] = NULL;
+    page_cache->count--;
+    stat.cache_size = page_cache->count;
   }
 
   void mpage_release(struct mpage *mp) {
 
     if (mp != NULL) {
       if (persist == false) {
-        delete mp->page;
+        if (!page_mapped(mp->page))
+          delete mp->page;
         delete mp;
       }
     }
   }
 
+  bool page_mapped(struct page *p) {
+    return (map != NULL && (char*) p >= map && (char*) p < map + BT_MAPSIZE);
+  }
+
+  /* Copy a page that is read from the mapping into its own buffer, before
+   * it is written.
+   */
+  void mpage_unmap(struct mpage *mp) {
+    struct page *p;
+
+    if (!page_mapped(mp->page))
+      return;
+
+    p = (page*) new char[head.psize];
+    bcopy(mp->page, p, head.psize);
+    mp->page = p;
+  }
+
   void mpage_del(struct mpage *mp) {
-    assert(RB_REMOVE(page_cache, page_cache, mp) == mp);
+    struct mpage *cmp;
+    unsigned int i;
 
-    if (stat.cache_size > 0 && !lru_queue) {
-      stat.cache_size--;
-      TAILQ_REMOVE(lru_queue, mp, lru_next);
+    for (i = mpage_slot(mp->pgno); (cmp = page_cache->slots[i]) != NULL;
+        i = (i + 1) & page_cache->mask) {
+      if (cmp == mp) {
+        mpage_remove_slot(i);
+        return;
+      }
     }
   }
 
   void mpage_flush() {
     struct mpage *mp;
+    unsigned int i;
 
-    while ((mp = RB_MIN(page_cache, page_cache)) != NULL) {
-      mpage_del(mp);
-      mpage_release(mp);
+    for (i = 0; i <= page_cache->mask; i++) {
+      if ((mp = page_cache->slots[i]) != NULL) {
+        page_cache->slots[i] = NULL;
+        mpage_release(mp);
+      }
     }
+
+    page_cache->count = 0;
+    page_cache->hand = 0;
+    stat.cache_size = 0;
   }
 
   struct mpage* mpage_copy(struct mpage *mp) {
@@ -1228,24 +1374,35 @@ class cow_btree {
     return copy;
   }
 
-  /* Remove the least recently used memory pages until the cache size is
-   * within the configured bounds. Pages referenced by cursors or returned
-   * key/data are not pruned.
+  /* Evict memory pages with the CLOCK hand until the cache size is within
+   * the configured bounds. A page touched since the hand last passed gets
+   * a second chance. Pages referenced by cursors or returned key/data, and
+   * dirty or pending pages, are not pruned.
    */
   void mpage_prune() {
-    struct mpage *mp, *next;
+    struct mpage *mp;
+    unsigned int scanned;
 
     if (persist)
       return;
 
-    for (mp = TAILQ_FIRST(lru_queue); mp; mp = next) {
-      if (stat.cache_size <= stat.max_cache)
-        break;
-      next = TAILQ_NEXT(mp, lru_next);
-      if (!mp->dirty && mp->ref <= 0) {
-        mpage_del(mp);
-        mpage_release(mp);
+    /* Two sweeps clear every reference bit, stop if all pages are pinned. */
+    for (scanned = 0; stat.cache_size > stat.max_cache
+        && scanned < 2 * (page_cache->mask + 1); scanned++) {
+      mp = page_cache->slots[page_cache->hand];
+
+      if (mp != NULL && !mp->dirty && !mp->pending && mp->ref <= 0) {
+        if (mp->accessed) {
+          mp->accessed = 0;
+        } else {
+          /* The slot may now hold a page shifted back, look again. */
+          mpage_remove_slot(page_cache->hand);
+          mpage_release(mp);
+          continue;
+        }
       }
+
+      page_cache->hand = (page_cache->hand + 1) & page_cache->mask;
     }
   }
 
@@ -1268,9 +1425,11 @@ class cow_btree {
 
     if (!mp->dirty) {
       DPRINTF("touching page %u -> %u", mp->pgno, txn->next_pgno);
-      if (mp->ref == 0)
+      /* A pending page stays as committed, an abort must not undo it. */
+      if (mp->ref == 0 && !mp->pending) {
         mpage_del(mp);
-      else {
+        mpage_unmap(mp);
+      } else {
         if ((mp = mpage_copy(mp)) == NULL)
           return NULL;
       }
@@ -1287,6 +1446,26 @@ class cow_btree {
     return mp;
   }
 
+  /* Returns page pgno in the mapping, or NULL if it is not mapped.
+   */
+  struct page* cow_btree_map_page(pgno_t pgno) {
+    struct page *p;
+    off_t off = (off_t) pgno * head.psize;
+
+    if (map == NULL || off + head.psize > size
+        || off + head.psize > (off_t) BT_MAPSIZE)
+      return NULL;
+
+    p = (struct page *) (map + off);
+    if (p->pgno != pgno) {
+      DPRINTF("page numbers don't match: %u != %u", pgno, p->pgno);
+      return NULL;
+    }
+
+    stat.reads++;
+    return p;
+  }
+
   int cow_btree_read_page(pgno_t pgno, struct page *page) {
     ssize_t rc;
 
@@ -1332,7 +1511,7 @@ class cow_btree {
     	  int ret = fsync(fd);
 
     	  // PCOMMIT
-    	  pcommit(PCOMMIT_LATENCY);
+    	  pcommit();
 
     	  return ret;
       }
@@ -1397,6 +1576,12 @@ class cow_btree {
     }
 
     _txn->root = meta.root;
+
+    /* Start from the last commit of the group, ahead of the file. */
+    if (group_root != P_INVALID) {
+      _txn->root = group_root;
+      _txn->next_pgno = group_next_pgno;
+    }
     DPRINTF("begin transaction on btree root page %u ", _txn->root);
 
     return _txn;
@@ -1435,7 +1620,28 @@ class cow_btree {
     delete _txn;
   }
 
+  /* Commit a transaction and wait for it to be on disk. Pages of earlier
+   * group commits are written first, they hold the lower page numbers.
+   */
   int txn_commit(struct cow_btree_txn *_txn) {
+    unsigned long long seq = 0;
+    int rc;
+
+    assert(_txn != NULL);
+
+    if (!persist && (_txn->flags & (BT_TXN_RDONLY | BT_TXN_ERROR)) == 0
+        && !SIMPLEQ_EMPTY(group_queue))
+      seq = mpage_group_take(_txn);
+
+    rc = txn_write(_txn);
+
+    if (seq != 0)
+      mpage_group_done(seq, rc);
+
+    return rc;
+  }
+
+  int txn_write(struct cow_btree_txn *_txn) {
     int n, done;
     ssize_t rc;
     off_t size;
@@ -1542,6 +1748,131 @@ class cow_btree {
     return BT_SUCCESS;
   }
 
+  /* Commit a transaction into the current group. Its pages are written
+   * later by cow_btree_group_flush(), with those of the other commits in
+   * the group, one meta page and one sync. Later transactions see the
+   * commit at once. Stores the commit's sequence number in *seqp, pass it
+   * to cow_btree_wait_durable() to learn when the commit is on disk.
+   */
+  int txn_commit_group(struct cow_btree_txn *_txn,
+                       unsigned long long *seqp) {
+    struct mpage *mp;
+
+    assert(_txn != NULL);
+
+    /* Pages of the persistent tree are durable at commit. */
+    if (persist) {
+      if (txn_commit(_txn) != BT_SUCCESS)
+        return BT_FAIL;
+
+      std::lock_guard<std::mutex> lock(group_mutex);
+      durable_seq = ++commit_seq;
+      if (seqp != NULL)
+        *seqp = commit_seq;
+      return BT_SUCCESS;
+    }
+
+    if (F_ISSET(_txn->flags, BT_TXN_RDONLY)) {
+      DPRINTF("attempt to commit read-only transaction");
+      cow_btree_txn_abort(_txn);
+      errno = EPERM;
+      return BT_FAIL;
+    }
+
+    if (F_ISSET(_txn->flags, BT_TXN_ERROR)) {
+      DPRINTF("error flag is set, can't commit");
+      cow_btree_txn_abort(_txn);
+      errno = EINVAL;
+      return BT_FAIL;
+    }
+
+    while (!SIMPLEQ_EMPTY(_txn->dirty_queue)) {
+      mp = SIMPLEQ_FIRST(_txn->dirty_queue);
+      SIMPLEQ_REMOVE_HEAD(_txn->dirty_queue, next);
+      mp->dirty = 0;
+      mp->pending = 1;
+      SIMPLEQ_INSERT_TAIL(group_queue, mp, next);
+      group_pages++;
+    }
+
+    group_root = _txn->root;
+    group_next_pgno = _txn->next_pgno;
+    {
+      std::lock_guard<std::mutex> lock(group_mutex);
+      commit_seq++;
+      if (seqp != NULL)
+        *seqp = commit_seq;
+    }
+
+    /* Nothing is left to discard, this only ends the transaction. */
+    cow_btree_txn_abort(_txn);
+
+    if (group_pages >= BT_GROUP_PAGES)
+      return cow_btree_group_flush();
+
+    return BT_SUCCESS;
+  }
+
+  /* Write the pages of all commits in the group, then a meta page for the
+   * last one, and sync. Fails with EBUSY while a write transaction is
+   * open. If the write fails the commits of the group are lost.
+   */
+  int cow_btree_group_flush() {
+    struct cow_btree_txn *_txn;
+
+    if (SIMPLEQ_EMPTY(group_queue))
+      return BT_SUCCESS;
+
+    /* An empty transaction on top of the group commits all of it. */
+    if ((_txn = txn_begin(0)) == NULL)
+      return BT_FAIL;
+
+    return txn_commit(_txn);
+  }
+
+  /* Move the pending pages ahead of the transaction's dirty pages, to be
+   * written with them. Returns the sequence number of the last commit.
+   */
+  unsigned long long mpage_group_take(struct cow_btree_txn *_txn) {
+    struct mpage *mp;
+
+    SIMPLEQ_FOREACH(mp, group_queue, next)
+    {
+      mp->pending = 0;
+      mp->dirty = 1;
+    }
+    SIMPLEQ_CONCAT(group_queue, _txn->dirty_queue);
+    SIMPLEQ_CONCAT(_txn->dirty_queue, group_queue);
+    group_pages = 0;
+    group_root = P_INVALID;
+
+    std::lock_guard<std::mutex> lock(group_mutex);
+    return commit_seq;
+  }
+
+  void mpage_group_done(unsigned long long seq, int rc) {
+    {
+      std::lock_guard<std::mutex> lock(group_mutex);
+      if (rc == BT_SUCCESS)
+        durable_seq = seq;
+      else
+        lost_seq = seq;
+    }
+    group_cond.notify_all();
+  }
+
+  /* Block until commit seq is on disk. Returns BT_FAIL if it was lost.
+   */
+  int cow_btree_wait_durable(unsigned long long seq) {
+    std::unique_lock<std::mutex> lock(group_mutex);
+
+    group_cond.wait(lock, [&] {
+      return (durable_seq >= seq || lost_seq >= seq);
+    });
+
+    return (durable_seq >= seq) ? BT_SUCCESS : BT_FAIL;
+  }
+
   int cow_btree_write_header() {
     struct stat sb;
     struct bt_head *h;
@@ -1835,10 +2166,13 @@ class cow_btree {
   void cow_btree_close() {
     if (--ref == 0) {
       DPRINTF("ref is zero, closing btree");
+      mpage_flush();
       if (persist == false) {
+        if (map != NULL)
+          munmap(map, BT_MAPSIZE);
+        map = NULL;
         close(fd);
       }
-      mpage_flush();
       //delete page_cache;
     } else {
       DPRINTF("ref is now %d ", ref);
@@ -1950,15 +2284,18 @@ class cow_btree {
 
       if (persist == false) {
         mp = new mpage();
-        mp->page = (page*) new char[head.psize];
 
-        if (cow_btree_read_page(pgno, mp->page) != BT_SUCCESS) {
-          mpage_release(mp);
-          return NULL;
+        if ((mp->page = cow_btree_map_page(pgno)) == NULL) {
+          mp->page = (page*) new char[head.psize];
+
+          if (cow_btree_read_page(pgno, mp->page) != BT_SUCCESS) {
+            mpage_release(mp);
+            return NULL;
+          }
         }
 
         mp->pgno = pgno;
-        //mpage_add(mp);
+        mpage_add(mp);
       } else {
         mp = mpages->at(pgno);
         //mpage_add(mp);
@@ -2193,7 +2530,6 @@ class cow_btree {
           || !F_ISSET(omp->page->flags, P_OVERFLOW)) {
         DPRINTF("read overflow page %u failed", pgno);
         delete (char*) data->data;
-        mpage_release(omp);
         return BT_FAIL;
       }
       psz = data->size - sz;
@@ -2287,9 +2623,6 @@ class cow_btree {
       key->data = new char[key->size];
       if (key->data == NULL)
         return -1;
-      if (persist) {
-        pmemalloc_activate(key->data);
-      }
 
       concat_prefix(mp->prefix.str, mp->prefix.len, (char*) NODEKEY(cow_node),
                     cow_node->ksize, (char*) key->data, &key->size);
@@ -2688,8 +3021,6 @@ class cow_btree {
       cursor->txn = txn;
       cow_btree_ref();
     }
-    if (persist)
-      pmemalloc_activate(cursor);
 
     return cursor;
   }
@@ -3629,6 +3960,9 @@ class cow_btree {
       }
     }
 
+    if (cow_btree_group_flush() != BT_SUCCESS)
+      return BT_FAIL;
+
     if ((_txn = txn_begin(0)) == NULL)
       return BT_FAIL;
 
@@ -3669,7 +4003,7 @@ class cow_btree {
       fsync(tmp_fd);
 
       // PCOMMIT
-      pcommit(PCOMMIT_LATENCY);
+      pcommit();
 
       DPRINTF("renaming %s to %s \n", compact_path.c_str(), path);
       if (rename(compact_path.c_str(), path) != 0)
@@ -3688,7 +4022,6 @@ class cow_btree {
       mpages = btc->mpages;
       meta = btc->meta;
       page_cache = btc->page_cache;
-      lru_queue = btc->lru_queue;
     }
 
     cow_btree_txn_abort(_txn);
@@ -3736,6 +4069,8 @@ class cow_btree {
     } else {
       ftruncate(fd, head.psize * meta.root);
       DPRINTF("truncating file at page %u", meta.root);
+      /* Page numbers past the end get reused, drop the cached ones. */
+      mpage_flush();
     }
 
     return 0;
@@ -3766,17 +4101,6 @@ class cow_btree {
     return &stat;
   }
 
-  RB_GENERATE(page_cache, mpage, entry, mpage_cmp)
-  ;
-
-  int mpage_cmp(struct mpage *a, struct mpage *b) {
-    if (a->pgno > b->pgno)
-      return 1;
-    if (a->pgno < b->pgno)
-      return -1;
-    return 0;
-  }
-
   int memncmp(const void *s1, size_t n1, const void *s2, size_t n2) {
     if (n1 < n2) {
       if (memcmp(s1, s2, n1) == 0)
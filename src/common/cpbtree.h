@@ -0,0 +1,696 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <functional>
+
+#include "libpm.h"
+#include "pbtree.h"
+
+namespace storage {
+
+/** Concurrent persistent B+ tree with optimistic lock coupling.
+ *
+ * Every node carries a version lock. Readers take no locks: they note the
+ * version of each node before reading it and restart when it has moved
+ * on, so a lookup never writes shared memory. Writers descend the same
+ * way and upgrade only the nodes they change. Full nodes are split on
+ * the way down, so a split needs at most the node and its parent.
+ *
+ * Erase does not merge nodes, so no node is ever freed while the tree is
+ * in use and readers need no reclamation scheme. An inner node gains a
+ * child by being copied: the copy is swapped into the grandparent and the
+ * old node is marked obsolete and kept for a later copy. Its version only
+ * grows, so a reader that still holds it fails validation.
+ *
+ * Nodes live in the pool. Each change persists new nodes before they are
+ * linked in, and the parent before the split node shrinks. A crash can
+ * leave a split node with stale copies of the keys it handed over, or a
+ * leaf with a key in two adjacent slots. The first access after the pool
+ * is reopened walks the tree once, drops such entries, relinks the leaves
+ * and clears lock bits left by threads that died. Obsolete nodes waiting
+ * for reuse are leaked by a crash.
+ */
+template<typename _Key, typename _Data,
+    typename _Traits = btree_default_map_traits<_Key, _Data> >
+class cpbtree {
+ public:
+  typedef _Key key_type;
+  typedef _Data data_type;
+  typedef _Traits traits;
+
+  static const unsigned short leafslotmax = traits::leafslots;
+  static const unsigned short innerslotmax = traits::innerslots;
+
+ private:
+  // version lock words, bit 1 is the lock and bit 0 marks obsolete nodes
+  static const uint64_t LOCKED = 0x2;
+  static const uint64_t OBSOLETE = 0x1;
+
+  struct node {
+    std::atomic<uint64_t> version;
+    unsigned short level;
+    unsigned short slotuse;
+
+    inline bool isleafnode() const {
+      return (level == 0);
+    }
+
+    // read_lock -- version to validate against, false if being written
+    inline bool read_lock(uint64_t* v) const {
+      *v = version.load(std::memory_order_acquire);
+      return (*v & (LOCKED | OBSOLETE)) == 0;
+    }
+
+    // check -- true if nothing changed since read_lock returned v
+    inline bool check(uint64_t v) const {
+      std::atomic_thread_fence(std::memory_order_acquire);
+      return (version.load(std::memory_order_relaxed) == v);
+    }
+
+    // upgrade -- write lock the node if it is still at version v
+    inline bool upgrade(uint64_t v) {
+      return version.compare_exchange_strong(v, v + LOCKED,
+                                             std::memory_order_acquire);
+    }
+
+    inline void unlock() {
+      version.fetch_add(LOCKED, std::memory_order_release);
+    }
+  };
+
+  struct inner_node : public node {
+    key_type slotkey[innerslotmax];
+    node* childid[innerslotmax + 1];
+
+    inline bool isfull() const {
+      return (node::slotuse == innerslotmax);
+    }
+  };
+
+  struct leaf_node : public node {
+    leaf_node* nextleaf;
+    key_type slotkey[leafslotmax];
+    data_type slotdata[leafslotmax];
+
+    inline bool isfull() const {
+      return (node::slotuse == leafslotmax);
+    }
+  };
+
+  /// Pointer to the root node, kept in the static area
+  node** m_root;
+
+  /// Number of key/data pairs, recounted on recovery
+  std::atomic<size_t> m_itemcount;
+
+  /// pmem_boot of the last recovery, see recover()
+  unsigned long m_boot;
+
+  /// Obsolete inner nodes, linked through childid[0], see retire()
+  inner_node* m_retired;
+
+ public:
+  explicit cpbtree(void** _root)
+      : m_root((node**) _root),
+        m_itemcount(0),
+        m_boot(pmem_boot),
+        m_retired(NULL) {
+    if ((*m_root) == NULL) {
+      (*m_root) = allocate_leaf();
+      pmem_persist(m_root, sizeof(node*), 0);
+    }
+  }
+
+  ~cpbtree() {
+    clear();
+    free_node(*m_root);
+    (*m_root) = NULL;
+  }
+
+  size_t size() {
+    check_boot();
+    return m_itemcount.load(std::memory_order_relaxed);
+  }
+
+  bool empty() {
+    return (size() == 0);
+  }
+
+  bool exists(const key_type& key) {
+    data_type val;
+    return at(key, &val);
+  }
+
+  /// Tries to return value if key is found.
+  bool at(const key_type& key, data_type* val) {
+    node* n;
+    uint64_t v, cv;
+    int slot;
+
+    check_boot();
+
+ restart:
+    n = (*m_root);
+    if (!n->read_lock(&v) || n != (*m_root))
+      goto restart;
+
+    while (!n->isleafnode()) {
+      inner_node* inner = static_cast<inner_node*>(n);
+      node* child = inner->childid[find_lower(inner, key)];
+
+      // the parent still routes here only if it did not change meanwhile
+      if (child == NULL || !child->read_lock(&cv) || !inner->check(v))
+        goto restart;
+
+      n = child;
+      v = cv;
+    }
+
+    leaf_node* leaf = static_cast<leaf_node*>(n);
+    slot = find_lower(leaf, key);
+
+    bool found = (slot < leaf->slotuse && leaf->slotkey[slot] == key);
+    data_type data = found ? leaf->slotdata[slot] : data_type();
+
+    if (!leaf->check(v))
+      goto restart;
+
+    if (found)
+      (*val) = data;
+    return found;
+  }
+
+  /// Inserts the pair if the key is not present, returns false otherwise.
+  bool insert(const key_type& key, const data_type& val) {
+    node *n, *child;
+    inner_node *parent, *gparent;
+    uint64_t v, pv, gpv, cv;
+    int slot;
+
+    check_boot();
+
+ restart:
+    parent = gparent = NULL;
+    pv = gpv = 0;
+    n = (*m_root);
+    if (!n->read_lock(&v) || n != (*m_root))
+      goto restart;
+
+    while (!n->isleafnode()) {
+      inner_node* inner = static_cast<inner_node*>(n);
+
+      if (inner->isfull()) {
+        split(gparent, gpv, parent, pv, inner, v);
+        goto restart;
+      }
+
+      if (parent != NULL && !parent->check(pv))
+        goto restart;
+
+      child = inner->childid[find_lower(inner, key)];
+      if (child == NULL || !child->read_lock(&cv) || !inner->check(v))
+        goto restart;
+
+      gparent = parent;
+      gpv = pv;
+      parent = inner;
+      pv = v;
+      n = child;
+      v = cv;
+    }
+
+    leaf_node* leaf = static_cast<leaf_node*>(n);
+
+    if (leaf->isfull()) {
+      split(gparent, gpv, parent, pv, leaf, v);
+      goto restart;
+    }
+
+    if (!leaf->upgrade(v))
+      goto restart;
+
+    if (parent != NULL && !parent->check(pv)) {
+      leaf->unlock();
+      goto restart;
+    }
+
+    slot = find_lower(leaf, key);
+    if (slot < leaf->slotuse && leaf->slotkey[slot] == key) {
+      leaf->unlock();
+      return false;
+    }
+
+    leaf_insert(leaf, slot, key, val);
+    leaf->unlock();
+
+    m_itemcount.fetch_add(1, std::memory_order_relaxed);
+    return true;
+  }
+
+  /// Erases the key, returns the number of pairs removed.
+  size_t erase(const key_type& key) {
+    node *n, *child;
+    uint64_t v, cv;
+    int slot;
+
+    check_boot();
+
+ restart:
+    n = (*m_root);
+    if (!n->read_lock(&v) || n != (*m_root))
+      goto restart;
+
+    while (!n->isleafnode()) {
+      inner_node* inner = static_cast<inner_node*>(n);
+
+      // the parent still routes here only if it did not change meanwhile
+      child = inner->childid[find_lower(inner, key)];
+      if (child == NULL || !child->read_lock(&cv) || !inner->check(v))
+        goto restart;
+
+      n = child;
+      v = cv;
+    }
+
+    leaf_node* leaf = static_cast<leaf_node*>(n);
+    if (!leaf->upgrade(v))
+      goto restart;
+
+    slot = find_lower(leaf, key);
+    if (slot >= leaf->slotuse || leaf->slotkey[slot] != key) {
+      leaf->unlock();
+      return 0;
+    }
+
+    // shift down over the slot, then drop the last one. Pair by pair, key
+    // before data, as in leaf_insert().
+    for (int i = slot; i < leaf->slotuse - 1; i++) {
+      leaf->slotkey[i] = leaf->slotkey[i + 1];
+      std::atomic_signal_fence(std::memory_order_seq_cst);
+      leaf->slotdata[i] = leaf->slotdata[i + 1];
+    }
+    pmem_persist(&leaf->slotkey[slot],
+                 (leaf->slotuse - 1 - slot) * sizeof(key_type), 0);
+    pmem_persist(&leaf->slotdata[slot],
+                 (leaf->slotuse - 1 - slot) * sizeof(data_type), 0);
+
+    leaf->slotuse--;
+    pmem_persist(&leaf->slotuse, sizeof(leaf->slotuse), 0);
+    leaf->unlock();
+
+    m_itemcount.fetch_sub(1, std::memory_order_relaxed);
+    return 1;
+  }
+
+  /// Frees every node but the root, not safe against concurrent use.
+  void clear() {
+    node* root = (*m_root);
+
+    if (!root->isleafnode()) {
+      inner_node* inner = static_cast<inner_node*>(root);
+      for (int i = 0; i <= inner->slotuse; i++)
+        free_subtree(inner->childid[i]);
+
+      (*m_root) = allocate_leaf();
+      pmem_persist(m_root, sizeof(node*), 0);
+      free_node(root);
+
+      while (m_retired != NULL) {
+        inner_node* next = static_cast<inner_node*>(m_retired->childid[0]);
+        free_node(m_retired);
+        m_retired = next;
+      }
+    } else {
+      root->slotuse = 0;
+      pmem_persist(&root->slotuse, sizeof(root->slotuse), 0);
+    }
+
+    m_itemcount = 0;
+  }
+
+ private:
+  // *** Node Search
+
+  template<typename node_type>
+  inline int find_lower(const node_type* n, const key_type& key) const {
+    int lo = 0;
+
+    nvm_read();
+
+    if (traits::simdsearch)
+      return key_search(n->slotkey, n->slotuse, key, false);
+
+    while (lo < n->slotuse && n->slotkey[lo] < key)
+      ++lo;
+    return lo;
+  }
+
+  // *** Node Allocation
+
+  leaf_node* allocate_leaf() {
+    leaf_node* n = (leaf_node*) pmalloc(sizeof(leaf_node));
+
+    new (&n->version) std::atomic<uint64_t>(0);
+    n->level = 0;
+    n->slotuse = 0;
+    n->nextleaf = NULL;
+    pmemalloc_activate(n);
+    return n;
+  }
+
+  inner_node* allocate_inner(unsigned short level) {
+    inner_node* n = reuse_inner();
+
+    // readers racing with a writer may see unused child slots
+    if (n == NULL) {
+      n = (inner_node*) pmalloc(sizeof(inner_node));
+      memset(n, 0, sizeof(inner_node));
+      new (&n->version) std::atomic<uint64_t>(0);
+      pmemalloc_activate(n);
+    }
+
+    n->level = level;
+    n->slotuse = 0;
+    return n;
+  }
+
+  // retire -- unlock a replaced inner node as obsolete, keep it for reuse
+  void retire(inner_node* n) {
+    std::lock_guard<std::mutex> lock(retired_mutex());
+
+    n->version.fetch_add(LOCKED + OBSOLETE, std::memory_order_release);
+    n->childid[0] = m_retired;
+    m_retired = n;
+  }
+
+  // reuse_inner -- an obsolete node, its version moved past every one a
+  // reader may still hold
+  inner_node* reuse_inner() {
+    std::lock_guard<std::mutex> lock(retired_mutex());
+    inner_node* n = m_retired;
+
+    if (n == NULL)
+      return NULL;
+
+    m_retired = static_cast<inner_node*>(n->childid[0]);
+    memset(n->childid, 0, sizeof(n->childid));
+    n->version.store((n->version.load(std::memory_order_relaxed)
+        | LOCKED | OBSOLETE) + 1, std::memory_order_release);
+    return n;
+  }
+
+  static std::mutex& retired_mutex() {
+    static std::mutex retired;
+    return retired;
+  }
+
+  void free_node(node* n) {
+    pfree(n);
+  }
+
+  void free_subtree(node* n) {
+    if (!n->isleafnode()) {
+      inner_node* inner = static_cast<inner_node*>(n);
+      for (int i = 0; i <= inner->slotuse; i++)
+        free_subtree(inner->childid[i]);
+    }
+
+    free_node(n);
+  }
+
+  // *** Node Modification, with the node write locked
+
+  /*
+   * leaf_insert -- fill the slot past the end, count it, then shift and
+   * fill the slot of the key. Before an append the slot past the end holds
+   * stale data. Otherwise it takes a copy of the last pair first, so until
+   * the new pair lands the leaf holds a doubled pair and loses none.
+   */
+  void leaf_insert(leaf_node* leaf, int slot, const key_type& key,
+                   const data_type& val) {
+    int use = leaf->slotuse;
+
+    leaf->slotdata[use] = (slot == use) ? val : leaf->slotdata[use - 1];
+    leaf->slotkey[use] = (slot == use) ? key : leaf->slotkey[use - 1];
+    pmem_persist(&leaf->slotdata[use], sizeof(data_type), 0);
+    pmem_persist(&leaf->slotkey[use], sizeof(key_type), 0);
+
+    leaf->slotuse = use + 1;
+    pmem_persist(&leaf->slotuse, sizeof(leaf->slotuse), 0);
+
+    if (slot == use)
+      return;
+
+    // pair by pair, data before key: of two copies of a key the later one
+    // has the right data. The fence keeps the compiler from splitting the
+    // loop into two moves.
+    for (int i = use - 1; i > slot; i--) {
+      leaf->slotdata[i] = leaf->slotdata[i - 1];
+      std::atomic_signal_fence(std::memory_order_seq_cst);
+      leaf->slotkey[i] = leaf->slotkey[i - 1];
+    }
+    if (use - 1 > slot) {
+      pmem_persist(&leaf->slotkey[slot + 1], (use - 1 - slot) * sizeof(key_type),
+                   0);
+      pmem_persist(&leaf->slotdata[slot + 1],
+                   (use - 1 - slot) * sizeof(data_type), 0);
+    }
+
+    leaf->slotdata[slot] = val;
+    pmem_persist(&leaf->slotdata[slot], sizeof(data_type), 0);
+    leaf->slotkey[slot] = key;
+    pmem_persist(&leaf->slotkey[slot], sizeof(key_type), 0);
+  }
+
+  /*
+   * inner_insert -- a persisted copy of inner with the separator key and
+   * the new right child after it. A crash amid an in place shift could
+   * drop the last child, the copy is swapped in with one pointer write.
+   */
+  inner_node* inner_insert(inner_node* inner, const key_type& key,
+                           node* child) {
+    int slot = find_lower(inner, key);
+    inner_node* copy = allocate_inner(inner->level);
+
+    for (int i = 0; i < inner->slotuse; i++)
+      copy->slotkey[i + (i >= slot)] = inner->slotkey[i];
+    for (int i = 0; i <= inner->slotuse; i++)
+      copy->childid[i + (i > slot)] = inner->childid[i];
+
+    copy->slotkey[slot] = key;
+    copy->childid[slot + 1] = child;
+    copy->slotuse = inner->slotuse + 1;
+    pmem_persist(copy, sizeof(inner_node), 0);
+    return copy;
+  }
+
+  // replace -- point the grandparent, or the root, at copy instead of n
+  void replace(inner_node* gparent, inner_node* n, inner_node* copy) {
+    if (gparent == NULL) {
+      (*m_root) = copy;
+      pmem_persist(m_root, sizeof(node*), 0);
+      return;
+    }
+
+    int slot = 0;
+    while (gparent->childid[slot] != n)
+      slot++;
+
+    gparent->childid[slot] = copy;
+    pmem_persist(&gparent->childid[slot], sizeof(node*), 0);
+  }
+
+  // unlock_all -- release the nodes locked by a split that gave up
+  static bool unlock_all(inner_node* gparent, inner_node* parent) {
+    if (parent != NULL)
+      parent->unlock();
+    if (gparent != NULL)
+      gparent->unlock();
+    return false;
+  }
+
+  /*
+   * split -- split a full node that was read at version v, under its
+   * parent and grandparent read at versions pv and gpv. The grandparent
+   * takes the copy of the parent. Returns false if any moved on.
+   */
+  bool split(inner_node* gparent, uint64_t gpv, inner_node* parent,
+             uint64_t pv, node* n, uint64_t v) {
+    node* sibling;
+    key_type sep;
+
+    if (gparent != NULL && !gparent->upgrade(gpv))
+      return false;
+
+    if (parent != NULL && !parent->upgrade(pv))
+      return unlock_all(gparent, NULL);
+
+    if (!n->upgrade(v))
+      return unlock_all(gparent, parent);
+
+    // only the current root may be split or replaced without a parent
+    if ((parent == NULL && n != (*m_root))
+        || (parent != NULL && gparent == NULL && parent != (*m_root))) {
+      n->unlock();
+      return unlock_all(gparent, parent);
+    }
+
+    if (n->isleafnode())
+      sibling = split_leaf(static_cast<leaf_node*>(n), &sep);
+    else
+      sibling = split_inner(static_cast<inner_node*>(n), &sep);
+
+    if (parent != NULL) {
+      replace(gparent, parent, inner_insert(parent, sep, sibling));
+    } else {
+      inner_node* root = allocate_inner(n->level + 1);
+      root->slotkey[0] = sep;
+      root->childid[0] = n;
+      root->childid[1] = sibling;
+      root->slotuse = 1;
+      pmem_persist(root, sizeof(inner_node), 0);
+
+      (*m_root) = root;
+      pmem_persist(m_root, sizeof(node*), 0);
+    }
+
+    // the upper half is reachable through the sibling, drop it here
+    if (n->isleafnode()) {
+      leaf_node* leaf = static_cast<leaf_node*>(n);
+      leaf->slotuse = leafslotmax / 2;
+      leaf->nextleaf = static_cast<leaf_node*>(sibling);
+      pmem_persist(leaf, sizeof(node) + sizeof(leaf_node*), 0);
+    } else {
+      n->slotuse = innerslotmax / 2;
+      pmem_persist(&n->slotuse, sizeof(n->slotuse), 0);
+    }
+
+    n->unlock();
+    if (parent != NULL)
+      retire(parent);
+    if (gparent != NULL)
+      gparent->unlock();
+    return true;
+  }
+
+  // split_leaf -- copy the upper half to a new persisted leaf
+  leaf_node* split_leaf(leaf_node* leaf, key_type* sep) {
+    leaf_node* sibling = allocate_leaf();
+    int mid = leafslotmax / 2;
+
+    for (int i = mid; i < leaf->slotuse; i++) {
+      sibling->slotkey[i - mid] = leaf->slotkey[i];
+      sibling->slotdata[i - mid] = leaf->slotdata[i];
+    }
+    sibling->slotuse = leaf->slotuse - mid;
+    sibling->nextleaf = leaf->nextleaf;
+    pmem_persist(sibling, sizeof(leaf_node), 0);
+
+    *sep = leaf->slotkey[mid - 1];
+    return sibling;
+  }
+
+  // split_inner -- move the keys above the middle one to a new node
+  inner_node* split_inner(inner_node* inner, key_type* sep) {
+    inner_node* sibling = allocate_inner(inner->level);
+    int mid = innerslotmax / 2;
+
+    for (int i = mid + 1; i < inner->slotuse; i++)
+      sibling->slotkey[i - mid - 1] = inner->slotkey[i];
+    for (int i = mid + 1; i <= inner->slotuse; i++)
+      sibling->childid[i - mid - 1] = inner->childid[i];
+    sibling->slotuse = inner->slotuse - mid - 1;
+    pmem_persist(sibling, sizeof(inner_node), 0);
+
+    *sep = inner->slotkey[mid];
+    return sibling;
+  }
+
+  // *** Recovery
+
+  inline void check_boot() {
+    if (m_boot != pmem_boot)
+      recover();
+  }
+
+  // recover -- repair the tree once after the pool is reopened
+  void recover() {
+    static std::mutex recover_mutex;
+    std::lock_guard<std::mutex> lock(recover_mutex);
+    leaf_node* prev = NULL;
+    size_t count = 0;
+
+    if (m_boot == pmem_boot)
+      return;
+
+    // nodes waiting for reuse are unreachable, and so leaked
+    m_retired = NULL;
+
+    repair(*m_root, NULL, &prev, &count);
+    if (prev != NULL) {
+      prev->nextleaf = NULL;
+      pmem_persist(&prev->nextleaf, sizeof(leaf_node*), 0);
+    }
+
+    m_itemcount = count;
+    m_boot = pmem_boot;
+  }
+
+  // repair -- walk the subtree whose keys are <= *bound, in key order
+  void repair(node* n, const key_type* bound, leaf_node** prev,
+              size_t* count) {
+    n->version.store(0, std::memory_order_relaxed);
+
+    if (n->isleafnode()) {
+      leaf_node* leaf = static_cast<leaf_node*>(n);
+      int use = 0;
+
+      // drop stale copies of an unfinished split and doubled slots
+      for (int i = 0; i < leaf->slotuse; i++) {
+        if (bound != NULL && *bound < leaf->slotkey[i])
+          break;
+        // of two copies the later one has the right data
+        if (use > 0 && leaf->slotkey[use - 1] == leaf->slotkey[i]) {
+          leaf->slotdata[use - 1] = leaf->slotdata[i];
+          continue;
+        }
+        leaf->slotkey[use] = leaf->slotkey[i];
+        leaf->slotdata[use] = leaf->slotdata[i];
+        use++;
+      }
+
+      if (use != leaf->slotuse) {
+        leaf->slotuse = use;
+        pmem_persist(leaf, sizeof(leaf_node), 0);
+      }
+
+      if ((*prev) != NULL && (*prev)->nextleaf != leaf) {
+        (*prev)->nextleaf = leaf;
+        pmem_persist(&(*prev)->nextleaf, sizeof(leaf_node*), 0);
+      }
+
+      (*prev) = leaf;
+      (*count) += use;
+      return;
+    }
+
+    inner_node* inner = static_cast<inner_node*>(n);
+    int use = 0;
+
+    while (use < inner->slotuse
+        && (bound == NULL || inner->slotkey[use] < *bound))
+      use++;
+
+    if (use != inner->slotuse) {
+      inner->slotuse = use;
+      pmem_persist(&inner->slotuse, sizeof(inner->slotuse), 0);
+    }
+
+    for (int i = 0; i <= use; i++)
+      repair(inner->childid[i], (i < use) ? &inner->slotkey[i] : bound, prev,
+             count);
+  }
+};
+
+}
@@ -3,6 +3,7 @@
 #include "config.h"
 #include "table.h"
 #include "plist.h"
+#include "pvector.h"
 #include "cow_pbtree.h"
 #include <set>
 
@@ -18,8 +19,7 @@ class database {
     sp->itr++;
 
     // TABLES
-    plist<table*>* _tables = new ((plist<table*>*) pmalloc(sizeof(plist<table*>))) plist<table*>(&sp->ptrs[get_next_pp()],
-                                               					&sp->ptrs[get_next_pp()]);
+    pvector<table*>* _tables = new ((pvector<table*>*) pmalloc(sizeof(pvector<table*>))) pvector<table*>(&sp->ptrs[get_next_pp()]);
     pmemalloc_activate(_tables);
     tables = _tables;
 
@@ -62,6 +62,11 @@ class database {
           NULL);
     }
 
+    // Rebuild the volatile table and index lookup caches
+    tables->reload();
+    for (table* tab : tables->get_data())
+      tab->indices->reload();
+
     // Clear all table data and indices
     if (conf.etype == engine_type::WAL || conf.etype == engine_type::LSM) {
       std::vector<table*> tab_vec = tables->get_data();
@@ -70,15 +75,28 @@ class database {
         tab->pm_data->clear();
         std::vector<table_index*> indices = tab->indices->get_data();
         for (table_index* index : indices) {
-          index->pm_map->clear();
-          index->off_map->clear();
+          index->clear();
         }
       }
     }
 
   }
 
-  plist<table*>* tables;
+  // Rebuild the DRAM inner nodes of hybrid indices, which a crash loses.
+  // Returns the time taken in ms.
+  double rebuild_indices() {
+    double duration = 0;
+
+    for (table* tab : tables->get_data()) {
+      for (table_index* index : tab->indices->get_data()) {
+        duration += index->map->rebuild();
+      }
+    }
+
+    return duration;
+  }
+
+  pvector<table*>* tables;
   plist<char*>* log;
 
   // SP and OPT_SP
@@ -60,6 +60,14 @@ class engine {
     return (de->select(st));
   }
 
+  virtual std::vector<std::string> scan(const statement& st) {
+    return (de->scan(st));
+  }
+
+  virtual std::vector<std::string> multi_select(const statement& st) {
+    return (de->multi_select(st));
+  }
+
   virtual int insert(const statement& st) {
     return (de->insert(st));
   }
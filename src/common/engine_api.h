@@ -1,6 +1,7 @@
 #pragma once
 
 #include <string>
+#include <vector>
 #include "statement.h"
 
 namespace storage {
@@ -10,6 +11,8 @@ class engine_api {
   virtual ~engine_api() {}
 
   virtual std::string select(const statement& st) = 0;
+  virtual std::vector<std::string> scan(const statement& st) = 0;
+  virtual std::vector<std::string> multi_select(const statement& st) = 0;
   virtual int insert(const statement& st) = 0;
   virtual int remove(const statement& st) = 0;
   virtual int update(const statement& st) = 0;
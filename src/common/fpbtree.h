@@ -0,0 +1,927 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <iterator>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "libpm.h"
+#include "pbtree.h"
+
+namespace storage {
+
+#define FPBTREE_LEAF_SLOTS 48 /* bitmap, link and fingerprints fill a line */
+#define FPBTREE_MAX_HEIGHT 16
+
+/// Lookups walked in lockstep by multi_at()
+#define FPBTREE_PREFETCH_GROUP 16
+
+/// Leaves scanned per thread when the inner nodes are rebuilt
+#define FPBTREE_REBUILD_CHUNK (16 * 1024)
+
+/** Persistent B+ tree with unsorted, fingerprinted leaves.
+ *
+ * Leaf slots are not kept in key order. Each leaf has an occupancy bitmap
+ * and a one byte fingerprint per slot, which share the first cache line
+ * with the link to the next leaf. Insert fills a free slot, persists it
+ * and commits by setting its bit, a single 8 byte persist of the first
+ * line. Erase clears the bit. Nothing is ever shifted. Lookups compare the
+ * fingerprints with vector compares and only read the keys that match.
+ *
+ * Inner nodes are sorted. They live in the pool, or in DRAM after
+ * enable_hybrid(). A leaf split copies the upper half to a new leaf,
+ * persists and links it, adds it to the parent and only then drops the
+ * moved slots from the old leaf with one bitmap write. An inner node in
+ * the pool is never shifted in place, the parent is pointed at a copy
+ * with the new child. The first access
+ * after the pool is reopened repairs a split that a crash left half done,
+ * or rebuilds the inner nodes of a hybrid tree from the leaf chain.
+ *
+ * Erase does not merge leaves. Iterators visit the pairs in key order,
+ * sorting each leaf as they enter it.
+ */
+template<typename _Key, typename _Data,
+    typename _Traits = btree_default_map_traits<_Key, _Data> >
+class fpbtree {
+ public:
+  typedef _Key key_type;
+  typedef _Data data_type;
+  typedef _Traits traits;
+  typedef std::pair<key_type, data_type> value_type;
+
+  static const unsigned short leafslotmax = FPBTREE_LEAF_SLOTS;
+  static const unsigned short innerslotmax = traits::innerslots;
+
+ private:
+  static const unsigned long LEAF_FULL = (1UL << leafslotmax) - 1;
+
+  struct inner_node {
+    unsigned short level;
+    unsigned short slotuse;
+    key_type slotkey[innerslotmax];
+    void* childid[innerslotmax + 1];
+  };
+
+  struct leaf_node {
+    unsigned long bitmap;
+    leaf_node* nextleaf;
+    unsigned char fingerprint[leafslotmax];
+    key_type slotkey[leafslotmax];
+    data_type slotdata[leafslotmax];
+  };
+
+  /// Static area slot with the head leaf, which never changes on split
+  leaf_node** m_head;
+
+  /// Root node, the head leaf while the tree has a single leaf
+  void* m_root;
+
+  /// Levels of inner nodes, derived from the root on recovery
+  unsigned short m_height;
+
+  /// Number of key/data pairs, recounted on recovery
+  size_t m_itemcount;
+
+  // Persistence mode
+  bool persist = true;
+
+  /// Hybrid mode: inner nodes live in DRAM and are rebuilt from the leaves
+  bool hybrid = false;
+
+  /// pmem_boot when the tree was last checked, see recover()
+  unsigned long m_boot;
+
+ public:
+  /// Forward iterator over the pairs in key order
+  class iterator {
+   public:
+    typedef std::forward_iterator_tag iterator_category;
+    typedef typename fpbtree::value_type value_type;
+    typedef ptrdiff_t difference_type;
+    typedef value_type* pointer;
+    typedef value_type& reference;
+
+    iterator()
+        : leaf(NULL),
+          pos(0),
+          count(0) {
+    }
+
+    explicit iterator(leaf_node* _leaf)
+        : leaf(_leaf),
+          pos(0),
+          count(0) {
+      enter();
+    }
+
+    inline value_type operator*() const {
+      return value_type(key(), data());
+    }
+
+    inline const key_type& key() const {
+      return leaf->slotkey[order[pos]];
+    }
+
+    inline data_type& data() const {
+      return leaf->slotdata[order[pos]];
+    }
+
+    inline iterator& operator++() {
+      if (++pos >= count) {
+        leaf = leaf->nextleaf;
+        enter();
+      }
+      return *this;
+    }
+
+    inline iterator operator++(int) {
+      iterator tmp = *this;
+      ++(*this);
+      return tmp;
+    }
+
+    inline bool operator==(const iterator& x) const {
+      return (leaf == x.leaf && pos == x.pos);
+    }
+
+    inline bool operator!=(const iterator& x) const {
+      return (leaf != x.leaf || pos != x.pos);
+    }
+
+   private:
+    friend class fpbtree;
+
+    leaf_node* leaf;
+    unsigned short pos;
+    unsigned short count;
+    unsigned char order[leafslotmax];
+
+    // enter -- sort the slots of the current leaf, skipping empty leaves
+    void enter() {
+      pos = 0;
+      while (leaf != NULL && (count = sort_slots(leaf, order)) == 0)
+        leaf = leaf->nextleaf;
+    }
+  };
+
+  typedef iterator const_iterator;
+
+  explicit fpbtree(void** _head)
+      : m_head((leaf_node**) _head),
+        m_root(NULL),
+        m_height(0),
+        m_itemcount(0),
+        m_boot(pmem_boot) {
+    (*m_head) = allocate_leaf();
+    pmem_persist(m_head, sizeof(leaf_node*), 0);
+
+    m_root = (*m_head);
+    pmem_persist(this, sizeof(*this), 0);
+  }
+
+  ~fpbtree() {
+    clear();
+    free_leaf(*m_head);
+    (*m_head) = NULL;
+  }
+
+  inline size_t size() {
+    check_boot();
+    return m_itemcount;
+  }
+
+  inline bool empty() {
+    return (size() == 0);
+  }
+
+  iterator begin() {
+    check_boot();
+    return iterator(*m_head);
+  }
+
+  iterator end() {
+    return iterator();
+  }
+
+  bool exists(const key_type& key) {
+    data_type val;
+    return at(key, &val);
+  }
+
+  /// Tries to return value if key is found.
+  bool at(const key_type& key, data_type* val) {
+    check_boot();
+
+    leaf_node* leaf = find_leaf(key, NULL);
+    int slot = leaf_find(leaf, key);
+
+    if (slot < 0)
+      return false;
+
+    (*val) = leaf->slotdata[slot];
+    return true;
+  }
+
+  /// Looks up count keys, setting found[i] and vals[i] for each. The
+  /// lookups descend one level at a time, prefetching the next node of
+  /// every lookup before any of them reads it, so their misses overlap.
+  /// Returns the number of keys found.
+  size_t multi_at(const key_type* keys, size_t count, data_type* vals,
+                  bool* found) {
+    void* nodes[FPBTREE_PREFETCH_GROUP];
+    unsigned long match[FPBTREE_PREFETCH_GROUP];
+    size_t hits = 0;
+
+    check_boot();
+
+    for (size_t base = 0; base < count; base += FPBTREE_PREFETCH_GROUP) {
+      size_t group = std::min(count - base, (size_t) FPBTREE_PREFETCH_GROUP);
+      const key_type* gkeys = &keys[base];
+
+      for (size_t i = 0; i < group; i++)
+        nodes[i] = m_root;
+
+      for (unsigned short depth = 0; depth < m_height; ++depth) {
+        bool to_leaf = (depth + 1 == m_height);
+
+        for (size_t i = 0; i < group; i++) {
+          inner_node* inner = static_cast<inner_node*>(nodes[i]);
+          nodes[i] = inner->childid[find_lower(inner, gkeys[i])];
+
+          // a leaf is matched on its first line alone
+          prefetch(nodes[i], to_leaf ? 1 : sizeof(inner_node));
+        }
+      }
+
+      // fingerprints of every leaf, then the keys they point at
+      for (size_t i = 0; i < group; i++) {
+        leaf_node* leaf = static_cast<leaf_node*>(nodes[i]);
+        match[i] = key_search_fp(leaf->fingerprint, leafslotmax,
+                                 fingerprint(gkeys[i])) & leaf->bitmap;
+        nvm_read();
+
+        if (match[i]) {
+          prefetch(&leaf->slotkey[__builtin_ctzl(match[i])], sizeof(key_type));
+          prefetch(&leaf->slotdata[__builtin_ctzl(match[i])], 1);
+        }
+      }
+
+      for (size_t i = 0; i < group; i++) {
+        leaf_node* leaf = static_cast<leaf_node*>(nodes[i]);
+        found[base + i] = false;
+
+        for (unsigned long bits = match[i]; bits; bits &= bits - 1) {
+          int slot = __builtin_ctzl(bits);
+          if (leaf->slotkey[slot] == gkeys[i]) {
+            vals[base + i] = leaf->slotdata[slot];
+            found[base + i] = true;
+            hits++;
+            break;
+          }
+        }
+      }
+    }
+
+    return hits;
+  }
+
+  /// Iterator to the first pair not less than key, or end().
+  iterator lower_bound(const key_type& key) {
+    check_boot();
+
+    iterator itr(find_leaf(key, NULL));
+    while (itr != end() && itr.key() < key)
+      ++itr;
+    return itr;
+  }
+
+  /// Inserts the pair if the key is not present, returns false otherwise.
+  bool insert(const key_type& key, const data_type& val) {
+    inner_node* path[FPBTREE_MAX_HEIGHT];
+    unsigned long moved;
+    key_type sep;
+
+    check_boot();
+
+    leaf_node* leaf = find_leaf(key, path);
+    if (leaf_find(leaf, key) >= 0)
+      return false;
+
+    if (leaf->bitmap == LEAF_FULL) {
+      leaf_node* sibling = split_leaf(leaf, &sep, &moved);
+      insert_parent(path, m_height, sep, sibling);
+
+      // the upper half is reachable through the sibling, drop it here
+      leaf->bitmap &= ~moved;
+      persist_leaf(&leaf->bitmap, sizeof(unsigned long));
+
+      if (sep < key)
+        leaf = sibling;
+    }
+
+    leaf_insert(leaf, key, val);
+    m_itemcount++;
+    return true;
+  }
+
+  /// Tries to set value if key is found. A value wider than 8 bytes is
+  /// not replaced atomically.
+  int update(const key_type& key, const data_type& val) {
+    check_boot();
+
+    leaf_node* leaf = find_leaf(key, NULL);
+    int slot = leaf_find(leaf, key);
+
+    if (slot < 0)
+      return -1;
+
+    leaf->slotdata[slot] = val;
+    persist_leaf(&leaf->slotdata[slot], sizeof(data_type));
+    return 0;
+  }
+
+  /// Erases the key, returns the number of pairs removed.
+  size_t erase(const key_type& key) {
+    check_boot();
+
+    leaf_node* leaf = find_leaf(key, NULL);
+    int slot = leaf_find(leaf, key);
+
+    if (slot < 0)
+      return 0;
+
+    leaf->bitmap &= ~(1UL << slot);
+    persist_leaf(&leaf->bitmap, sizeof(unsigned long));
+
+    m_itemcount--;
+    return 1;
+  }
+
+  /// Frees every node but the head leaf
+  void clear() {
+    check_boot();
+
+    void* root = m_root;
+    unsigned short height = m_height;
+    leaf_node* head = (*m_head);
+    leaf_node* leaf = head->nextleaf;
+
+    m_root = head;
+    m_height = 0;
+    persist_root();
+
+    head->bitmap = 0;
+    head->nextleaf = NULL;
+    persist_leaf(head, 2 * sizeof(void*));
+
+    if (height > 0)
+      free_inner(static_cast<inner_node*>(root), height);
+
+    while (leaf != NULL) {
+      leaf_node* next = leaf->nextleaf;
+      free_leaf(leaf);
+      leaf = next;
+    }
+
+    m_itemcount = 0;
+  }
+
+  // Disable persistence
+  void disable_persistence() {
+    persist = false;
+  }
+
+  /// Keep only the leaves in the pool, the tree must be empty
+  void enable_hybrid() {
+    hybrid = true;
+    pmem_persist(&hybrid, sizeof(bool), 0);
+  }
+
+  inline bool is_hybrid() const {
+    return hybrid;
+  }
+
+  /// Build the inner nodes of a hybrid tree afresh from the persistent leaf
+  /// chain. The leaves are scanned by several threads. Returns the time
+  /// taken in ms.
+  double rebuild() {
+    std::chrono::time_point<std::chrono::steady_clock> start =
+        std::chrono::steady_clock::now();
+
+    if (!hybrid)
+      return 0;
+
+    // inner nodes from this run are still there to free
+    if (m_boot == pmem_boot && m_height > 0)
+      free_inner(static_cast<inner_node*>(m_root), m_height);
+    m_boot = pmem_boot;
+
+    std::vector<leaf_node*> leaves;
+    for (leaf_node* leaf = (*m_head); leaf != NULL; leaf = leaf->nextleaf)
+      leaves.push_back(leaf);
+
+    // smallest and largest key of each leaf, for separators and repair
+    std::vector<key_type> lo(leaves.size()), hi(leaves.size());
+    std::vector<unsigned short> count(leaves.size());
+
+    unsigned int num_threads = std::max(1U, std::min(
+        std::thread::hardware_concurrency(),
+        (unsigned int) (leaves.size() / FPBTREE_REBUILD_CHUNK)));
+    std::vector<std::thread> threads;
+
+    for (unsigned int t = 0; t < num_threads; ++t) {
+      threads.push_back(std::thread([&, t]() {
+        unsigned char order[leafslotmax];
+
+        for (size_t i = t * leaves.size() / num_threads;
+            i < (t + 1) * leaves.size() / num_threads; ++i) {
+          count[i] = sort_slots(leaves[i], order);
+          if (count[i] > 0) {
+            lo[i] = leaves[i]->slotkey[order[0]];
+            hi[i] = leaves[i]->slotkey[order[count[i] - 1]];
+          }
+        }
+      }));
+    }
+    for (std::thread& thread : threads)
+      thread.join();
+
+    // drop empty leaves and the copies left in a leaf by an unfinished split
+    std::vector<std::pair<void*, key_type> > nodes;
+    leaf_node* prev = NULL;
+    m_itemcount = 0;
+
+    for (size_t i = 0; i < leaves.size(); ++i) {
+      if (count[i] == 0 && !(i + 1 == leaves.size() && prev == NULL)) {
+        unlink_leaf(prev, leaves[i]);
+        continue;
+      }
+
+      if (count[i] > 0 && i + 1 < leaves.size() && count[i + 1] > 0
+          && !(hi[i] < lo[i + 1])) {
+        count[i] = trim_leaf(leaves[i], lo[i + 1]);
+        hi[i] = max_key(leaves[i]);
+      }
+
+      m_itemcount += count[i];
+      nodes.push_back(std::make_pair((void*) leaves[i], hi[i]));
+      prev = leaves[i];
+    }
+
+    m_root = build_levels(nodes, &m_height);
+    return std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - start).count();
+  }
+
+ private:
+  // *** Node Search
+
+  static inline unsigned char fingerprint(const key_type& key) {
+    return (unsigned char) ((std::hash<key_type>()(key) * 0x9e3779b97f4a7c15UL)
+        >> 56);
+  }
+
+  inline int find_lower(const inner_node* n, const key_type& key) const {
+    int lo = 0;
+
+    // one dependent node load per level, inner nodes of a hybrid tree
+    // are in DRAM
+    if (!hybrid)
+      nvm_read();
+
+    if (traits::simdsearch)
+      return key_search(n->slotkey, n->slotuse, key, false);
+
+    while (lo < n->slotuse && n->slotkey[lo] < key)
+      ++lo;
+    return lo;
+  }
+
+  // prefetch -- bring the lines of [addr, addr + len) towards the cache
+  static inline void prefetch(const void* addr, size_t len) {
+    const char* line = (const char*) addr;
+
+    for (size_t off = 0; off < len; off += ALIGN)
+      __builtin_prefetch(line + off);
+  }
+
+  // find_leaf -- descend to the leaf for key, noting the inner nodes
+  leaf_node* find_leaf(const key_type& key, inner_node** path) const {
+    void* n = m_root;
+
+    for (unsigned short depth = 0; depth < m_height; ++depth) {
+      inner_node* inner = static_cast<inner_node*>(n);
+      if (path != NULL)
+        path[depth] = inner;
+      n = inner->childid[find_lower(inner, key)];
+    }
+
+    return static_cast<leaf_node*>(n);
+  }
+
+  // leaf_find -- slot of key in the leaf, or -1
+  inline int leaf_find(const leaf_node* leaf, const key_type& key) const {
+    unsigned long match = key_search_fp(leaf->fingerprint, leafslotmax,
+                                        fingerprint(key)) & leaf->bitmap;
+
+    nvm_read();
+
+    while (match) {
+      int slot = __builtin_ctzl(match);
+      if (leaf->slotkey[slot] == key)
+        return slot;
+      match &= match - 1;
+    }
+
+    return -1;
+  }
+
+  // sort_slots -- used slots of the leaf in key order, returns their count
+  static unsigned short sort_slots(const leaf_node* leaf,
+                                   unsigned char* order) {
+    unsigned long bits = leaf->bitmap;
+    unsigned short count = 0;
+
+    while (bits) {
+      order[count++] = __builtin_ctzl(bits);
+      bits &= bits - 1;
+    }
+
+    std::sort(order, order + count, [leaf](unsigned char a, unsigned char b) {
+      return leaf->slotkey[a] < leaf->slotkey[b];
+    });
+    return count;
+  }
+
+  static key_type max_key(const leaf_node* leaf) {
+    unsigned long bits = leaf->bitmap;
+    key_type key = leaf->slotkey[__builtin_ctzl(bits)];
+
+    for (bits &= bits - 1; bits; bits &= bits - 1)
+      key = std::max(key, leaf->slotkey[__builtin_ctzl(bits)]);
+    return key;
+  }
+
+  // *** Node Allocation
+
+  inline void persist_leaf(void* addr, size_t len) {
+    if (persist)
+      pmem_persist(addr, len, 0);
+  }
+
+  inline void persist_inner(void* addr, size_t len) {
+    if (persist && !hybrid)
+      pmem_persist(addr, len, 0);
+  }
+
+  inline void persist_inner(inner_node* n) {
+    persist_inner(n, sizeof(inner_node));
+  }
+
+  inline void persist_root() {
+    if (persist && !hybrid)
+      pmem_persist(&m_root, sizeof(void*), 0);
+  }
+
+  leaf_node* allocate_leaf() {
+    leaf_node* n = (leaf_node*) pmalloc(sizeof(leaf_node));
+
+    n->bitmap = 0;
+    n->nextleaf = NULL;
+    if (persist)
+      pmemalloc_activate(n);
+    return n;
+  }
+
+  inner_node* allocate_inner(unsigned short level) {
+    inner_node* n;
+
+    if (hybrid) {
+      n = new inner_node;
+    } else {
+      n = (inner_node*) pmalloc(sizeof(inner_node));
+      if (persist)
+        pmemalloc_activate(n);
+    }
+
+    n->level = level;
+    n->slotuse = 0;
+    return n;
+  }
+
+  void free_leaf(leaf_node* n) {
+    pfree(n);
+  }
+
+  // free_inner -- free the inner nodes of the subtree, not the leaves
+  void free_inner(inner_node* n, unsigned short level) {
+    if (level > 1)
+      for (unsigned short i = 0; i <= n->slotuse; ++i)
+        free_inner(static_cast<inner_node*>(n->childid[i]), level - 1);
+
+    if (hybrid)
+      delete n;
+    else
+      pfree(n);
+  }
+
+  // *** Node Modification
+
+  // leaf_insert -- fill a free slot, then commit it with its bit
+  void leaf_insert(leaf_node* leaf, const key_type& key,
+                   const data_type& val) {
+    int slot = __builtin_ctzl(~leaf->bitmap);
+
+    leaf->slotkey[slot] = key;
+    leaf->slotdata[slot] = val;
+    persist_leaf(&leaf->slotkey[slot], sizeof(key_type));
+    persist_leaf(&leaf->slotdata[slot], sizeof(data_type));
+
+    // the fingerprint shares the first line with the bitmap and lands with it
+    leaf->fingerprint[slot] = fingerprint(key);
+    leaf->bitmap |= (1UL << slot);
+    persist_leaf(&leaf->bitmap, sizeof(unsigned long));
+  }
+
+  // split_leaf -- copy the upper half to a new leaf, persisted and linked
+  leaf_node* split_leaf(leaf_node* leaf, key_type* sep, unsigned long* moved) {
+    leaf_node* sibling = allocate_leaf();
+    unsigned char order[leafslotmax];
+    unsigned short count = sort_slots(leaf, order);
+    unsigned short mid = count / 2;
+
+    *moved = 0;
+    for (unsigned short i = mid; i < count; ++i) {
+      sibling->slotkey[i - mid] = leaf->slotkey[order[i]];
+      sibling->slotdata[i - mid] = leaf->slotdata[order[i]];
+      sibling->fingerprint[i - mid] = leaf->fingerprint[order[i]];
+      *moved |= (1UL << order[i]);
+    }
+    sibling->bitmap = (1UL << (count - mid)) - 1;
+    sibling->nextleaf = leaf->nextleaf;
+    persist_leaf(sibling, sizeof(leaf_node));
+
+    leaf->nextleaf = sibling;
+    persist_leaf(&leaf->nextleaf, sizeof(leaf_node*));
+
+    *sep = leaf->slotkey[order[mid - 1]];
+    return sibling;
+  }
+
+  // split_inner -- copy the keys above the middle one to a new node
+  inner_node* split_inner(inner_node* inner, key_type* sep) {
+    inner_node* sibling = allocate_inner(inner->level);
+    unsigned short mid = innerslotmax / 2;
+
+    for (unsigned short i = mid + 1; i < inner->slotuse; ++i)
+      sibling->slotkey[i - mid - 1] = inner->slotkey[i];
+    for (unsigned short i = mid + 1; i <= inner->slotuse; ++i)
+      sibling->childid[i - mid - 1] = inner->childid[i];
+    sibling->slotuse = inner->slotuse - mid - 1;
+    persist_inner(sibling);
+
+    *sep = inner->slotkey[mid];
+    return sibling;
+  }
+
+  // inner_insert -- add separator key with the new right child after it
+  void inner_insert(inner_node* inner, const key_type& key, void* child) {
+    int slot = find_lower(inner, key);
+
+    // a crash amid an in place shift of a node in the pool can drop its
+    // last child, swap in a copy instead
+    if (persist && !hybrid) {
+      inner_node* copy = allocate_inner(inner->level);
+
+      for (int i = 0; i < inner->slotuse; ++i)
+        copy->slotkey[i + (i >= slot)] = inner->slotkey[i];
+      for (int i = 0; i <= inner->slotuse; ++i)
+        copy->childid[i + (i > slot)] = inner->childid[i];
+
+      copy->slotkey[slot] = key;
+      copy->childid[slot + 1] = child;
+      copy->slotuse = inner->slotuse + 1;
+      persist_inner(copy);
+
+      replace_inner(inner, copy, key);
+      pfree(inner);
+      return;
+    }
+
+    for (int i = inner->slotuse; i > slot; --i) {
+      inner->slotkey[i] = inner->slotkey[i - 1];
+      inner->childid[i + 1] = inner->childid[i];
+    }
+
+    inner->slotkey[slot] = key;
+    inner->childid[slot + 1] = child;
+    inner->slotuse++;
+    persist_inner(inner);
+  }
+
+  // replace_inner -- point the parent of n, found through key, at copy
+  void replace_inner(inner_node* n, inner_node* copy, const key_type& key) {
+    if (m_root == n) {
+      m_root = copy;
+      persist_root();
+      return;
+    }
+
+    inner_node* parent = static_cast<inner_node*>(m_root);
+    while (parent->level > n->level + 1)
+      parent = static_cast<inner_node*>(parent->childid[find_lower(parent,
+                                                                   key)]);
+
+    int slot = find_lower(parent, key);
+    assert(parent->childid[slot] == n);
+    parent->childid[slot] = copy;
+    pmem_persist(&parent->childid[slot], sizeof(void*), 0);
+  }
+
+  /*
+   * insert_parent -- route the keys above sep to child, the new right
+   * sibling of the node at depth, splitting the inner nodes above it
+   */
+  void insert_parent(inner_node** path, unsigned short depth,
+                     const key_type& sep, void* child) {
+    key_type psep;
+
+    if (depth == 0) {
+      inner_node* root = allocate_inner(m_height + 1);
+      root->slotkey[0] = sep;
+      root->childid[0] = m_root;
+      root->childid[1] = child;
+      root->slotuse = 1;
+      persist_inner(root);
+
+      m_root = root;
+      m_height++;
+      persist_root();
+      return;
+    }
+
+    inner_node* parent = path[depth - 1];
+
+    if (parent->slotuse == innerslotmax) {
+      inner_node* sibling = split_inner(parent, &psep);
+      insert_parent(path, depth - 1, psep, sibling);
+
+      // the upper half is in the sibling, only the count changes here
+      parent->slotuse = innerslotmax / 2;
+      persist_inner(&parent->slotuse, sizeof(parent->slotuse));
+
+      if (psep < sep)
+        parent = sibling;
+    }
+
+    inner_insert(parent, sep, child);
+  }
+
+  // *** Recovery
+
+  inline void check_boot() {
+    if (persist && m_boot != pmem_boot)
+      recover();
+  }
+
+  // recover -- repair the tree once after the pool is reopened
+  void recover() {
+    std::vector<leaf_node*> leaves;
+
+    if (hybrid) {
+      rebuild();
+      return;
+    }
+
+    m_boot = pmem_boot;
+    m_height = (m_root == (*m_head)) ? 0 :
+        static_cast<inner_node*>(m_root)->level;
+
+    repair(m_root, m_height, NULL, &leaves);
+
+    // relink the leaves in key order, freeing one left by a split whose
+    // parent was never updated
+    m_itemcount = 0;
+    for (size_t i = 0; i < leaves.size(); ++i) {
+      leaf_node* next = (i + 1 < leaves.size()) ? leaves[i + 1] : NULL;
+      leaf_node* dangling = leaves[i]->nextleaf;
+
+      if (dangling != next) {
+        leaves[i]->nextleaf = next;
+        persist_leaf(&leaves[i]->nextleaf, sizeof(leaf_node*));
+        if (dangling != NULL && dangling->nextleaf == next)
+          free_leaf(dangling);
+      }
+
+      m_itemcount += __builtin_popcountl(leaves[i]->bitmap);
+    }
+  }
+
+  // repair -- walk the subtree holding the keys <= *bound in key order
+  void repair(void* n, unsigned short level, const key_type* bound,
+              std::vector<leaf_node*>* leaves) {
+    if (level == 0) {
+      leaf_node* leaf = static_cast<leaf_node*>(n);
+
+      if (bound != NULL && leaf->bitmap != 0 && *bound < max_key(leaf))
+        trim_above(leaf, *bound);
+
+      leaves->push_back(leaf);
+      return;
+    }
+
+    inner_node* inner = static_cast<inner_node*>(n);
+    unsigned short use = 0;
+
+    // keys handed over by an unfinished inner split
+    while (use < inner->slotuse
+        && (bound == NULL || inner->slotkey[use] < *bound))
+      use++;
+
+    if (use != inner->slotuse) {
+      inner->slotuse = use;
+      persist_inner(inner);
+    }
+
+    for (unsigned short i = 0; i <= use; ++i)
+      repair(inner->childid[i], level - 1, (i < use) ? &inner->slotkey[i] : bound,
+             leaves);
+  }
+
+  // trim_leaf -- drop the slots with keys not less than key, returns the rest
+  unsigned short trim_leaf(leaf_node* leaf, const key_type& key) {
+    unsigned long bits = leaf->bitmap, keep = bits;
+
+    for (; bits; bits &= bits - 1)
+      if (!(leaf->slotkey[__builtin_ctzl(bits)] < key))
+        keep &= ~(bits & -bits);
+
+    leaf->bitmap = keep;
+    persist_leaf(&leaf->bitmap, sizeof(unsigned long));
+    return __builtin_popcountl(keep);
+  }
+
+  // trim_above -- drop the slots with keys greater than key
+  void trim_above(leaf_node* leaf, const key_type& key) {
+    unsigned long bits = leaf->bitmap, keep = bits;
+
+    for (; bits; bits &= bits - 1)
+      if (key < leaf->slotkey[__builtin_ctzl(bits)])
+        keep &= ~(bits & -bits);
+
+    leaf->bitmap = keep;
+    persist_leaf(&leaf->bitmap, sizeof(unsigned long));
+  }
+
+  // unlink_leaf -- take an empty leaf out of the chain and free it
+  void unlink_leaf(leaf_node* prev, leaf_node* leaf) {
+    if (prev == NULL) {
+      (*m_head) = leaf->nextleaf;
+      pmem_persist(m_head, sizeof(leaf_node*), 0);
+    } else {
+      prev->nextleaf = leaf->nextleaf;
+      persist_leaf(&prev->nextleaf, sizeof(leaf_node*));
+    }
+
+    free_leaf(leaf);
+  }
+
+  // build_levels -- inner nodes over the children, each with its largest key
+  void* build_levels(std::vector<std::pair<void*, key_type> >& nodes,
+                     unsigned short* height) {
+    unsigned short level = 0;
+
+    while (nodes.size() > 1) {
+      std::vector<std::pair<void*, key_type> > parents;
+      size_t num_parents = (nodes.size() + innerslotmax) / (innerslotmax + 1);
+      size_t itr = 0;
+
+      level++;
+      for (size_t i = 0; i < num_parents; ++i) {
+        inner_node* n = allocate_inner(level);
+        size_t take = (nodes.size() - itr) / (num_parents - i);
+
+        n->slotuse = take - 1;
+        for (size_t s = 0; s < take; ++s) {
+          n->childid[s] = nodes[itr + s].first;
+          if (s + 1 < take)
+            n->slotkey[s] = nodes[itr + s].second;
+        }
+        persist_inner(n);
+
+        parents.push_back(std::make_pair((void*) n, nodes[itr + take - 1].second));
+        itr += take;
+      }
+
+      nodes.swap(parents);
+    }
+
+    *height = level;
+    return nodes[0].first;
+  }
+};
+
+}
@@ -0,0 +1,223 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <functional>
+
+#include "schema.h"
+#include "record.h"
+
+namespace storage {
+
+#define INDEX_KEY_WORDS 6
+#define INDEX_KEY_LEN (INDEX_KEY_WORDS * sizeof(uint64_t))
+
+/*
+ * index_key -- fixed width binary key. Each word holds eight key bytes,
+ * most significant first, so comparing the words in order compares the
+ * bytes and two keys are equal only if their columns are.
+ */
+struct index_key {
+  uint64_t words[INDEX_KEY_WORDS];
+
+  bool operator<(const index_key& other) const {
+    for (int itr = 0; itr < INDEX_KEY_WORDS; itr++)
+      if (words[itr] != other.words[itr])
+        return words[itr] < other.words[itr];
+    return false;
+  }
+
+  bool operator==(const index_key& other) const {
+    for (int itr = 0; itr < INDEX_KEY_WORDS; itr++)
+      if (words[itr] != other.words[itr])
+        return false;
+    return true;
+  }
+
+  bool operator!=(const index_key& other) const {
+    return !(*this == other);
+  }
+};
+
+/*
+ * key_encoder -- builds index keys from the record's column bytes. The
+ * enabled columns of the index schema are laid out in schema order,
+ * integers and doubles big endian with the sign flipped, varchars padded
+ * to their declared length, so the key bytes sort like the columns.
+ */
+class key_encoder {
+ public:
+
+  index_key encode(record* rptr, schema* sptr) const {
+    unsigned char buf[INDEX_KEY_LEN];
+
+    encode_bytes(rptr, sptr, buf);
+    return to_key(buf);
+  }
+
+  // encode_bound -- the lowest key, or the highest with upper, that starts
+  // with the first prefix_len bytes of the record's key. Scans of a
+  // non-unique index start and stop at these.
+  index_key encode_bound(record* rptr, schema* sptr, size_t prefix_len,
+                         bool upper) const {
+    unsigned char buf[INDEX_KEY_LEN];
+
+    size_t len = encode_bytes(rptr, sptr, buf);
+    fill_suffix(buf, prefix_len, len, upper);
+    return to_key(buf);
+  }
+
+  // encode_str -- the key bytes behind a table and index prefix, for the
+  // copy-on-write tree that holds every index of the database
+  std::string encode_str(record* rptr, schema* sptr, unsigned int table_id,
+                         unsigned int index_id) const {
+    unsigned char buf[2 + INDEX_KEY_LEN];
+
+    buf[0] = (unsigned char) table_id;
+    buf[1] = (unsigned char) index_id;
+    size_t len = encode_bytes(rptr, sptr, &buf[2]);
+
+    return std::string((char*) buf, 2 + len);
+  }
+
+  // encode_str_bound -- encode_bound() behind a table and index prefix
+  std::string encode_str_bound(record* rptr, schema* sptr,
+                               unsigned int table_id, unsigned int index_id,
+                               size_t prefix_len, bool upper) const {
+    unsigned char buf[2 + INDEX_KEY_LEN];
+
+    buf[0] = (unsigned char) table_id;
+    buf[1] = (unsigned char) index_id;
+    size_t len = encode_bytes(rptr, sptr, &buf[2]);
+    fill_suffix(&buf[2], prefix_len, len, upper);
+
+    return std::string((char*) buf, 2 + len);
+  }
+
+  // key_len -- bytes taken by the enabled columns of an index schema
+  static size_t key_len(schema* sptr) {
+    size_t len = 0;
+
+    for (unsigned int itr = 0; itr < sptr->num_columns; itr++)
+      if (sptr->columns[itr].enabled)
+        len += column_len(sptr->columns[itr]);
+
+    return len;
+  }
+
+  // prefix_len -- bytes taken by the first num_cols enabled columns
+  static size_t prefix_len(schema* sptr, unsigned int num_cols) {
+    size_t len = 0;
+
+    for (unsigned int itr = 0; itr < sptr->num_columns && num_cols > 0; itr++)
+      if (sptr->columns[itr].enabled) {
+        len += column_len(sptr->columns[itr]);
+        num_cols--;
+      }
+
+    return len;
+  }
+
+ private:
+
+  static index_key to_key(const unsigned char* buf) {
+    index_key key;
+
+    for (int itr = 0; itr < INDEX_KEY_WORDS; itr++) {
+      memcpy(&key.words[itr], &buf[itr * sizeof(uint64_t)], sizeof(uint64_t));
+      key.words[itr] = __builtin_bswap64(key.words[itr]);
+    }
+
+    return key;
+  }
+
+  static void fill_suffix(unsigned char* buf, size_t prefix_len, size_t len,
+                          bool upper) {
+    if (prefix_len < len)
+      memset(&buf[prefix_len], (upper) ? 0xff : 0x00, len - prefix_len);
+  }
+
+  // encode_bytes -- fill buf with the key bytes, returns the key length
+  size_t encode_bytes(record* rptr, schema* sptr, unsigned char* buf) const {
+    size_t len = 0;
+
+    memset(buf, 0, INDEX_KEY_LEN);
+
+    if (rptr == NULL || sptr == NULL)
+      return 0;
+
+    char* data = rptr->data;
+    unsigned int num_columns = sptr->num_columns;
+
+    for (unsigned int itr = 0; itr < num_columns; itr++) {
+      const field_info& finfo = sptr->columns[itr];
+      if (!finfo.enabled)
+        continue;
+
+      switch (finfo.type) {
+        case field_type::INTEGER: {
+          uint32_t ival;
+          memcpy(&ival, &(data[finfo.offset]), sizeof(int));
+          ival = __builtin_bswap32(ival ^ (1U << 31));
+          memcpy(&buf[len], &ival, sizeof(ival));
+        }
+          break;
+
+        case field_type::DOUBLE: {
+          uint64_t dval;
+          memcpy(&dval, &(data[finfo.offset]), sizeof(double));
+          dval = (dval >> 63) ? ~dval : dval | (1UL << 63);
+          dval = __builtin_bswap64(dval);
+          memcpy(&buf[len], &dval, sizeof(dval));
+        }
+          break;
+
+        case field_type::VARCHAR: {
+          char* vcval = NULL;
+          memcpy(&vcval, &(data[finfo.offset]), sizeof(char*));
+          if (vcval != NULL)
+            memcpy(&buf[len], vcval, strnlen(vcval, finfo.deser_len - 1));
+        }
+          break;
+
+        default:
+          break;
+      }
+
+      len += column_len(finfo);
+    }
+
+    return len;
+  }
+
+  static size_t column_len(const field_info& finfo) {
+    switch (finfo.type) {
+      case field_type::INTEGER:
+        return sizeof(int);
+      case field_type::DOUBLE:
+        return sizeof(double);
+      case field_type::VARCHAR:
+        return finfo.deser_len - 1;
+      default:
+        return 0;
+    }
+  }
+};
+
+}
+
+namespace std {
+
+template<>
+struct hash<storage::index_key> {
+  size_t operator()(const storage::index_key& key) const {
+    uint64_t h = 0;
+
+    for (int itr = 0; itr < INDEX_KEY_WORDS; itr++)
+      h = (h ^ key.words[itr]) * 0x100000001b3UL;
+    return h;
+  }
+};
+
+}
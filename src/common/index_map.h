@@ -0,0 +1,195 @@
+#pragma once
+
+#include "fpbtree.h"
+#include "phash.h"
+#include "index_key.h"
+#include "libpm.h"
+
+namespace storage {
+
+enum index_type {
+  BTREE_INDEX,
+  HASH_INDEX
+};
+
+/*
+ * index_map -- the map behind a table index, either a B+ tree or a hash
+ * table picked when the index is created. Point operations go to either.
+ * Only the tree keeps keys in order, lower_bound() on a hash index dies
+ * rather than let a scan come back empty, so indexes that are scanned
+ * stay trees.
+ */
+template<typename _Data>
+class index_map {
+ public:
+  typedef index_key key_type;
+  typedef _Data data_type;
+  typedef std::pair<key_type, data_type> value_type;
+  typedef fpbtree<index_key, _Data> tree_type;
+  typedef phash<index_key, _Data> hash_type;
+
+  class iterator {
+   public:
+    iterator()
+        : hashed(false) {
+    }
+
+    iterator(const typename tree_type::iterator& _titr)
+        : hashed(false),
+          titr(_titr) {
+    }
+
+    iterator(const typename hash_type::iterator& _hitr)
+        : hashed(true),
+          hitr(_hitr) {
+    }
+
+    inline value_type operator*() const {
+      return value_type(key(), data());
+    }
+
+    inline const key_type& key() const {
+      return (hashed) ? hitr.key() : titr.key();
+    }
+
+    inline data_type& data() const {
+      return (hashed) ? hitr.data() : titr.data();
+    }
+
+    inline iterator& operator++() {
+      if (hashed)
+        ++hitr;
+      else
+        ++titr;
+      return *this;
+    }
+
+    inline iterator operator++(int) {
+      iterator tmp = *this;
+      ++(*this);
+      return tmp;
+    }
+
+    inline bool operator==(const iterator& x) const {
+      return (hashed) ? hitr == x.hitr : titr == x.titr;
+    }
+
+    inline bool operator!=(const iterator& x) const {
+      return !(*this == x);
+    }
+
+   private:
+    bool hashed;
+    typename tree_type::iterator titr;
+    typename hash_type::iterator hitr;
+  };
+
+  typedef iterator const_iterator;
+
+  index_map(index_type _type, void** head)
+      : type(_type),
+        tree(NULL),
+        hash(NULL) {
+    if (type == index_type::HASH_INDEX) {
+      hash = new ((hash_type*) pmalloc(sizeof(hash_type))) hash_type();
+      pmemalloc_activate(hash);
+    } else {
+      tree = new ((tree_type*) pmalloc(sizeof(tree_type))) tree_type(head);
+      pmemalloc_activate(tree);
+    }
+    pmem_persist(this, sizeof(*this), 0);
+  }
+
+  ~index_map() {
+    delete tree;
+    delete hash;
+  }
+
+  inline size_t size() {
+    return (hash) ? hash->size() : tree->size();
+  }
+
+  inline bool empty() {
+    return (size() == 0);
+  }
+
+  iterator begin() {
+    if (hash)
+      return iterator(hash->begin());
+    return iterator(tree->begin());
+  }
+
+  iterator end() {
+    if (hash)
+      return iterator(hash->end());
+    return iterator(tree->end());
+  }
+
+  bool exists(const key_type& key) {
+    return (hash) ? hash->exists(key) : tree->exists(key);
+  }
+
+  bool at(const key_type& key, data_type* val) {
+    return (hash) ? hash->at(key, val) : tree->at(key, val);
+  }
+
+  size_t multi_at(const key_type* keys, size_t count, data_type* vals,
+                  bool* found) {
+    return (hash) ? hash->multi_at(keys, count, vals, found) :
+        tree->multi_at(keys, count, vals, found);
+  }
+
+  /// Iterator to the first pair not less than key, trees only
+  iterator lower_bound(const key_type& key) {
+    if (hash)
+      die();
+    return iterator(tree->lower_bound(key));
+  }
+
+  bool insert(const key_type& key, const data_type& val) {
+    return (hash) ? hash->insert(key, val) : tree->insert(key, val);
+  }
+
+  int update(const key_type& key, const data_type& val) {
+    return (hash) ? hash->update(key, val) : tree->update(key, val);
+  }
+
+  size_t erase(const key_type& key) {
+    return (hash) ? hash->erase(key) : tree->erase(key);
+  }
+
+  void clear() {
+    if (hash)
+      hash->clear();
+    else
+      tree->clear();
+  }
+
+  void disable_persistence() {
+    if (hash)
+      hash->disable_persistence();
+    else
+      tree->disable_persistence();
+  }
+
+  /// Inner nodes in DRAM, hash tables have none
+  void enable_hybrid() {
+    if (tree)
+      tree->enable_hybrid();
+  }
+
+  double rebuild() {
+    return (tree) ? tree->rebuild() : 0;
+  }
+
+  inline bool is_hashed() const {
+    return (hash != NULL);
+  }
+
+ private:
+  index_type type;
+  tree_type* tree;
+  hash_type* hash;
+};
+
+}
@@ -0,0 +1,208 @@
+#pragma once
+
+#include <stdint.h>
+#include <type_traits>
+#include <immintrin.h>
+
+namespace storage {
+
+// Vectorized search over the sorted key arrays of B+ tree nodes, used for
+// 64-bit integer keys ordered by std::less, and over the one byte key
+// fingerprints of unsorted leaves. The best instruction set is picked at
+// startup.
+
+#define KEY_SEARCH_SCALAR 0
+#define KEY_SEARCH_SSE42 1
+#define KEY_SEARCH_AVX2 2
+#define KEY_SEARCH_TYPES 3
+
+extern int key_search_isa;
+extern const char* key_search_names[KEY_SEARCH_TYPES];
+
+int key_search_detect();
+
+// key_search_simd -- true for key types the kernels below can compare
+template<typename _Key>
+struct key_search_simd {
+  static const bool value = std::is_integral<_Key>::value
+      && sizeof(_Key) == sizeof(uint64_t);
+};
+
+// unsigned keys are compared as signed after flipping the sign bit
+template<typename _Key>
+static inline int64_t key_search_bias(_Key key) {
+  if (std::is_unsigned<_Key>::value)
+    return (int64_t) ((uint64_t) key ^ (1UL << 63));
+  return (int64_t) key;
+}
+
+/*
+ * key_search_sse42 -- index of the first of n sorted keys that is not
+ * less than key, or not less or equal to key when upper is set
+ */
+template<typename _Key>
+__attribute__((target("sse4.2")))
+static inline int key_search_sse42(const _Key* keys, int n, _Key key,
+                                   bool upper) {
+  int64_t bkey = key_search_bias(key);
+  __m128i flip = _mm_set1_epi64x(std::is_unsigned<_Key>::value ? (1UL << 63) : 0);
+  __m128i kv = _mm_set1_epi64x(bkey);
+  int lo = 0, mask;
+
+  // first key > key is the first key >= key + 1
+  if (upper) {
+    if (bkey == INT64_MAX)
+      return n;
+    kv = _mm_set1_epi64x(++bkey);
+  }
+
+  for (; lo + 2 <= n; lo += 2) {
+    __m128i sv = _mm_xor_si128(
+        _mm_loadu_si128((const __m128i *) (keys + lo)), flip);
+    mask = _mm_movemask_pd(_mm_castsi128_pd(_mm_cmpgt_epi64(kv, sv)));
+    if (mask != 0x3)
+      return lo + __builtin_ctz(~mask);
+  }
+
+  if (lo < n && key_search_bias(keys[lo]) < bkey)
+    lo++;
+  return lo;
+}
+
+// key_search_avx2 -- same as key_search_sse42, four keys per compare
+template<typename _Key>
+__attribute__((target("avx2")))
+static inline int key_search_avx2(const _Key* keys, int n, _Key key,
+                                  bool upper) {
+  int64_t bkey = key_search_bias(key);
+  __m256i flip = _mm256_set1_epi64x(std::is_unsigned<_Key>::value ? (1UL << 63) : 0);
+  __m256i kv = _mm256_set1_epi64x(bkey);
+  int lo = 0, mask;
+
+  if (upper) {
+    if (bkey == INT64_MAX)
+      return n;
+    kv = _mm256_set1_epi64x(++bkey);
+  }
+
+  for (; lo + 4 <= n; lo += 4) {
+    __m256i sv = _mm256_xor_si256(
+        _mm256_loadu_si256((const __m256i *) (keys + lo)), flip);
+    mask = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(kv, sv)));
+    if (mask != 0xF)
+      return lo + __builtin_ctz(~mask);
+  }
+
+  while (lo < n && key_search_bias(keys[lo]) < bkey)
+    lo++;
+  return lo;
+}
+
+/*
+ * key_search_fp_sse42 -- bit i set for each of the n fingerprints that
+ * equals fp, n is a multiple of 16 and at most 64
+ */
+__attribute__((target("sse4.2")))
+static inline unsigned long key_search_fp_sse42(const unsigned char* fps,
+                                                int n, unsigned char fp) {
+  __m128i fv = _mm_set1_epi8((char) fp);
+  unsigned long mask = 0;
+
+  for (int lo = 0; lo < n; lo += 16) {
+    __m128i sv = _mm_loadu_si128((const __m128i *) (fps + lo));
+    mask |= (unsigned long) (unsigned int) _mm_movemask_epi8(
+        _mm_cmpeq_epi8(sv, fv)) << lo;
+  }
+  return mask;
+}
+
+// key_search_fp_avx2 -- same as key_search_fp_sse42, 32 fingerprints per compare
+__attribute__((target("avx2")))
+static inline unsigned long key_search_fp_avx2(const unsigned char* fps,
+                                               int n, unsigned char fp) {
+  __m256i fv = _mm256_set1_epi8((char) fp);
+  unsigned long mask = 0;
+  int lo = 0;
+
+  for (; lo + 32 <= n; lo += 32) {
+    __m256i sv = _mm256_loadu_si256((const __m256i *) (fps + lo));
+    mask |= (unsigned long) (unsigned int) _mm256_movemask_epi8(
+        _mm256_cmpeq_epi8(sv, fv)) << lo;
+  }
+
+  if (lo < n) {
+    __m128i sv = _mm_loadu_si128((const __m128i *) (fps + lo));
+    mask |= (unsigned long) (unsigned int) _mm_movemask_epi8(
+        _mm_cmpeq_epi8(sv, _mm256_castsi256_si128(fv))) << lo;
+  }
+  return mask;
+}
+
+// key_search_fp -- dispatch to the fingerprint kernel picked at startup
+static inline unsigned long key_search_fp(const unsigned char* fps, int n,
+                                          unsigned char fp) {
+  unsigned long mask = 0;
+
+  if (key_search_isa == KEY_SEARCH_AVX2)
+    return key_search_fp_avx2(fps, n, fp);
+  if (key_search_isa == KEY_SEARCH_SSE42)
+    return key_search_fp_sse42(fps, n, fp);
+
+  for (int lo = 0; lo < n; lo++)
+    if (fps[lo] == fp)
+      mask |= (1UL << lo);
+  return mask;
+}
+
+// key_search_scalar -- keys the kernels cannot compare, like index_key
+template<typename _Key>
+static inline int key_search_scalar(const _Key* keys, int n, const _Key& key,
+                                    bool upper) {
+  int lo = 0;
+
+  if (upper) {
+    while (lo < n && !(key < keys[lo]))
+      ++lo;
+  } else {
+    while (lo < n && keys[lo] < key)
+      ++lo;
+  }
+  return lo;
+}
+
+template<typename _Key>
+static inline int key_search(const _Key* keys, int n, const _Key& key,
+                             bool upper, std::false_type) {
+  return key_search_scalar(keys, n, key, upper);
+}
+
+template<typename _Key>
+static inline int key_search(const _Key* keys, int n, _Key key, bool upper,
+                             std::true_type) {
+  int lo = 0;
+
+  if (key_search_isa == KEY_SEARCH_AVX2)
+    return key_search_avx2(keys, n, key, upper);
+  if (key_search_isa == KEY_SEARCH_SSE42)
+    return key_search_sse42(keys, n, key, upper);
+
+  if (upper) {
+    while (lo < n && keys[lo] <= key)
+      ++lo;
+  } else {
+    while (lo < n && keys[lo] < key)
+      ++lo;
+  }
+  return lo;
+}
+
+// key_search -- dispatch to the kernel picked at startup
+template<typename _Key>
+static inline int key_search(const _Key* keys, int n, const _Key& key,
+                             bool upper) {
+  typedef std::integral_constant<bool, key_search_simd<_Key>::value> simd;
+
+  return key_search(keys, n, key, upper, simd());
+}
+
+}
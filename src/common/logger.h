@@ -60,7 +60,7 @@ class logger {
     ret = fsync(log_file_fd);
 
     // PCOMMIT
-    pcommit(PCOMMIT_LATENCY);
+    pcommit();
 
     if (ret != 0) {
       perror("fsync failed");
@@ -25,6 +25,9 @@ class lsm_engine : public engine_api {
   ~lsm_engine();
 
   std::string select(const statement& st);
+  std::vector<std::string> scan(const statement& st);
+  std::vector<std::string> multi_select(const statement& st);
+  std::string lookup(table* tab, const index_val& ival, schema* projection);
   int update(const statement& st);
   int insert(const statement& t);
   int remove(const statement& t);
@@ -45,7 +48,7 @@ class lsm_engine : public engine_api {
   database* db;
 
   logger fs_log;
-  std::hash<std::string> hash_fn;
+  key_encoder ke;
   std::stringstream entry_stream;
   std::string entry_str;
   std::thread gc;
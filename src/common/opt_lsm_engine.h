@@ -27,6 +27,9 @@ class opt_lsm_engine : public engine_api {
   ~opt_lsm_engine();
 
   std::string select(const statement& st);
+  std::vector<std::string> scan(const statement& st);
+  std::vector<std::string> multi_select(const statement& st);
+  std::string lookup(table* tab, const index_val& ival, schema* projection);
   int update(const statement& st);
   int insert(const statement& t);
   int remove(const statement& t);
@@ -48,7 +51,7 @@ class opt_lsm_engine : public engine_api {
   std::vector<std::thread> executors;
 
   plist<char*>* pm_log;
-  std::hash<std::string> hash_fn;
+  key_encoder ke;
 
   std::stringstream entry_stream;
   std::string entry_str;
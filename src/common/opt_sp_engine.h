@@ -24,6 +24,8 @@ class opt_sp_engine : public engine_api {
   ~opt_sp_engine();
 
   std::string select(const statement& st);
+  std::vector<std::string> scan(const statement& st);
+  std::vector<std::string> multi_select(const statement& st);
   int update(const statement& st);
   int insert(const statement& t);
   int remove(const statement& t);
@@ -40,7 +42,7 @@ class opt_sp_engine : public engine_api {
   const config& conf;
   database* db;
 
-  std::hash<std::string> hash_fn;
+  key_encoder ke;
 
   std::thread gc;
   pthread_rwlock_t gc_rwlock = PTHREAD_RWLOCK_INITIALIZER;
@@ -3,6 +3,7 @@
 #include <string>
 #include <sstream>
 #include <atomic>
+#include <memory>
 
 #include "engine_api.h"
 #include "config.h"
@@ -23,6 +24,8 @@ class opt_wal_engine : public engine_api {
   ~opt_wal_engine();
 
   std::string select(const statement& st);
+  std::vector<std::string> scan(const statement& st);
+  std::vector<std::string> multi_select(const statement& st);
   int update(const statement& st);
   int insert(const statement& t);
   int remove(const statement& t);
@@ -40,7 +43,7 @@ class opt_wal_engine : public engine_api {
   database* db;
 
   plist<char*>* pm_log;
-  std::hash<std::string> hash_fn;
+  key_encoder ke;
 
   std::stringstream entry_stream;
   std::string entry_str;
@@ -9,10 +9,16 @@
 #include <assert.h>
 
 #include "libpm.h"
+#include "key_search.h"
 
 namespace storage {
 
-#define BTREE_NODE_SIZE 512
+#define BTREE_NODE_SIZE 512 /* a multiple of the 64B cache line */
+
+/// Bytes taken by the node header and leaf links, and by the node header
+/// and the extra child pointer of inner nodes
+#define BTREE_LEAF_HEADER (3 * sizeof(void*))
+#define BTREE_INNER_HEADER (2 * sizeof(void*))
 
 /// Print out debug information to std::cout if BTREE_DEBUG is defined.
 #define BTREE_PRINT(x)
@@ -44,14 +50,18 @@ struct btree_default_set_traits {
   /// printable.
   static const bool debug = false;
 
-  /// Number of slots in each leaf of the tree. Estimated so that each node
-  /// has a size of about 256 bytes.
-  static const int leafslots = BTREE_MAX(8, BTREE_NODE_SIZE / (sizeof(_Key)));
+  /// Number of slots in each leaf of the tree. Sized so that the node, header
+  /// and leaf links included, fills whole cache lines.
+  static const int leafslots = BTREE_MAX(8,
+		  (BTREE_NODE_SIZE - BTREE_LEAF_HEADER) / (sizeof(_Key)));
 
-  /// Number of slots in each inner node of the tree. Estimated so that each node
-  /// has a size of about 256 bytes.
+  /// Number of slots in each inner node of the tree. Sized so that the node,
+  /// header included, fills whole cache lines.
   static const int innerslots = BTREE_MAX(8,
-		  BTREE_NODE_SIZE / (sizeof(_Key) + sizeof(void*)));
+		  (BTREE_NODE_SIZE - BTREE_INNER_HEADER) / (sizeof(_Key) + sizeof(void*)));
+
+  /// Search 64-bit integer keys with vector compares, see key_search.h
+  static const bool simdsearch = key_search_simd<_Key>::value;
 
   /// As of stx-btree-0.9, the code does linear search in find_lower() and
   /// find_upper() instead of binary_search, unless the node size is larger
@@ -74,15 +84,18 @@ struct btree_default_map_traits {
   /// printable.
   static const bool debug = false;
 
-  /// Number of slots in each leaf of the tree. Estimated so that each node
-  /// has a size of about 256 bytes.
+  /// Number of slots in each leaf of the tree. Sized so that the node, header
+  /// and leaf links included, fills whole cache lines.
   static const int leafslots = BTREE_MAX(8,
-		  BTREE_NODE_SIZE / (sizeof(_Key) + sizeof(_Data)));
+		  (BTREE_NODE_SIZE - BTREE_LEAF_HEADER) / (sizeof(_Key) + sizeof(_Data)));
 
-  /// Number of slots in each inner node of the tree. Estimated so that each node
-  /// has a size of about 256 bytes.
+  /// Number of slots in each inner node of the tree. Sized so that the node,
+  /// header included, fills whole cache lines.
   static const int innerslots = BTREE_MAX(8,
-		  BTREE_NODE_SIZE / (sizeof(_Key) + sizeof(void*)));
+		  (BTREE_NODE_SIZE - BTREE_INNER_HEADER) / (sizeof(_Key) + sizeof(void*)));
+
+  /// Search 64-bit integer keys with vector compares, see key_search.h
+  static const bool simdsearch = key_search_simd<_Key>::value;
 
   /// As of stx-btree-0.9, the code does linear search in find_lower() and
   /// find_upper() instead of binary_search, unless the node size is larger
@@ -195,6 +208,11 @@ class btree {
   /// with BTREE_DEBUG and the key type must be std::ostream printable.
   static const bool debug = traits::debug;
 
+  /// Operational parameter: Use the vectorized key search. Only for keys it
+  /// can compare, ordered by std::less.
+  static const bool simdsearch = traits::simdsearch
+      && std::is_same<key_compare, std::less<key_type> >::value;
+
  private:
   // *** Node Classes for In-Memory Nodes
 
@@ -1496,6 +1514,12 @@ class btree {
   /// places in leaf_node and inner_node.
   template<typename node_type>
   inline int find_lower(const node_type *n, const key_type& key) const {
+    // one dependent node load per level
+    nvm_read();
+
+    if (simdsearch)
+      return key_search(n->slotkey, n->slotuse, key, false);
+
     if (0 && sizeof(n->slotkey) > traits::binsearch_threshold) {
       if (n->slotuse == 0)
         return 0;
@@ -1540,6 +1564,11 @@ class btree {
   /// leaf_node and inner_node.
   template<typename node_type>
   inline int find_upper(const node_type *n, const key_type& key) const {
+    nvm_read();
+
+    if (simdsearch)
+      return key_search(n->slotkey, n->slotuse, key, true);
+
     if (0 && sizeof(n->slotkey) > traits::binsearch_threshold) {
       if (n->slotuse == 0)
         return 0;
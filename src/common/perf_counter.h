@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstring>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+namespace storage {
+
+// Hardware event counter for the calling thread, used like timer
+class perf_counter {
+ public:
+
+  perf_counter(unsigned int type, unsigned long long config)
+      : fd(-1),
+        total(0) {
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+  }
+
+  ~perf_counter() {
+    if (fd != -1)
+      close(fd);
+  }
+
+  // counters may be unavailable in VMs and containers
+  bool valid() const {
+    return (fd != -1);
+  }
+
+  void start() {
+    if (fd == -1)
+      return;
+
+    ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+    ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+  }
+
+  void end() {
+    unsigned long long count;
+
+    if (fd == -1)
+      return;
+
+    ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+    if (read(fd, &count, sizeof(count)) == sizeof(count))
+      total += count;
+  }
+
+  int fd;
+  unsigned long long total;
+};
+
+// dTLB load and store misses
+#define PERF_DTLB_MISS(op) \
+  (PERF_COUNT_HW_CACHE_DTLB | ((op) << 8) \
+      | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+}
@@ -0,0 +1,586 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <utility>
+
+#include "libpm.h"
+
+namespace storage {
+
+#define PHASH_SLOTS 4 /* slots per bucket, the token has a bit for each */
+#define PHASH_MIN_BUCKETS 256 /* top level buckets of a new table */
+#define PHASH_PREFETCH_GROUP 16 /* lookups prefetched together by multi_at */
+
+/** Persistent hash table with level hashing.
+ *
+ * Two levels of buckets, the bottom level half the size of the top. A key
+ * hashes with two functions to two top buckets, and top bucket i shares the
+ * bottom bucket i modulo the bottom size, so a key lives in one of four
+ * buckets and a lookup reads at most four. Each bucket has a token word
+ * with one bit per slot. Insert writes the pair to a free slot, persists it
+ * and commits by setting its bit, a single 8 byte persist. Erase clears the
+ * bit. Nothing else is written on the point paths.
+ *
+ * When the four buckets are full, a pair moves to its other bucket on the
+ * same level, committing the copy before clearing the original. When that
+ * fails too, the table grows: a new top level twice the size is filled
+ * from the bottom level alone, and the old top becomes the bottom. The
+ * levels are swapped with one pointer write. The first access after the
+ * pool is reopened finishes a resize that a crash left half done and drops
+ * the second copy of a pair whose move was cut short.
+ *
+ * Pairs are not ordered, iterators visit them bucket by bucket.
+ */
+template<typename _Key, typename _Data>
+class phash {
+ public:
+  typedef _Key key_type;
+  typedef _Data data_type;
+  typedef std::pair<key_type, data_type> value_type;
+
+ private:
+  static const unsigned long BUCKET_FULL = (1UL << PHASH_SLOTS) - 1;
+
+  struct bucket {
+    unsigned long token;
+    key_type slotkey[PHASH_SLOTS];
+    data_type slotdata[PHASH_SLOTS];
+  } __attribute__((aligned(64)));
+
+  struct levels {
+    bucket* top;
+    bucket* bottom;
+    size_t top_buckets;
+
+    /// Bottom level replaced by a resize, freed once the swap is durable
+    bucket* retired;
+  };
+
+  levels* m_levels;
+
+  /// New top level of an unfinished resize
+  bucket* m_resize;
+
+  /// Number of key/data pairs, recounted on recovery
+  size_t m_itemcount;
+
+  // Persistence mode
+  bool persist = true;
+
+  /// pmem_boot when the table was last checked, see recover()
+  unsigned long m_boot;
+
+ public:
+  /// Forward iterator over the pairs, top level first
+  class iterator {
+   public:
+    typedef std::forward_iterator_tag iterator_category;
+    typedef typename phash::value_type value_type;
+    typedef ptrdiff_t difference_type;
+    typedef value_type* pointer;
+    typedef value_type& reference;
+
+    iterator()
+        : lv(NULL),
+          level(2),
+          index(0),
+          slot(0) {
+    }
+
+    explicit iterator(levels* _lv)
+        : lv(_lv),
+          level(0),
+          index(0),
+          slot(0) {
+      seek();
+    }
+
+    inline value_type operator*() const {
+      return value_type(key(), data());
+    }
+
+    inline const key_type& key() const {
+      return current()->slotkey[slot];
+    }
+
+    inline data_type& data() const {
+      return current()->slotdata[slot];
+    }
+
+    inline iterator& operator++() {
+      slot++;
+      seek();
+      return *this;
+    }
+
+    inline iterator operator++(int) {
+      iterator tmp = *this;
+      ++(*this);
+      return tmp;
+    }
+
+    inline bool operator==(const iterator& x) const {
+      return (level == x.level && index == x.index && slot == x.slot);
+    }
+
+    inline bool operator!=(const iterator& x) const {
+      return !(*this == x);
+    }
+
+   private:
+    levels* lv;
+    unsigned short level;
+    size_t index;
+    unsigned short slot;
+
+    inline bucket* current() const {
+      return (level == 0) ? &lv->top[index] : &lv->bottom[index];
+    }
+
+    // seek -- move to the first used slot at or after the current one
+    void seek() {
+      while (level < 2) {
+        size_t num_buckets = (level == 0) ? lv->top_buckets :
+            lv->top_buckets / 2;
+
+        for (; index < num_buckets; index++, slot = 0) {
+          unsigned long bits = current()->token >> slot;
+          if (bits != 0) {
+            slot += __builtin_ctzl(bits);
+            return;
+          }
+        }
+
+        level++;
+        index = 0;
+        slot = 0;
+      }
+
+      index = 0;
+      slot = 0;
+    }
+  };
+
+  typedef iterator const_iterator;
+
+  phash()
+      : m_levels(NULL),
+        m_resize(NULL),
+        m_itemcount(0),
+        m_boot(pmem_boot) {
+    m_levels = allocate_levels(allocate_level(PHASH_MIN_BUCKETS),
+                               allocate_level(PHASH_MIN_BUCKETS / 2),
+                               PHASH_MIN_BUCKETS);
+    pmem_persist(this, sizeof(*this), 0);
+  }
+
+  ~phash() {
+    pfree(m_levels->top);
+    pfree(m_levels->bottom);
+    pfree(m_levels);
+  }
+
+  inline size_t size() {
+    check_boot();
+    return m_itemcount;
+  }
+
+  inline bool empty() {
+    return (size() == 0);
+  }
+
+  iterator begin() {
+    check_boot();
+    return iterator(m_levels);
+  }
+
+  iterator end() {
+    return iterator();
+  }
+
+  bool exists(const key_type& key) {
+    data_type val;
+    return at(key, &val);
+  }
+
+  /// Tries to return value if key is found.
+  bool at(const key_type& key, data_type* val) {
+    int slot;
+
+    check_boot();
+
+    bucket* b = find(m_levels, key, &slot);
+    if (b == NULL)
+      return false;
+
+    (*val) = b->slotdata[slot];
+    return true;
+  }
+
+  /// Looks up count keys, setting found[i] and vals[i] for each. Both top
+  /// buckets of every key are prefetched before any is read, so their
+  /// misses overlap. Returns the number of keys found.
+  size_t multi_at(const key_type* keys, size_t count, data_type* vals,
+                  bool* found) {
+    size_t hits = 0;
+    int slot;
+
+    check_boot();
+
+    for (size_t base = 0; base < count; base += PHASH_PREFETCH_GROUP) {
+      size_t group = std::min(count - base, (size_t) PHASH_PREFETCH_GROUP);
+
+      for (size_t i = base; i < base + group; i++) {
+        prefetch(&m_levels->top[first(m_levels, keys[i])]);
+        prefetch(&m_levels->top[second(m_levels, keys[i])]);
+      }
+
+      for (size_t i = base; i < base + group; i++) {
+        bucket* b = find(m_levels, keys[i], &slot);
+
+        found[i] = (b != NULL);
+        if (found[i]) {
+          vals[i] = b->slotdata[slot];
+          hits++;
+        }
+      }
+    }
+
+    return hits;
+  }
+
+  /// Inserts the pair if the key is not present, returns false otherwise.
+  bool insert(const key_type& key, const data_type& val) {
+    int slot;
+
+    check_boot();
+
+    if (find(m_levels, key, &slot) != NULL)
+      return false;
+
+    while (!place(m_levels, key, val))
+      resize();
+
+    m_itemcount++;
+    return true;
+  }
+
+  /// Tries to set value if key is found. A value wider than 8 bytes is
+  /// not replaced atomically.
+  int update(const key_type& key, const data_type& val) {
+    int slot;
+
+    check_boot();
+
+    bucket* b = find(m_levels, key, &slot);
+    if (b == NULL)
+      return -1;
+
+    b->slotdata[slot] = val;
+    persist_range(&b->slotdata[slot], sizeof(data_type));
+    return 0;
+  }
+
+  /// Erases the key, returns the number of pairs removed.
+  size_t erase(const key_type& key) {
+    int slot;
+
+    check_boot();
+
+    bucket* b = find(m_levels, key, &slot);
+    if (b == NULL)
+      return 0;
+
+    clear_slot(b, slot);
+    m_itemcount--;
+    return 1;
+  }
+
+  /// Drops every pair, back to the initial size
+  void clear() {
+    check_boot();
+
+    levels* old = m_levels;
+
+    m_levels = allocate_levels(allocate_level(PHASH_MIN_BUCKETS),
+                               allocate_level(PHASH_MIN_BUCKETS / 2),
+                               PHASH_MIN_BUCKETS);
+    persist_range(&m_levels, sizeof(levels*));
+
+    pfree(old->top);
+    pfree(old->bottom);
+    pfree(old);
+    m_itemcount = 0;
+  }
+
+  // Disable persistence
+  void disable_persistence() {
+    persist = false;
+  }
+
+  /// Slots on both levels, for load factor reporting
+  size_t capacity() const {
+    return (m_levels->top_buckets + m_levels->top_buckets / 2) * PHASH_SLOTS;
+  }
+
+ private:
+  // *** Hashing
+
+  static inline size_t hash_seed(const key_type& key, size_t seed) {
+    size_t h = (std::hash<key_type>()(key) ^ seed) * 0x9e3779b97f4a7c15UL;
+    return h ^ (h >> 32);
+  }
+
+  static inline size_t first(const levels* lv, const key_type& key) {
+    return hash_seed(key, 0) & (lv->top_buckets - 1);
+  }
+
+  static inline size_t second(const levels* lv, const key_type& key) {
+    return hash_seed(key, 0x5bd1e995UL) & (lv->top_buckets - 1);
+  }
+
+  static inline size_t below(const levels* lv, size_t index) {
+    return index & (lv->top_buckets / 2 - 1);
+  }
+
+  // *** Bucket Access
+
+  static inline void prefetch(const bucket* b) {
+    for (size_t off = 0; off < sizeof(bucket); off += ALIGN)
+      __builtin_prefetch((const char*) b + off);
+  }
+
+  inline int bucket_find(const bucket* b, const key_type& key) const {
+    nvm_read();
+
+    for (unsigned long bits = b->token; bits; bits &= bits - 1) {
+      int slot = __builtin_ctzl(bits);
+      if (b->slotkey[slot] == key)
+        return slot;
+    }
+    return -1;
+  }
+
+  // find -- the bucket and slot of key, top level first
+  bucket* find(levels* lv, const key_type& key, int* slot) const {
+    size_t f = first(lv, key), s = second(lv, key);
+    bucket* candidates[4] = { &lv->top[f], &lv->top[s],
+        &lv->bottom[below(lv, f)], &lv->bottom[below(lv, s)] };
+
+    for (int itr = 0; itr < 4; itr++) {
+      if (itr % 2 == 1 && candidates[itr] == candidates[itr - 1])
+        continue;
+      if ((*slot = bucket_find(candidates[itr], key)) >= 0)
+        return candidates[itr];
+    }
+    return NULL;
+  }
+
+  // fill_slot -- persist the pair in a free slot, then commit its bit
+  bool fill_slot(bucket* b, const key_type& key, const data_type& val) {
+    if (b->token == BUCKET_FULL)
+      return false;
+
+    int slot = __builtin_ctzl(~b->token & BUCKET_FULL);
+    b->slotkey[slot] = key;
+    b->slotdata[slot] = val;
+    persist_range(&b->slotkey[slot], sizeof(key_type));
+    persist_range(&b->slotdata[slot], sizeof(data_type));
+
+    b->token |= (1UL << slot);
+    persist_range(&b->token, sizeof(unsigned long));
+    return true;
+  }
+
+  void clear_slot(bucket* b, int slot) {
+    b->token &= ~(1UL << slot);
+    persist_range(&b->token, sizeof(unsigned long));
+  }
+
+  // move_one -- move a pair of b to its other bucket on the same level
+  bool move_one(levels* lv, bucket* level, bool top, size_t index) {
+    bucket* b = &level[index];
+
+    for (int slot = 0; slot < PHASH_SLOTS; slot++) {
+      const key_type& key = b->slotkey[slot];
+      size_t f = first(lv, key), s = second(lv, key);
+      size_t alt = (top) ? ((f == index) ? s : f) :
+          ((below(lv, f) == index) ? below(lv, s) : below(lv, f));
+
+      if (alt != index && fill_slot(&level[alt], key, b->slotdata[slot])) {
+        clear_slot(b, slot);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // place -- a free slot in the four buckets, after moving a pair if needed
+  bool place(levels* lv, const key_type& key, const data_type& val) {
+    size_t f = first(lv, key), s = second(lv, key);
+    bucket* top_f = &lv->top[f];
+    bucket* top_s = &lv->top[s];
+
+    // the emptier of the two top buckets
+    if (__builtin_popcountl(top_s->token) < __builtin_popcountl(top_f->token))
+      std::swap(top_f, top_s);
+
+    if (fill_slot(top_f, key, val) || fill_slot(top_s, key, val)
+        || fill_slot(&lv->bottom[below(lv, f)], key, val)
+        || fill_slot(&lv->bottom[below(lv, s)], key, val))
+      return true;
+
+    if (move_one(lv, lv->top, true, f) || move_one(lv, lv->top, true, s))
+      return fill_slot(&lv->top[f], key, val)
+          || fill_slot(&lv->top[s], key, val);
+
+    if (move_one(lv, lv->bottom, false, below(lv, f))
+        || move_one(lv, lv->bottom, false, below(lv, s)))
+      return fill_slot(&lv->bottom[below(lv, f)], key, val)
+          || fill_slot(&lv->bottom[below(lv, s)], key, val);
+
+    return false;
+  }
+
+  // *** Resizing
+
+  // resize -- grow the top level, rehashing the bottom level into it
+  void resize() {
+    m_resize = allocate_level(2 * m_levels->top_buckets);
+    persist_range(&m_resize, sizeof(bucket*));
+
+    rehash();
+  }
+
+  // rehash -- move the bottom pairs to the new top, then swap the levels
+  void rehash() {
+    levels* old = m_levels;
+    levels next = { m_resize, old->top, 2 * old->top_buckets, old->bottom };
+
+    for (size_t index = 0; index < old->top_buckets / 2; index++) {
+      bucket* b = &old->bottom[index];
+
+      for (unsigned long bits = b->token; bits; bits &= bits - 1) {
+        int slot = __builtin_ctzl(bits);
+        const key_type& key = b->slotkey[slot];
+        const data_type& val = b->slotdata[slot];
+        size_t f = first(&next, key), s = second(&next, key);
+        int found;
+
+        // a crash may have left the copy committed, the original not cleared
+        if (find(&next, key, &found) == NULL
+            && !fill_slot(&next.top[f], key, val)
+            && !fill_slot(&next.top[s], key, val)
+            && !fill_slot(&next.bottom[below(&next, f)], key, val)
+            && !fill_slot(&next.bottom[below(&next, s)], key, val)) {
+          std::cout << "phash: no room while rehashing" << std::endl;
+          exit(EXIT_FAILURE);
+        }
+
+        clear_slot(b, slot);
+      }
+    }
+
+    m_levels = allocate_levels(next.top, next.bottom, next.top_buckets);
+    m_levels->retired = next.retired;
+    persist_range(m_levels, sizeof(levels));
+    persist_range(&m_levels, sizeof(levels*));
+    pfree(old);
+
+    release_retired();
+    m_resize = NULL;
+    persist_range(&m_resize, sizeof(bucket*));
+  }
+
+  void release_retired() {
+    bucket* retired = m_levels->retired;
+
+    if (retired != NULL) {
+      m_levels->retired = NULL;
+      persist_range(&m_levels->retired, sizeof(bucket*));
+      pfree(retired);
+    }
+  }
+
+  // *** Recovery
+
+  inline void check_boot() {
+    if (persist && m_boot != pmem_boot)
+      recover();
+  }
+
+  // recover -- finish a resize and drop copies once after the pool is
+  // reopened
+  void recover() {
+    m_boot = pmem_boot;
+
+    release_retired();
+
+    if (m_resize != NULL) {
+      if (m_resize != m_levels->top) {
+        rehash();
+      } else {
+        m_resize = NULL;
+        persist_range(&m_resize, sizeof(bucket*));
+      }
+    }
+
+    // a pair is kept where a lookup finds it
+    m_itemcount = 0;
+    for (int level = 0; level < 2; level++) {
+      bucket* buckets = (level == 0) ? m_levels->top : m_levels->bottom;
+      size_t num_buckets = m_levels->top_buckets >> level;
+
+      for (size_t index = 0; index < num_buckets; index++) {
+        bucket* b = &buckets[index];
+
+        for (unsigned long bits = b->token; bits; bits &= bits - 1) {
+          int slot = __builtin_ctzl(bits), found;
+
+          if (find(m_levels, b->slotkey[slot], &found) != b || found != slot)
+            clear_slot(b, slot);
+          else
+            m_itemcount++;
+        }
+      }
+    }
+  }
+
+  // *** Allocation
+
+  inline void persist_range(void* addr, size_t len) {
+    if (persist)
+      pmem_persist(addr, len, 0);
+  }
+
+  bucket* allocate_level(size_t num_buckets) {
+    bucket* buckets = (bucket*) pmalloc(num_buckets * sizeof(bucket));
+
+    for (size_t index = 0; index < num_buckets; index++)
+      buckets[index].token = 0;
+    persist_range(buckets, num_buckets * sizeof(bucket));
+    if (persist)
+      pmemalloc_activate(buckets);
+    return buckets;
+  }
+
+  levels* allocate_levels(bucket* top, bucket* bottom, size_t top_buckets) {
+    levels* lv = (levels*) pmalloc(sizeof(levels));
+
+    lv->top = top;
+    lv->bottom = bottom;
+    lv->top_buckets = top_buckets;
+    lv->retired = NULL;
+    persist_range(lv, sizeof(levels));
+    if (persist)
+      pmemalloc_activate(lv);
+    return lv;
+  }
+};
+
+}
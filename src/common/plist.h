@@ -89,7 +89,8 @@ class plist {
       pmemalloc_activate(np);
 
     tailp->next = np;
-    pmem_persist(&tailp->next, sizeof(*np), 0);
+    pmem_flush(&tailp->next, sizeof(*np));
+    pmem_drain();
 
     index = _size;
     _size++;
@@ -102,6 +103,7 @@ class plist {
     int itr = 0;
 
     while (np != NULL) {
+      nvm_read();
       if (itr == index) {
         return np->val;
       } else {
@@ -119,6 +121,7 @@ class plist {
     bool found = false;
 
     while (np != NULL) {
+      nvm_read();
       if (np->val == val) {
         found = true;
         break;
@@ -143,6 +146,7 @@ class plist {
     unsigned int itr = 0;
 
     while (np != NULL) {
+      nvm_read();
       if (itr == index) {
         np->val = val;
         break;
@@ -168,7 +172,8 @@ class plist {
     } else {
       if (prev != NULL) {
         prev->next = np->next;
-        pmem_persist(&prev->next, sizeof(*np), 0);
+        pmem_flush(&prev->next, sizeof(*np));
+        pmem_drain();
       }
 
       // Update head and tail
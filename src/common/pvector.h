@@ -0,0 +1,152 @@
+#pragma once
+
+#include <vector>
+#include "libpm.h"
+
+namespace storage {
+
+// Persistent array of pointers, O(1) indexed access and append.
+// The slots live in one pool block, the count is bumped only after the
+// new slot is durable and a full block is swapped out in one pointer
+// store, so a crash never exposes a half written entry.
+// Lookups are served from a volatile copy that is rebuilt whenever the
+// pool was reopened since it was filled.
+template<typename V>
+class pvector {
+ public:
+  struct block {
+    size_t count;
+    size_t capacity;
+    V vals[];
+  };
+
+  struct block** vec;
+  V* cache;
+  size_t cache_capacity;
+  unsigned long cache_boot;
+
+  pvector(void** _vec)
+      : vec((struct block**) _vec),
+        cache(NULL),
+        cache_capacity(0),
+        cache_boot(0) {
+    if ((*vec) == NULL) {
+      (*vec) = alloc_block(4);
+      pmem_persist(vec, sizeof(*vec), 0);
+    }
+    reload();
+  }
+
+  ~pvector() {
+    clear();
+    pfree(*vec);
+    (*vec) = NULL;
+    delete[] cache;
+  }
+
+  // reload -- rebuild the volatile copy from the persistent slots
+  void reload() {
+    struct block* bp = (*vec);
+
+    // cache pointer from an earlier run is stale, not ours to free
+    if (cache_boot != pmem_boot)
+      cache = NULL;
+
+    delete[] cache;
+    cache = new V[bp->capacity];
+    cache_capacity = bp->capacity;
+
+    nvm_read();
+    memcpy(cache, bp->vals, bp->count * sizeof(V));
+    cache_boot = pmem_boot;
+  }
+
+  off_t push_back(V val) {
+    struct block* bp = (*vec);
+    struct block* np;
+    size_t index = bp->count;
+
+    // full, copy into a block twice the size and swap it in
+    if (index == bp->capacity) {
+      np = alloc_block(2 * bp->capacity);
+      memcpy(np->vals, bp->vals, index * sizeof(V));
+      np->count = index;
+      pmem_persist(np, sizeof(*np) + index * sizeof(V), 0);
+
+      (*vec) = np;
+      pmem_persist(vec, sizeof(*vec), 0);
+      pfree(bp);
+      bp = np;
+    }
+
+    bp->vals[index] = val;
+    pmem_persist(&bp->vals[index], sizeof(V), 0);
+
+    bp->count = index + 1;
+    pmem_persist(&bp->count, sizeof(bp->count), 0);
+
+    if (cache_boot != pmem_boot || cache_capacity != bp->capacity)
+      reload();
+    else
+      cache[index] = val;
+
+    return index;
+  }
+
+  // Returns the absolute pointer value
+  V at(const int index) {
+    if (cache_boot != pmem_boot)
+      reload();
+
+    if (index < 0 || (size_t) index >= (*vec)->count)
+      return NULL;
+
+    return cache[index];
+  }
+
+  void update(const int index, V val) {
+    struct block* bp = (*vec);
+
+    if (index < 0 || (size_t) index >= bp->count)
+      return;
+
+    bp->vals[index] = val;
+    pmem_persist(&bp->vals[index], sizeof(V), 0);
+
+    if (cache_boot == pmem_boot)
+      cache[index] = val;
+  }
+
+  void clear(void) {
+    (*vec)->count = 0;
+    pmem_persist(&(*vec)->count, sizeof((*vec)->count), 0);
+  }
+
+  std::vector<V> get_data(void) {
+    struct block* bp = (*vec);
+
+    return std::vector<V>(bp->vals, bp->vals + bp->count);
+  }
+
+  bool empty() {
+    return ((*vec)->count == 0);
+  }
+
+  int size() {
+    return (*vec)->count;
+  }
+
+ private:
+  static struct block* alloc_block(size_t capacity) {
+    struct block* bp = (struct block*) pmalloc(
+        sizeof(struct block) + capacity * sizeof(V));
+
+    bp->count = 0;
+    bp->capacity = capacity;
+    pmem_persist(bp, sizeof(*bp), 0);
+    pmemalloc_activate(bp);
+    return bp;
+  }
+};
+
+}
@@ -17,7 +17,8 @@ class record {
   record(schema* _sptr)
       : sptr(_sptr),
         data(NULL),
-        data_len(_sptr->ser_len) {
+        data_len(_sptr->ser_len),
+        slot(-1) {
     data = (char*) pmalloc(data_len*sizeof(char));//new char[data_len];
   }
 
@@ -131,14 +132,22 @@ class record {
   }
 
   void persist_data() {
-    pmemalloc_activate(data);
+    activation act = activation();
+
+    persist_data(&act);
+    pmemalloc_activate_batch(&act);
+  }
+
+  // Queue data and non-inlined fields on the caller's activation batch
+  void persist_data(activation* act) {
+    pmemalloc_activate_add(act, data);
 
     unsigned int field_itr;
     for (field_itr = 0; field_itr < sptr->num_columns; field_itr++) {
       if (sptr->columns[field_itr].inlined == 0) {
         void* ptr = get_pointer(field_itr);
         //printf("persist data :: %p \n", ptr);
-        pmemalloc_activate(ptr);
+        pmemalloc_activate_add(act, ptr);
       }
     }
   }
@@ -146,6 +155,9 @@ class record {
   schema* sptr;
   char* data;
   size_t data_len;
+
+  // position in the table's record heap, -1 if not stored
+  off_t slot;
 };
 
 }
@@ -0,0 +1,176 @@
+#pragma once
+
+#include <vector>
+#include "libpm.h"
+#include "pvector.h"
+#include "record.h"
+
+namespace storage {
+
+#define RECORD_HEAP_SLOTS 1024 /* slots per segment */
+#define RECORD_HEAP_WORDS (RECORD_HEAP_SLOTS / 64)
+
+// Persistent slotted heap of the records in a table.
+// Slots are grouped in segments, each with an allocation bitmap. A slot
+// is filled and persisted before its bit is set, and freed by clearing
+// the bit, so the bitmaps always name exactly the live records.
+// Records remember their slot, made durable before the bit is set, so
+// delete searches only for a record whose slot is stale.
+class record_heap {
+ public:
+  struct segment {
+    unsigned long bitmap[RECORD_HEAP_WORDS];
+    record* vals[RECORD_HEAP_SLOTS];
+  };
+
+  pvector<struct segment*>* segments;
+  size_t hint;  // no free slot in segments before this one
+
+  record_heap(void** _segments)
+      : segments(NULL),
+        hint(0) {
+    segments = new ((pvector<struct segment*>*) pmalloc(sizeof(pvector<struct segment*>))) pvector<struct segment*>(_segments);
+    pmemalloc_activate(segments);
+  }
+
+  ~record_heap() {
+    std::vector<struct segment*> seg_vec = segments->get_data();
+    for (struct segment* seg : seg_vec)
+      pfree(seg);
+
+    delete segments;
+  }
+
+  // Returns the slot the record was stored in
+  off_t push_back(record* rec) {
+    size_t num_segs = segments->size();
+    struct segment* seg;
+    unsigned int word, bit;
+    size_t seg_itr;
+
+    for (seg_itr = hint; seg_itr < num_segs; seg_itr++) {
+      seg = segments->at(seg_itr);
+      for (word = 0; word < RECORD_HEAP_WORDS; word++)
+        if (~seg->bitmap[word] != 0)
+          goto found;
+    }
+
+    seg = (struct segment*) pmalloc(sizeof(struct segment));
+    memset(seg->bitmap, 0, sizeof(seg->bitmap));
+    pmem_persist(seg->bitmap, sizeof(seg->bitmap), 0);
+    pmemalloc_activate(seg);
+    seg_itr = segments->push_back(seg);
+    word = 0;
+
+ found:
+    hint = seg_itr;
+    bit = __builtin_ctzl(~seg->bitmap[word]);
+
+    seg->vals[word * 64 + bit] = rec;
+    pmem_persist(&seg->vals[word * 64 + bit], sizeof(record*), 0);
+
+    rec->slot = seg_itr * RECORD_HEAP_SLOTS + word * 64 + bit;
+    pmem_persist(&rec->slot, sizeof(rec->slot), 0);
+
+    seg->bitmap[word] |= (1UL << bit);
+    pmem_persist(&seg->bitmap[word], sizeof(unsigned long), 0);
+
+    return rec->slot;
+  }
+
+  record* at(off_t slot) {
+    struct segment* seg;
+    unsigned int word, bit;
+
+    if (slot < 0 || (size_t) slot >= (size_t) segments->size() * RECORD_HEAP_SLOTS)
+      return NULL;
+
+    seg = segments->at(slot / RECORD_HEAP_SLOTS);
+    word = (slot % RECORD_HEAP_SLOTS) / 64;
+    bit = slot % 64;
+
+    if ((seg->bitmap[word] & (1UL << bit)) == 0)
+      return NULL;
+
+    return seg->vals[slot % RECORD_HEAP_SLOTS];
+  }
+
+  // Slot of a live record, searched for if rec->slot is stale, or -1
+  off_t find(record* rec) {
+    std::vector<struct segment*> seg_vec;
+    unsigned long bits;
+    unsigned int word, bit;
+
+    if (at(rec->slot) == rec)
+      return rec->slot;
+
+    seg_vec = segments->get_data();
+    for (size_t seg_itr = 0; seg_itr < seg_vec.size(); seg_itr++) {
+      for (word = 0; word < RECORD_HEAP_WORDS; word++) {
+        bits = seg_vec[seg_itr]->bitmap[word];
+        while (bits) {
+          bit = __builtin_ctzl(bits);
+          if (seg_vec[seg_itr]->vals[word * 64 + bit] == rec)
+            return seg_itr * RECORD_HEAP_SLOTS + word * 64 + bit;
+          bits &= bits - 1;
+        }
+      }
+    }
+
+    return -1;
+  }
+
+  // Returns false if the record is not in the heap
+  bool erase(record* rec) {
+    off_t slot = find(rec);
+    struct segment* seg;
+    unsigned int word;
+
+    if (slot < 0)
+      return false;
+
+    seg = segments->at(slot / RECORD_HEAP_SLOTS);
+    word = (slot % RECORD_HEAP_SLOTS) / 64;
+
+    seg->bitmap[word] &= ~(1UL << (slot % 64));
+    pmem_persist(&seg->bitmap[word], sizeof(unsigned long), 0);
+
+    if ((size_t) slot / RECORD_HEAP_SLOTS < hint)
+      hint = slot / RECORD_HEAP_SLOTS;
+
+    rec->slot = -1;
+    return true;
+  }
+
+  void clear(void) {
+    std::vector<struct segment*> seg_vec = segments->get_data();
+
+    for (struct segment* seg : seg_vec) {
+      memset(seg->bitmap, 0, sizeof(seg->bitmap));
+      pmem_persist(seg->bitmap, sizeof(seg->bitmap), 0);
+    }
+
+    hint = 0;
+  }
+
+  std::vector<record*> get_data(void) {
+    std::vector<struct segment*> seg_vec = segments->get_data();
+    std::vector<record*> data;
+    unsigned long bits;
+    unsigned int word;
+
+    for (struct segment* seg : seg_vec) {
+      for (word = 0; word < RECORD_HEAP_WORDS; word++) {
+        bits = seg->bitmap[word];
+        while (bits) {
+          data.push_back(seg->vals[word * 64 + __builtin_ctzl(bits)]);
+          bits &= bits - 1;
+        }
+      }
+    }
+
+    return data;
+  }
+};
+
+}
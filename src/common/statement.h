@@ -12,7 +12,9 @@ enum operation_type {
   Insert,
   Delete,
   Update,
-  Select
+  Select,
+  Scan,
+  MultiSelect
 };
 
 class statement {
@@ -24,7 +26,9 @@ class statement {
         table_id(-1),
         rec_ptr(NULL),
         table_index_id(-1),
-        projection(NULL) {
+        projection(NULL),
+        end_ptr(NULL),
+        limit(0) {
   }
 
   // Insert and Delete
@@ -34,7 +38,9 @@ class statement {
         table_id(_table_id),
         rec_ptr(_rptr),
         table_index_id(-1),
-        projection(NULL) {
+        projection(NULL),
+        end_ptr(NULL),
+        limit(0) {
   }
 
   // Update
@@ -46,7 +52,9 @@ class statement {
         rec_ptr(_rptr),
         field_ids(_fid),
         table_index_id(-1),
-        projection(NULL) {
+        projection(NULL),
+        end_ptr(NULL),
+        limit(0) {
   }
 
   // Select
@@ -57,7 +65,51 @@ class statement {
         table_id(_table_id),
         rec_ptr(_rptr),
         table_index_id(_table_index_id),
-        projection(_projection) {
+        projection(_projection),
+        end_ptr(NULL),
+        limit(0) {
+  }
+
+  // Scan, keys from rec_ptr up to end_ptr in index order
+  statement(int _txn_id, operation_type _otype, int _table_id, record* _rptr,
+            record* _end_ptr, int _table_index_id, schema* _projection,
+            size_t _limit)
+      : transaction_id(_txn_id),
+        op_type(_otype),
+        table_id(_table_id),
+        rec_ptr(_rptr),
+        table_index_id(_table_index_id),
+        projection(_projection),
+        end_ptr(_end_ptr),
+        limit(_limit) {
+  }
+
+  // Scan of the keys equal to rec_ptr's, for a non-unique index
+  statement(int _txn_id, operation_type _otype, int _table_id, record* _rptr,
+            int _table_index_id, schema* _projection, size_t _limit)
+      : transaction_id(_txn_id),
+        op_type(_otype),
+        table_id(_table_id),
+        rec_ptr(_rptr),
+        table_index_id(_table_index_id),
+        projection(_projection),
+        end_ptr(NULL),
+        limit(_limit) {
+  }
+
+  // MultiSelect, one key record per select
+  statement(int _txn_id, operation_type _otype, int _table_id,
+            std::vector<record*> _rptrs, int _table_index_id,
+            schema* _projection)
+      : transaction_id(_txn_id),
+        op_type(_otype),
+        table_id(_table_id),
+        rec_ptr(NULL),
+        table_index_id(_table_index_id),
+        projection(_projection),
+        end_ptr(NULL),
+        limit(0),
+        rec_ptrs(_rptrs) {
   }
 
   int transaction_id;
@@ -74,6 +126,13 @@ class statement {
   int table_index_id;
   schema* projection;
 
+  // Scan, up to the keys of rec_ptr if end_ptr is NULL
+  record* end_ptr;
+  size_t limit;
+
+  // MultiSelect
+  std::vector<record*> rec_ptrs;
+
 };
 
 }
@@ -103,7 +103,7 @@ class storage {
     ret = fsync(storage_file_fd);
 
     // PCOMMIT
-    pcommit(PCOMMIT_LATENCY);
+    pcommit();
 
     if (ret != 0) {
       perror("fsync failed");
@@ -124,6 +124,7 @@ class storage {
       perror("fread");
       exit(EXIT_FAILURE);
     }
+    buf[rc] = '\0';
 
     entry_str = std::string(buf);
     delete[] buf;
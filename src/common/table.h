@@ -3,6 +3,8 @@
 #include "schema.h"
 #include "table_index.h"
 #include "plist.h"
+#include "pvector.h"
+#include "record_heap.h"
 #include "storage.h"
 
 namespace storage {
@@ -23,11 +25,10 @@ class table {
     memcpy(table_name, name_str.c_str(), len + 1);
     pmemalloc_activate(table_name);
 
-    pm_data = new ((plist<record*>*) pmalloc(sizeof(plist<record*>))) plist<record*>(&sp->ptrs[get_next_pp()], &sp->ptrs[get_next_pp()]);
+    pm_data = new ((record_heap*) pmalloc(sizeof(record_heap))) record_heap(&sp->ptrs[get_next_pp()]);
     pmemalloc_activate(pm_data);
 
-    indices = new ((plist<table_index*>*) pmalloc(sizeof(plist<table_index*>))) plist<table_index*>(&sp->ptrs[get_next_pp()],
-                                      					&sp->ptrs[get_next_pp()]);
+    indices = new ((pvector<table_index*>*) pmalloc(sizeof(pvector<table_index*>))) pvector<table_index*>(&sp->ptrs[get_next_pp()]);
     pmemalloc_activate(indices);
 
   }
@@ -52,11 +53,11 @@ class table {
   size_t max_tuple_size;
   unsigned int num_indices;
 
-  plist<table_index*>* indices;
+  pvector<table_index*>* indices;
 
   storage fs_data;
 
-  plist<record*>* pm_data;
+  record_heap* pm_data;
 };
 
 }
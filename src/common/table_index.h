@@ -1,47 +1,217 @@
 #pragma once
 
+#include <vector>
+
 #include "schema.h"
 #include "record.h"
-#include "pbtree.h"
+#include "index_map.h"
+#include "index_key.h"
 #include "config.h"
 
 namespace storage {
 
+/// No tuple in the table file
+#define INVALID_OFFSET ((off_t) -1)
+
+/*
+ * index_val -- what an index key maps to, the record in the pool and the
+ * offset of its tuple in the table file. WAL keeps both, OPT_WAL only the
+ * record, and the LSM engines either or both until the next merge. A NULL
+ * record or INVALID_OFFSET marks the part as missing.
+ */
+struct index_val {
+  index_val()
+      : rec(NULL),
+        offset(INVALID_OFFSET) {
+  }
+
+  index_val(record* _rec, off_t _offset)
+      : rec(_rec),
+        offset(_offset) {
+  }
+
+  record* rec;
+  off_t offset;
+};
+
 class table_index {
  public:
 
+  // A non-unique index has dup_cols leading key columns that may repeat,
+  // followed by the primary key columns that tell the entries apart
   table_index(schema* _sptr, unsigned int _num_fields, config& conf,
-              struct static_info* sp)
+              struct static_info* sp, index_type type = BTREE_INDEX,
+              unsigned int dup_cols = 0)
       : sptr(_sptr),
         num_fields(_num_fields),
-        pm_map(NULL),
-        off_map(NULL) {
+        allow_duplicates(dup_cols != 0),
+        match_len(key_encoder::key_len(_sptr)),
+        map(NULL),
+        pm_count(0),
+        fs_count(0),
+        count_boot(pmem_boot) {
+
+    if (key_encoder::key_len(sptr) > INDEX_KEY_LEN) {
+      std::cout << "index key longer than " << INDEX_KEY_LEN << " bytes"
+                << std::endl;
+      exit(EXIT_FAILURE);
+    }
 
-    pm_map = new ((pbtree<unsigned long, record*>*) pmalloc(sizeof(pbtree<unsigned long, record*>))) \
-							pbtree<unsigned long, record*>(&sp->ptrs[get_next_pp()]);
-    pmemalloc_activate(pm_map);
+    if (allow_duplicates) {
+      if (type == HASH_INDEX) {
+        std::cout << "non-unique index needs a tree" << std::endl;
+        exit(EXIT_FAILURE);
+      }
+      match_len = key_encoder::prefix_len(sptr, dup_cols);
+    }
 
-    off_map = new ((pbtree<unsigned long, off_t>*) pmalloc(sizeof(pbtree<unsigned long, off_t>))) \
-							pbtree<unsigned long, off_t>(&sp->ptrs[get_next_pp()]);
-    pmemalloc_activate(off_map);
+    map = new ((index_map<index_val>*) pmalloc(sizeof(index_map<index_val>))) \
+							index_map<index_val>(type, &sp->ptrs[get_next_pp()]);
+    pmemalloc_activate(map);
 
     if (conf.etype == engine_type::WAL || conf.etype == engine_type::LSM) {
-      pm_map->disable_persistence();
-      off_map->disable_persistence();
+      map->disable_persistence();
+    } else if (conf.hybrid_index) {
+      map->enable_hybrid();
     }
   }
 
   ~table_index() {
     delete sptr;
-    delete pm_map;
-    delete off_map;
+    delete map;
+  }
+
+  // insert -- add the entry unless key is present
+  bool insert(const index_key& key, const index_val& val) {
+    if (map->insert(key, val) == false)
+      return false;
+
+    tally(val, 1);
+    return true;
+  }
+
+  // update -- replace both parts of key, as set_rec()
+  void update(const index_key& key, const index_val& val) {
+    index_val old;
+
+    map->at(key, &old);
+    put(key, old, val);
+  }
+
+  void erase(const index_key& key) {
+    index_val old;
+
+    if (map->at(key, &old)) {
+      map->erase(key);
+      tally(old, -1);
+    }
+  }
+
+  void clear() {
+    map->clear();
+    pm_count = fs_count = 0;
+    count_boot = pmem_boot;
+  }
+
+  // set_rec -- the record part of key, the entry goes once both are missing
+  void set_rec(const index_key& key, record* rec) {
+    index_val old, val;
+
+    map->at(key, &old);
+    val = old;
+    val.rec = rec;
+    put(key, old, val);
+  }
+
+  // set_offset -- the offset part of key, as set_rec()
+  void set_offset(const index_key& key, off_t offset) {
+    index_val old, val;
+
+    map->at(key, &old);
+    val = old;
+    val.offset = offset;
+    put(key, old, val);
+  }
+
+  // sizes -- entries with a record part and with an offset part, recounted
+  // once after the pool is reopened
+  void sizes(size_t* pm_size, size_t* fs_size) {
+    if (count_boot != pmem_boot)
+      recount();
+
+    *pm_size = pm_count;
+    *fs_size = fs_count;
+  }
+
+  // drop_recs -- forget every record part, after the pool is reset
+  void drop_recs() {
+    drop(true);
+  }
+
+  // drop_offsets -- forget every offset part, before the log is replayed
+  void drop_offsets() {
+    drop(false);
   }
 
   schema* sptr;
   unsigned int num_fields;
 
-  pbtree<unsigned long, record*>* pm_map;
-  pbtree<unsigned long, off_t>* off_map;
+  // Scans match the first match_len key bytes, all of them if unique
+  bool allow_duplicates;
+  size_t match_len;
+
+  index_map<index_val>* map;
+
+ private:
+
+  // put -- old is what key held, both parts missing if it was absent
+  void put(const index_key& key, const index_val& old, const index_val& val) {
+    if (val.rec == NULL && val.offset == INVALID_OFFSET)
+      map->erase(key);
+    else if (map->update(key, val) != 0)
+      map->insert(key, val);
+
+    tally(old, -1);
+    tally(val, 1);
+  }
+
+  inline void tally(const index_val& val, long delta) {
+    pm_count += (val.rec != NULL) ? delta : 0;
+    fs_count += (val.offset != INVALID_OFFSET) ? delta : 0;
+  }
+
+  void recount() {
+    index_map<index_val>::iterator itr;
+
+    pm_count = fs_count = 0;
+    for (itr = map->begin(); itr != map->end(); ++itr)
+      tally(itr.data(), 1);
+    count_boot = pmem_boot;
+  }
+
+  void drop(bool recs) {
+    std::vector<index_key> keys;
+    index_map<index_val>::iterator itr;
+
+    // collect first, erasing would move the pairs under the iterator
+    for (itr = map->begin(); itr != map->end(); ++itr) {
+      const index_val& val = itr.data();
+      if ((recs) ? val.rec != NULL : val.offset != INVALID_OFFSET)
+        keys.push_back(itr.key());
+    }
+
+    for (const index_key& key : keys) {
+      if (recs)
+        set_rec(key, NULL);
+      else
+        set_offset(key, INVALID_OFFSET);
+    }
+  }
+
+  // Entry counts of sizes(), volatile and valid while count_boot is pmem_boot
+  size_t pm_count;
+  size_t fs_count;
+  unsigned long count_boot;
 };
 
 }
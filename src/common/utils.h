@@ -61,10 +61,36 @@ void wrlock(pthread_rwlock_t* access);
 void rdlock(pthread_rwlock_t* access);
 void unlock(pthread_rwlock_t* access);
 
-// PCOMMIT
-// PCOMMIT helpers
-
-#define CPU_FREQ_MHZ (2593)
+// NVM EMULATION
+// Latencies are in ns and the bandwidth cap in MB/s, zero disables a knob.
+// The fence latency alone is also charged by pcommit() on the fs engines.
+
+#define NVM_LINE_SIZE 64
+#define NVM_FENCE_LATENCY 100
+
+struct nvm_config {
+  unsigned long write_latency;  // per flushed line
+  unsigned long fence_latency;  // per drain
+  unsigned long read_latency;   // per pool node visited
+  unsigned long bandwidth;      // cap on flushed lines
+};
+
+// same knobs in TSC cycles, derived by nvm_configure()
+struct nvm_cycles {
+  unsigned long write;
+  unsigned long fence;
+  unsigned long read;
+  unsigned long line;
+};
+
+extern double tsc_per_ns;
+extern bool nvm_emulate;
+extern nvm_config nvm;
+extern nvm_cycles nvm_cyc;
+
+double nvm_calibrate();
+void nvm_configure(const nvm_config& cfg);
+void nvm_throttle(unsigned long lines);
 
 static inline unsigned long read_tsc(void){
     unsigned long var;
@@ -80,38 +106,50 @@ static inline void cpu_pause(){
     __asm__ volatile ("pause" ::: "memory");
 }
 
-static inline void clwb(__attribute__((unused)) void *addr){
-    cpu_pause();
-}
-
-static inline void pcommit(unsigned long lat){
-    unsigned long etsc = read_tsc() + (unsigned long)(lat*CPU_FREQ_MHZ/1000);
+static inline void nvm_spin(unsigned long cycles){
+    unsigned long etsc = read_tsc() + cycles;
     while (read_tsc() < etsc)
         cpu_pause();
 }
 
+// charge the lines written back by one flush
+static inline void nvm_write(unsigned long lines){
+    if (!nvm_emulate)
+        return;
+
+    if (nvm_cyc.write)
+        nvm_spin(lines * nvm_cyc.write);
+    if (nvm_cyc.line)
+        nvm_throttle(lines);
+}
+
+// charge a dependent load from the pool
+static inline void nvm_read(){
+    if (nvm_cyc.read)
+        nvm_spin(nvm_cyc.read);
+}
+
+static inline void pcommit(){
+    if (nvm_cyc.fence)
+        nvm_spin(nvm_cyc.fence);
+}
+
 #define DELAY_IN_NS (800)
 
 static inline void test_pcommit(){
     unsigned long stsc, etsc;
 
     stsc = read_tsc();
-    pcommit(DELAY_IN_NS);
+    nvm_spin((unsigned long) (DELAY_IN_NS * tsc_per_ns));
     etsc = read_tsc();
     printf ("pm_wbarrier latency: %lu ns\n",
-            (unsigned long)((etsc-stsc)*1000/CPU_FREQ_MHZ));
+            (unsigned long)((etsc-stsc)/tsc_per_ns));
 
     stsc = read_tsc();
-    pcommit(2*DELAY_IN_NS);
+    nvm_spin((unsigned long) (2 * DELAY_IN_NS * tsc_per_ns));
     etsc = read_tsc();
     printf ("pm_wbarrier latency: %lu ns\n",
-            (unsigned long)((etsc-stsc)*1000/CPU_FREQ_MHZ));
-
-    stsc = read_tsc();
-    clwb(NULL);
-    etsc = read_tsc();
-    printf ("clwb latency: %lu ns\n",
-            (unsigned long)((etsc-stsc)*1000/CPU_FREQ_MHZ));
+            (unsigned long)((etsc-stsc)/tsc_per_ns));
 }
 
 }
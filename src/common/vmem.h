@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace storage {
+
+// Volatile small object heap behind the global operator new.
+// Objects are not zeroed, callers that need zeros must ask for them.
+
+/* address range for the volatile heap, right above the pool range */
+#define VMEM_BASE 0x0000200000000000
+#define VMEM_MAX_SIZE (64UL * 1024 * 1024 * 1024)
+#define VMEM_SPAN_SIZE (64 * 1024)  /* carved into objects of one class */
+#define VMEM_MAX_SMALL 1024 /* larger objects come from malloc */
+
+// vmem_in_heap -- true for any address in the volatile heap range
+static inline bool vmem_in_heap(void *addr) {
+  return (uintptr_t) addr - VMEM_BASE < VMEM_MAX_SIZE;
+}
+
+void *vmem_alloc(size_t size);
+void vmem_free(void *ptr);
+
+}
@@ -3,6 +3,7 @@
 #include <string>
 #include <sstream>
 #include <atomic>
+#include <memory>
 #include <thread>
 #include <fstream>
 
@@ -25,6 +26,8 @@ class wal_engine : public engine_api {
   ~wal_engine();
 
   std::string select(const statement& st);
+  std::vector<std::string> scan(const statement& st);
+  std::vector<std::string> multi_select(const statement& st);
   int update(const statement& st);
   int insert(const statement& t);
   int remove(const statement& t);
@@ -41,7 +44,7 @@ class wal_engine : public engine_api {
   database* db;
 
   logger fs_log;
-  std::hash<std::string> hash_fn;
+  key_encoder ke;
   std::stringstream entry_stream;
   std::string entry_str;
 
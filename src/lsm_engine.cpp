@@ -58,31 +58,80 @@ std::string lsm_engine::select(const statement& st) {
   std::string val;
 
   record*rec_ptr = st.rec_ptr;
-  record *pm_rec = NULL, *fs_rec = NULL;
   table* tab = db->tables->at(st.table_id);
   table_index* table_index = tab->indices->at(st.table_index_id);
-  std::string key_str = sr.serialize(rec_ptr, table_index->sptr);
+  index_key key = ke.encode(rec_ptr, table_index->sptr);
+  index_val ival;
 
-  unsigned long key = hash_fn(key_str);
-  bool fs_storage = false;
-  off_t storage_offset = 0;
+  if (table_index->map->at(key, &ival))
+    val = lookup(tab, ival, st.projection);
+  LOG_INFO("val : %s", val.c_str());
+  //std::cout << "val : " << val << std::endl;
 
-  // Check if key exists in mem
-  table_index->pm_map->at(key, &pm_rec);
+  delete rec_ptr;
+  return val;
+}
 
-  // Check if key exists in fs
-  fs_storage = table_index->off_map->at(key, &storage_offset);
+std::vector<std::string> lsm_engine::scan(const statement& st) {
+  LOG_INFO("Scan");
+  table* tab = db->tables->at(st.table_id);
+  table_index* table_index = tab->indices->at(st.table_index_id);
+  std::vector<std::string> vals;
+  std::string val;
 
-  if (fs_storage) {
-    val = tab->fs_data.at(storage_offset);
+  record* end_ptr = (st.end_ptr) ? st.end_ptr : st.rec_ptr;
+  index_key key = ke.encode_bound(st.rec_ptr, table_index->sptr,
+                                  table_index->match_len, false);
+  index_key end_key = ke.encode_bound(end_ptr, table_index->sptr,
+                                      table_index->match_len, true);
+
+  // Each entry holds the versions in mem and in fs
+  index_map<index_val>::iterator itr;
+  for (itr = table_index->map->lower_bound(key);
+      itr != table_index->map->end() && vals.size() < st.limit; ++itr) {
+    if (end_key < itr.key())
+      break;
+
+    val = lookup(tab, itr.data(), st.projection);
+    if (!val.empty())
+      vals.push_back(val);
+  }
+
+  delete st.rec_ptr;
+  delete st.end_ptr;
+  return vals;
+}
+
+std::vector<std::string> lsm_engine::multi_select(const statement& st) {
+  LOG_INFO("Multi Select");
+  std::vector<std::string> vals;
+
+  for (record* rec_ptr : st.rec_ptrs)
+    vals.push_back(
+        select(
+            statement(st.transaction_id, operation_type::Select, st.table_id,
+                      rec_ptr, st.table_index_id, st.projection)));
+
+  return vals;
+}
+
+// Merge the versions of key in mem and in fs
+std::string lsm_engine::lookup(table* tab, const index_val& ival,
+                              schema* projection) {
+  std::string val;
+  record *pm_rec = ival.rec, *fs_rec = NULL;
+
+  // Check if key exists in fs
+  if (ival.offset != INVALID_OFFSET) {
+    val = tab->fs_data.at(ival.offset);
     if (!val.empty())
       fs_rec = sr.deserialize(val, tab->sptr);
   }
 
   if (pm_rec != NULL && fs_rec == NULL) {
-    val = sr.serialize(pm_rec, st.projection);
+    val = sr.serialize(pm_rec, projection);
   } else if (pm_rec == NULL && fs_rec != NULL) {
-    val = sr.serialize(fs_rec, st.projection);
+    val = sr.serialize(fs_rec, projection);
 
     fs_rec->clear_data();
     delete fs_rec;
@@ -94,14 +143,10 @@ std::string lsm_engine::select(const statement& st) {
         fs_rec->set_data(field_itr, pm_rec);
     }
 
-    val = sr.serialize(fs_rec, st.projection);
+    val = sr.serialize(fs_rec, projection);
     delete fs_rec;
   }
 
-  LOG_INFO("val : %s", val.c_str());
-  //std::cout << "val : " << val << std::endl;
-
-  delete rec_ptr;
   return val;
 }
 
@@ -109,17 +154,15 @@ int lsm_engine::insert(const statement& st) {
   LOG_INFO("Insert");
   record* after_rec = st.rec_ptr;
   table* tab = db->tables->at(st.table_id);
-  plist<table_index*>* indices = tab->indices;
+  pvector<table_index*>* indices = tab->indices;
 
   unsigned int num_indices = tab->num_indices;
   unsigned int index_itr;
 
-  std::string key_str = sr.serialize(after_rec, indices->at(0)->sptr);
-  unsigned long key = hash_fn(key_str);
+  index_key key = ke.encode(after_rec, indices->at(0)->sptr);
 
   // Check if key exists
-  if (indices->at(0)->pm_map->exists(key)
-      || indices->at(0)->off_map->exists(key)) {
+  if (indices->at(0)->map->exists(key)) {
     after_rec->clear_data();
     delete after_rec;
     return EXIT_SUCCESS;
@@ -136,10 +179,10 @@ int lsm_engine::insert(const statement& st) {
 
   // Add entry in indices
   for (index_itr = 0; index_itr < num_indices; index_itr++) {
-    key_str = sr.serialize(after_rec, indices->at(index_itr)->sptr);
-    key = hash_fn(key_str);
+    key = ke.encode(after_rec, indices->at(index_itr)->sptr);
 
-    indices->at(index_itr)->pm_map->insert(key, after_rec);
+    indices->at(index_itr)->insert(key,
+                                   index_val(after_rec, INVALID_OFFSET));
   }
 
   return EXIT_SUCCESS;
@@ -149,25 +192,23 @@ int lsm_engine::remove(const statement& st) {
   LOG_INFO("Remove");
   record* rec_ptr = st.rec_ptr;
   table* tab = db->tables->at(st.table_id);
-  plist<table_index*>* indices = tab->indices;
+  pvector<table_index*>* indices = tab->indices;
 
   unsigned int num_indices = tab->num_indices;
   unsigned int index_itr;
   std::string val;
 
-  std::string key_str = sr.serialize(rec_ptr, indices->at(0)->sptr);
-  //LOG_INFO("Key_str :: --%s-- ", key_str.c_str());
-  unsigned long key = hash_fn(key_str);
+  index_key key = ke.encode(rec_ptr, indices->at(0)->sptr);
+
+  index_val before_val;
 
   // Check if key does not exist
-  if (indices->at(0)->pm_map->exists(key) == 0
-      && indices->at(0)->off_map->exists(key) == 0) {
+  if (indices->at(0)->map->at(key, &before_val) == false) {
     delete rec_ptr;
     return EXIT_SUCCESS;
   }
 
-  record* before_rec = NULL;
-  indices->at(0)->pm_map->at(key, &before_rec);
+  record* before_rec = before_val.rec;
 
   // Add log entry
   entry_stream.str("");
@@ -179,11 +220,9 @@ int lsm_engine::remove(const statement& st) {
 
   // Remove entry in indices
   for (index_itr = 0; index_itr < num_indices; index_itr++) {
-    key_str = sr.serialize(rec_ptr, indices->at(index_itr)->sptr);
-    key = hash_fn(key_str);
+    key = ke.encode(rec_ptr, indices->at(index_itr)->sptr);
 
-    indices->at(index_itr)->pm_map->erase(key);
-    indices->at(index_itr)->off_map->erase(key);
+    indices->at(index_itr)->erase(key);
   }
 
   delete before_rec;
@@ -194,21 +233,23 @@ int lsm_engine::update(const statement& st) {
   LOG_INFO("Update");
   record* rec_ptr = st.rec_ptr;
   table* tab = db->tables->at(st.table_id);
-  plist<table_index*>* indices = db->tables->at(st.table_id)->indices;
+  pvector<table_index*>* indices = db->tables->at(st.table_id)->indices;
 
   unsigned int num_indices = tab->num_indices;
   unsigned int index_itr;
 
-  std::string key_str = sr.serialize(rec_ptr, indices->at(0)->sptr);
-  unsigned long key = hash_fn(key_str);
+  index_key key = ke.encode(rec_ptr, indices->at(0)->sptr);
   std::string val;
-  record* before_rec = NULL;
+  index_val before_val;
   void *before_field;
 
   entry_stream.str("");
 
-  // Check if key does not exist
-  if (indices->at(0)->pm_map->at(key, &before_rec) == false) {
+  indices->at(0)->map->at(key, &before_val);
+  record* before_rec = before_val.rec;
+
+  // Check if key does not exist in mem
+  if (before_rec == NULL) {
     before_rec = rec_ptr;
 
     entry_stream << st.transaction_id << " " << st.op_type << " " << st.table_id
@@ -218,10 +259,9 @@ int lsm_engine::update(const statement& st) {
     entry_str = entry_stream.str();
 
     for (index_itr = 0; index_itr < num_indices; index_itr++) {
-      key_str = sr.serialize(before_rec, indices->at(index_itr)->sptr);
-      key = hash_fn(key_str);
+      key = ke.encode(before_rec, indices->at(index_itr)->sptr);
 
-      indices->at(index_itr)->pm_map->insert(key, before_rec);
+      indices->at(index_itr)->set_rec(key, before_rec);
     }
   } else {
     entry_stream << st.transaction_id << " " << st.op_type << " " << st.table_id
@@ -251,13 +291,12 @@ void lsm_engine::load(const statement& st) {
   //LOG_INFO("Load");
   record* after_rec = st.rec_ptr;
   table* tab = db->tables->at(st.table_id);
-  plist<table_index*>* indices = tab->indices;
+  pvector<table_index*>* indices = tab->indices;
 
   unsigned int num_indices = tab->num_indices;
   unsigned int index_itr;
 
-  std::string key_str = sr.serialize(after_rec, indices->at(0)->sptr);
-  unsigned long key = hash_fn(key_str);
+  index_key key = ke.encode(after_rec, indices->at(0)->sptr);
 
   if (!conf.recovery) {
     // Add log entry
@@ -272,10 +311,10 @@ void lsm_engine::load(const statement& st) {
 
   // Add entry in indices
   for (index_itr = 0; index_itr < num_indices; index_itr++) {
-    key_str = sr.serialize(after_rec, indices->at(index_itr)->sptr);
-    key = hash_fn(key_str);
+    key = ke.encode(after_rec, indices->at(index_itr)->sptr);
 
-    indices->at(index_itr)->pm_map->insert(key, after_rec);
+    indices->at(index_itr)->insert(key,
+                                   index_val(after_rec, INVALID_OFFSET));
   }
 }
 
@@ -303,29 +342,35 @@ void lsm_engine::merge(bool force) {
     table_index *p_index = tab->indices->at(0);
     std::vector<table_index*> indices = tab->indices->get_data();
 
-    pbtree<unsigned long, record*>* pm_map = p_index->pm_map;
+    index_map<index_val>* map = p_index->map;
+    index_map<index_val>::iterator itr;
+    size_t pm_size, fs_size;
+
+    p_index->sizes(&pm_size, &fs_size);
 
-    size_t compact_threshold = conf.merge_ratio * p_index->off_map->size();
-    bool compact = (pm_map->size() > compact_threshold);
+    size_t compact_threshold = conf.merge_ratio * fs_size;
+    bool compact = (pm_size > compact_threshold);
 
     // Check if need to merge
     if (force || compact) {
       //std::std::cout << "Merging ! " << std::endl;
-      pbtree<unsigned long, record*>::const_iterator itr;
       record *pm_rec, *fs_rec;
-      unsigned long key;
+      index_key key;
       off_t storage_offset;
       std::string val;
 
       // All tuples in table
-      for (itr = pm_map->begin(); itr != pm_map->end(); itr++) {
-        key = (*itr).first;
-        pm_rec = (*itr).second;
+      for (itr = map->begin(); itr != map->end(); itr++) {
+        pm_rec = itr.data().rec;
+        storage_offset = itr.data().offset;
+
+        if (pm_rec == NULL)
+          continue;
 
         fs_rec = NULL;
 
         // Check if we need to merge
-        if (p_index->off_map->at(key, &storage_offset)) {
+        if (storage_offset != INVALID_OFFSET) {
           val = tab->fs_data.at(storage_offset);
 
           if (!val.empty()) {
@@ -349,21 +394,17 @@ void lsm_engine::merge(bool force) {
           //LOG_INFO("Merge :: insert new :: val :: %s ", val.c_str());
 
           storage_offset = tab->fs_data.push_back(val);
+        }
 
-          for (table_index* index : indices) {
-            std::string key_str = sr.serialize(pm_rec, index->sptr);
-            key = hash_fn(key_str);
-            index->off_map->insert(key, storage_offset);
-          }
+        // Clear mem table entry
+        for (table_index* index : indices) {
+          key = ke.encode(pm_rec, index->sptr);
+          index->update(key, index_val(NULL, storage_offset));
         }
 
         //pm_rec->clear_data();
         delete pm_rec;
       }
-
-      // Clear mem table
-      for (table_index* index : indices)
-        index->pm_map->clear();
     }
   }
 
@@ -390,12 +431,12 @@ void lsm_engine::recovery() {
   fs_log.sync();
   fs_log.disable();
 
-  // Clear pm map and rebuild it
+  // Clear the mem entries and rebuild them
   std::vector<table*> tables = db->tables->get_data();
   for (table* tab : tables) {
     std::vector<table_index*> indices = tab->indices->get_data();
     for (table_index* index : indices) {
-      index->pm_map->clear();
+      index->drop_recs();
     }
   }
 
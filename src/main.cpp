@@ -38,7 +38,15 @@ namespace storage {
             "   -r --recovery          :  Recovery mode \n"
             "   -b --load-batch-size   :  Load batch size \n"
             "   -j --test_b_mode       :  Test benchmark mode \n"
-            "   -i --multi-executors   :  Multiple executors \n");
+            "   -i --multi-executors   :  Multiple executors \n"
+            "   -W --nvm-write-latency :  NVM latency per flushed line (ns) \n"
+            "   -F --nvm-fence-latency :  NVM latency per fence (ns) \n"
+            "   -R --nvm-read-latency  :  NVM extra latency per pool read (ns) \n"
+            "   -B --nvm-bandwidth     :  NVM write bandwidth cap (MB/s) \n"
+            "   -H --huge-pages        :  Back the pool with 2MB pages \n"
+            "   -D --defrag-interval   :  Background defrag pass interval (ms) \n"
+            "   -I --hybrid-index      :  Keep index inner nodes in DRAM \n"
+            "   -K --hash-index        :  Hash tables for point lookup indexes \n");
     exit(EXIT_FAILURE);
   }
 
@@ -63,6 +71,14 @@ namespace storage {
     { "help", no_argument, NULL, 'h' },
     { "test-mode", optional_argument, NULL, 'j' },
     { "ycsb-update-one", no_argument, NULL, 'u' },
+    { "nvm-write-latency", required_argument, NULL, 'W' },
+    { "nvm-fence-latency", required_argument, NULL, 'F' },
+    { "nvm-read-latency", required_argument, NULL, 'R' },
+    { "nvm-bandwidth", required_argument, NULL, 'B' },
+    { "huge-pages", no_argument, NULL, 'H' },
+    { "defrag-interval", required_argument, NULL, 'D' },
+    { "hybrid-index", no_argument, NULL, 'I' },
+    { "hash-index", no_argument, NULL, 'K' },
     { NULL, 0, NULL, 0 } };
 
   static void parse_arguments(int argc, char* argv[], config& state) {
@@ -105,10 +121,21 @@ namespace storage {
 
     state.test_benchmark_mode = 0;
 
+    state.nvm_emulate = false;
+    state.nvm_write_latency = 0;
+    state.nvm_fence_latency = NVM_FENCE_LATENCY;
+    state.nvm_read_latency = 0;
+    state.nvm_bandwidth = 0;
+
+    state.huge_pages = false;
+    state.defrag_interval = 0;
+    state.hybrid_index = false;
+    state.hash_index = false;
+
     // Parse args
     while (1) {
       int idx = 0;
-      int c = getopt_long(argc, argv, "f:x:k:e:p:g:q:b:j:svwascmhludytzori", opts,
+      int c = getopt_long(argc, argv, "f:x:k:e:p:g:q:b:j:W:F:R:B:D:svwascmhludytzoriHIK", opts,
                           &idx);
 
       if (c == -1)
@@ -216,6 +243,42 @@ namespace storage {
         state.num_executors = 2;
         std::cout << "multiple executors " << std::endl;
         break;
+      case 'W':
+        state.nvm_emulate = true;
+        state.nvm_write_latency = strtoul(optarg, NULL, 10);
+        std::cout << "nvm_write_latency: " << state.nvm_write_latency << std::endl;
+        break;
+      case 'F':
+        state.nvm_emulate = true;
+        state.nvm_fence_latency = strtoul(optarg, NULL, 10);
+        std::cout << "nvm_fence_latency: " << state.nvm_fence_latency << std::endl;
+        break;
+      case 'R':
+        state.nvm_emulate = true;
+        state.nvm_read_latency = strtoul(optarg, NULL, 10);
+        std::cout << "nvm_read_latency: " << state.nvm_read_latency << std::endl;
+        break;
+      case 'B':
+        state.nvm_emulate = true;
+        state.nvm_bandwidth = strtoul(optarg, NULL, 10);
+        std::cout << "nvm_bandwidth: " << state.nvm_bandwidth << std::endl;
+        break;
+      case 'H':
+        state.huge_pages = true;
+        std::cout << "huge_pages " << std::endl;
+        break;
+      case 'D':
+        state.defrag_interval = atoi(optarg);
+        std::cout << "defrag_interval: " << state.defrag_interval << std::endl;
+        break;
+      case 'I':
+        state.hybrid_index = true;
+        std::cout << "hybrid_index " << std::endl;
+        break;
+      case 'K':
+        state.hash_index = true;
+        std::cout << "hash_index " << std::endl;
+        break;
       case 'h':
         usage_exit(stderr);
         break;
@@ -231,17 +294,32 @@ namespace storage {
 int main(int argc, char **argv) {
   const char* path = "/dev/shm/zfile";
 
+// Start
+  storage::config state;
+  parse_arguments(argc, argv, state);
+
+  // the pool is mapped and prefaulted before the first transaction
+  storage::timer startup;
+  storage::pmem_huge_pages = state.huge_pages;
+
   size_t pmp_size = PMSIZE;
+  startup.start();
   if ((storage::pmp = storage::pmemalloc_init(path, pmp_size)) == NULL)
     std::cout << "pmemalloc_init on :" << path << std::endl;
+  startup.end();
+  std::cout << "pool_startup(ms): " << startup.duration() << std::endl;
 
   storage::sp = (storage::static_info *) storage::pmemalloc_static_area();
-
-// Start
-  storage::config state;
-  parse_arguments(argc, argv, state);
   state.sp = storage::sp;
 
+  if (state.nvm_emulate) {
+    storage::nvm_config nvm = { state.nvm_write_latency,
+        state.nvm_fence_latency, state.nvm_read_latency, state.nvm_bandwidth };
+    storage::nvm_configure(nvm);
+    std::cout << "nvm_emulation: tsc " << storage::tsc_per_ns << " GHz"
+              << std::endl;
+  }
+
   storage::coordinator cc(state);
   cc.eval(state);
 
@@ -45,31 +45,77 @@ std::string opt_lsm_engine::select(const statement& st) {
   std::string val;
 
   record *rec_ptr = st.rec_ptr;
-  record *pm_rec = NULL, *fs_rec = NULL;
   table *tab = db->tables->at(st.table_id);
   table_index *table_index = tab->indices->at(st.table_index_id);
-  std::string key_str = sr.serialize(rec_ptr, table_index->sptr);
+  index_key key = ke.encode(rec_ptr, table_index->sptr);
+  index_val ival;
 
-  unsigned long key = hash_fn(key_str);
-  off_t storage_offset = -1;
+  if (table_index->map->at(key, &ival))
+    val = lookup(tab, ival, st.projection);
+  LOG_INFO("val : %s", val.c_str());
+
+  return val;
+}
+
+std::vector<std::string> opt_lsm_engine::scan(const statement& st) {
+  LOG_INFO("Scan");
+  table *tab = db->tables->at(st.table_id);
+  table_index *table_index = tab->indices->at(st.table_index_id);
+  std::vector<std::string> vals;
+  std::string val;
+
+  record* end_ptr = (st.end_ptr) ? st.end_ptr : st.rec_ptr;
+  index_key key = ke.encode_bound(st.rec_ptr, table_index->sptr,
+                                  table_index->match_len, false);
+  index_key end_key = ke.encode_bound(end_ptr, table_index->sptr,
+                                      table_index->match_len, true);
+
+  // Each entry holds the versions in mem and in fs
+  index_map<index_val>::iterator itr;
+  for (itr = table_index->map->lower_bound(key);
+      itr != table_index->map->end() && vals.size() < st.limit; ++itr) {
+    if (end_key < itr.key())
+      break;
+
+    val = lookup(tab, itr.data(), st.projection);
+    if (!val.empty())
+      vals.push_back(val);
+  }
+
+  return vals;
+}
 
-  // Check if key exists in mem
-  table_index->pm_map->at(key, &pm_rec);
+std::vector<std::string> opt_lsm_engine::multi_select(const statement& st) {
+  LOG_INFO("Multi Select");
+  std::vector<std::string> vals;
 
-  // Check if key exists in fs
-  table_index->off_map->at(key, &storage_offset);
+  for (record* rec_ptr : st.rec_ptrs)
+    vals.push_back(
+        select(
+            statement(st.transaction_id, operation_type::Select, st.table_id,
+                      rec_ptr, st.table_index_id, st.projection)));
+
+  return vals;
+}
 
-  if (storage_offset != -1) {
-    val = tab->fs_data.at(storage_offset);
+// Merge the versions of key in the memtable and the sstable
+std::string opt_lsm_engine::lookup(table* tab, const index_val& ival,
+                                  schema* projection) {
+  std::string val;
+  record *pm_rec = ival.rec, *fs_rec = NULL;
+
+  // Check if key exists in the sstable
+  if (ival.offset != INVALID_OFFSET) {
+    val = tab->fs_data.at(ival.offset);
     std::sscanf((char*) val.c_str(), "%p", &fs_rec);
   }
 
   if (pm_rec != NULL && fs_rec == NULL) {
     // From Memtable
-    val = sr.serialize(pm_rec, st.projection);
+    val = sr.serialize(pm_rec, projection);
   } else if (pm_rec == NULL && fs_rec != NULL) {
     // From SSTable
-    val = sr.serialize(fs_rec, st.projection);
+    val = sr.serialize(fs_rec, projection);
 
   } else if (pm_rec != NULL && fs_rec != NULL) {
     // Merge
@@ -79,11 +125,9 @@ std::string opt_lsm_engine::select(const statement& st) {
         fs_rec->set_data(field_itr, pm_rec);
     }
 
-    val = sr.serialize(fs_rec, st.projection);
+    val = sr.serialize(fs_rec, projection);
   }
 
-  LOG_INFO("val : %s", val.c_str());
-
   return val;
 }
 
@@ -91,18 +135,15 @@ int opt_lsm_engine::insert(const statement& st) {
   LOG_INFO("Insert");
   record* after_rec = st.rec_ptr;
   table* tab = db->tables->at(st.table_id);
-  plist<table_index*>* indices = tab->indices;
+  pvector<table_index*>* indices = tab->indices;
 
   unsigned int num_indices = tab->num_indices;
   unsigned int index_itr;
 
-  std::string key_str = sr.serialize(after_rec, indices->at(0)->sptr);
-  //LOG_INFO("Key_str :: --%s-- ", key_str.c_str());
-  unsigned long key = hash_fn(key_str);
+  index_key key = ke.encode(after_rec, indices->at(0)->sptr);
 
   // Check if key exists
-  if (indices->at(0)->pm_map->exists(key)
-      || indices->at(0)->off_map->exists(key)) {
+  if (indices->at(0)->map->exists(key)) {
     after_rec->clear_data();
     delete after_rec;
     return EXIT_SUCCESS;
@@ -115,23 +156,25 @@ int opt_lsm_engine::insert(const statement& st) {
 
   entry_str = entry_stream.str();
   size_t entry_str_sz = entry_str.size() + 1;
-  char* entry = new char[entry_str_sz];
+  char* entry = (char*) pmalloc(entry_str_sz*sizeof(char));//new char[entry_str_sz];
   memcpy(entry, entry_str.c_str(), entry_str_sz);
 
-  // Activate new record
-  pmemalloc_activate(after_rec);
-  after_rec->persist_data();
+  // Activate new record and log entry
+  activation act = activation();
+  pmemalloc_activate_add(&act, after_rec);
+  after_rec->persist_data(&act);
+  pmemalloc_activate_add(&act, entry);
+  pmemalloc_activate_batch(&act);
 
   // Add log entry
-  pmemalloc_activate(entry);
   pm_log->push_back(entry);
 
   // Add entry in indices
   for (index_itr = 0; index_itr < num_indices; index_itr++) {
-    key_str = sr.serialize(after_rec, indices->at(index_itr)->sptr);
-    key = hash_fn(key_str);
+    key = ke.encode(after_rec, indices->at(index_itr)->sptr);
 
-    indices->at(index_itr)->pm_map->insert(key, after_rec);
+    indices->at(index_itr)->insert(key,
+                                   index_val(after_rec, INVALID_OFFSET));
   }
 
   return EXIT_SUCCESS;
@@ -141,18 +184,18 @@ int opt_lsm_engine::remove(const statement& st) {
   LOG_INFO("Remove");
   record* rec_ptr = st.rec_ptr;
   table* tab = db->tables->at(st.table_id);
-  plist<table_index*>* indices = tab->indices;
+  pvector<table_index*>* indices = tab->indices;
 
   unsigned int num_indices = tab->num_indices;
   unsigned int index_itr;
   std::string val;
 
-  std::string key_str = sr.serialize(rec_ptr, indices->at(0)->sptr);
-  unsigned long key = hash_fn(key_str);
+  index_key key = ke.encode(rec_ptr, indices->at(0)->sptr);
+
+  index_val before_val;
 
   // Check if key does not exist
-  if (indices->at(0)->pm_map->exists(key) == 0
-      && indices->at(0)->off_map->exists(key) == 0) {
+  if (indices->at(0)->map->at(key, &before_val) == false) {
     delete rec_ptr;
     return EXIT_SUCCESS;
   }
@@ -164,25 +207,22 @@ int opt_lsm_engine::remove(const statement& st) {
 
   entry_str = entry_stream.str();
   size_t entry_str_sz = entry_str.size() + 1;
-  char* entry = new char[entry_str_sz];
+  char* entry = (char*) pmalloc(entry_str_sz*sizeof(char));//new char[entry_str_sz];
   memcpy(entry, entry_str.c_str(), entry_str_sz);
 
   // Add log entry
   pmemalloc_activate(entry);
   pm_log->push_back(entry);
 
-  record* before_rec = NULL;
-  if (indices->at(0)->pm_map->at(key, &before_rec)) {
-    delete before_rec;
+  if (before_val.rec != NULL) {
+    delete before_val.rec;
   }
 
   // Remove entry in indices
   for (index_itr = 0; index_itr < num_indices; index_itr++) {
-    key_str = sr.serialize(rec_ptr, indices->at(index_itr)->sptr);
-    key = hash_fn(key_str);
+    key = ke.encode(rec_ptr, indices->at(index_itr)->sptr);
 
-    indices->at(index_itr)->pm_map->erase(key);
-    indices->at(index_itr)->off_map->erase(key);
+    indices->at(index_itr)->erase(key);
   }
 
   return EXIT_SUCCESS;
@@ -192,20 +232,22 @@ int opt_lsm_engine::update(const statement& st) {
   LOG_INFO("Update");
   record* rec_ptr = st.rec_ptr;
   table* tab = db->tables->at(st.table_id);
-  plist<table_index*>* indices = db->tables->at(st.table_id)->indices;
+  pvector<table_index*>* indices = db->tables->at(st.table_id)->indices;
 
   unsigned int num_indices = tab->num_indices;
   unsigned int index_itr;
 
-  std::string key_str = sr.serialize(rec_ptr, indices->at(0)->sptr);
-  unsigned long key = hash_fn(key_str);
+  index_key key = ke.encode(rec_ptr, indices->at(0)->sptr);
   std::string val;
-  record* before_rec;
+  index_val before_val;
   void *before_field, *after_field;
   bool update_rec = false;
 
-  // Check if key does not exist
-  if (indices->at(0)->pm_map->at(key, &before_rec) == false) {
+  indices->at(0)->map->at(key, &before_val);
+  record* before_rec = before_val.rec;
+
+  // Check if key does not exist in the memtable
+  if (before_rec == NULL) {
     before_rec = rec_ptr;
 
     entry_stream.str("");
@@ -238,21 +280,29 @@ int opt_lsm_engine::update(const statement& st) {
 
   entry_str = entry_stream.str();
   size_t entry_str_sz = entry_str.size() + 1;
-  char* entry = new char[entry_str_sz];
+  char* entry = (char*) pmalloc(entry_str_sz*sizeof(char));//new char[entry_str_sz];
   memcpy(entry, entry_str.c_str(), entry_str_sz);
 
   // Add log entry
   pmemalloc_activate(entry);
   pm_log->push_back(entry);
 
+  activation act = activation();
+
   if (update_rec) {
+    // Activate new fields
     for (int field_itr : st.field_ids) {
-      // Activate new field and garbage collect previous field
       if (rec_ptr->sptr->columns[field_itr].inlined == 0) {
-        before_field = before_rec->get_pointer(field_itr);
         after_field = rec_ptr->get_pointer(field_itr);
+        pmemalloc_activate_add(&act, after_field);
+      }
+    }
+    pmemalloc_activate_batch(&act);
 
-        pmemalloc_activate(after_field);
+    for (int field_itr : st.field_ids) {
+      // Garbage collect previous field
+      if (rec_ptr->sptr->columns[field_itr].inlined == 0) {
+        before_field = before_rec->get_pointer(field_itr);
         commit_free_list.push_back(before_field);
       }
 
@@ -261,15 +311,15 @@ int opt_lsm_engine::update(const statement& st) {
     }
   } else {
     // Activate new record
-    pmemalloc_activate(before_rec);
-    before_rec->persist_data();
+    pmemalloc_activate_add(&act, before_rec);
+    before_rec->persist_data(&act);
+    pmemalloc_activate_batch(&act);
 
     // Add entry in indices
     for (index_itr = 0; index_itr < num_indices; index_itr++) {
-      key_str = sr.serialize(before_rec, indices->at(index_itr)->sptr);
-      key = hash_fn(key_str);
+      key = ke.encode(before_rec, indices->at(index_itr)->sptr);
 
-      indices->at(index_itr)->pm_map->insert(key, before_rec);
+      indices->at(index_itr)->set_rec(key, before_rec);
     }
   }
 
@@ -280,13 +330,12 @@ void opt_lsm_engine::load(const statement& st) {
   //LOG_INFO("Load");
   record* after_rec = st.rec_ptr;
   table* tab = db->tables->at(st.table_id);
-  plist<table_index*>* indices = tab->indices;
+  pvector<table_index*>* indices = tab->indices;
 
   unsigned int num_indices = tab->num_indices;
   unsigned int index_itr;
 
-  std::string key_str = sr.serialize(after_rec, indices->at(0)->sptr);
-  unsigned long key = hash_fn(key_str);
+  index_key key = ke.encode(after_rec, indices->at(0)->sptr);
 
   // Add log entry
   entry_stream.str("");
@@ -295,23 +344,25 @@ void opt_lsm_engine::load(const statement& st) {
 
   entry_str = entry_stream.str();
   size_t entry_str_sz = entry_str.size() + 1;
-  char* entry = new char[entry_str_sz];
+  char* entry = (char*) pmalloc(entry_str_sz*sizeof(char));//new char[entry_str_sz];
   memcpy(entry, entry_str.c_str(), entry_str_sz);
 
-  // Activate new record
-  pmemalloc_activate(after_rec);
-  after_rec->persist_data();
+  // Activate new record and log entry
+  activation act = activation();
+  pmemalloc_activate_add(&act, after_rec);
+  after_rec->persist_data(&act);
+  pmemalloc_activate_add(&act, entry);
+  pmemalloc_activate_batch(&act);
 
   // Add log entry
-  pmemalloc_activate(entry);
   pm_log->push_back(entry);
 
   // Add entry in indices
   for (index_itr = 0; index_itr < num_indices; index_itr++) {
-    key_str = sr.serialize(after_rec, indices->at(index_itr)->sptr);
-    key = hash_fn(key_str);
+    key = ke.encode(after_rec, indices->at(index_itr)->sptr);
 
-    indices->at(index_itr)->pm_map->insert(key, after_rec);
+    indices->at(index_itr)->insert(key,
+                                   index_val(after_rec, INVALID_OFFSET));
   }
 }
 
@@ -330,29 +381,35 @@ void opt_lsm_engine::merge(bool force) {
     table_index *p_index = tab->indices->at(0);
     std::vector<table_index*> indices = tab->indices->get_data();
 
-    pbtree<unsigned long, record*>* pm_map = p_index->pm_map;
+    index_map<index_val>* map = p_index->map;
+    index_map<index_val>::iterator itr;
+    size_t pm_size, fs_size;
 
-    size_t compact_threshold = conf.merge_ratio * p_index->off_map->size();
-    bool compact = (pm_map->size() > compact_threshold);
+    p_index->sizes(&pm_size, &fs_size);
+
+    size_t compact_threshold = conf.merge_ratio * fs_size;
+    bool compact = (pm_size > compact_threshold);
 
     // Check if need to merge
     if (force || compact) {
-      pbtree<unsigned long, record*>::const_iterator itr;
       record *pm_rec, *fs_rec;
-      unsigned long key;
+      index_key key;
       off_t storage_offset;
       std::string val;
       char ptr_buf[32];
 
       // All tuples in table
-      for (itr = pm_map->begin(); itr != pm_map->end(); itr++) {
-        key = (*itr).first;
-        pm_rec = (*itr).second;
+      for (itr = map->begin(); itr != map->end(); itr++) {
+        pm_rec = itr.data().rec;
+        storage_offset = itr.data().offset;
+
+        if (pm_rec == NULL)
+          continue;
 
         fs_rec = NULL;
 
         // Check if we need to merge
-        if (p_index->off_map->at(key, &storage_offset)) {
+        if (storage_offset != INVALID_OFFSET) {
           //LOG_INFO("Merge :: update :: val :: %s ", val.c_str());
 
           val = tab->fs_data.at(storage_offset);
@@ -372,18 +429,14 @@ void opt_lsm_engine::merge(bool force) {
           //LOG_INFO("Merge :: insert new :: val :: %s ", val.c_str());
 
           storage_offset = tab->fs_data.push_back(val);
+        }
 
-          for (table_index* index : indices) {
-            std::string key_str = sr.serialize(pm_rec, index->sptr);
-            key = hash_fn(key_str);
-            index->off_map->insert(key, storage_offset);
-          }
+        // Clear mem table entry
+        for (table_index* index : indices) {
+          key = ke.encode(pm_rec, index->sptr);
+          index->update(key, index_val(NULL, storage_offset));
         }
       }
-
-      // Clear mem table
-      for (table_index* index : indices)
-        index->pm_map->clear();
     }
   }
 
@@ -419,7 +472,7 @@ void opt_lsm_engine::recovery() {
   int op_type, txn_id, table_id;
   unsigned int num_indices, index_itr;
   table *tab;
-  plist<table_index*>* indices;
+  pvector<table_index*>* indices;
 
   std::string ptr_str;
 
@@ -429,6 +482,9 @@ void opt_lsm_engine::recovery() {
   timer rec_t;
   rec_t.start();
 
+  // the crash lost the inner nodes of hybrid indices
+  double rebuild_duration = db->rebuild_indices();
+
   int total_txns = undo_log.size();
   int txn_cnt = 0;
 
@@ -453,15 +509,14 @@ void opt_lsm_engine::recovery() {
         indices = tab->indices;
         num_indices = tab->num_indices;
 
+        // Not in the heap if the insert did not get that far
         tab->pm_data->erase(after_rec);
 
         // Remove entry in indices
         for (index_itr = 0; index_itr < num_indices; index_itr++) {
-          std::string key_str = sr.serialize(after_rec,
-                                             indices->at(index_itr)->sptr);
-          unsigned long key = hash_fn(key_str);
+          index_key key = ke.encode(after_rec, indices->at(index_itr)->sptr);
 
-          indices->at(index_itr)->pm_map->erase(key);
+          indices->at(index_itr)->set_rec(key, NULL);
         }
 
         // Free after_rec
@@ -484,15 +539,13 @@ void opt_lsm_engine::recovery() {
         indices = tab->indices;
         num_indices = tab->num_indices;
 
-        tab->pm_data->push_back(after_rec);
+        tab->pm_data->push_back(before_rec);
 
         // Fix entry in indices to point to before_rec
         for (index_itr = 0; index_itr < num_indices; index_itr++) {
-          std::string key_str = sr.serialize(before_rec,
-                                             indices->at(index_itr)->sptr);
-          unsigned long key = hash_fn(key_str);
+          index_key key = ke.encode(before_rec, indices->at(index_itr)->sptr);
 
-          indices->at(index_itr)->pm_map->insert(key, before_rec);
+          indices->at(index_itr)->set_rec(key, before_rec);
         }
         break;
 
@@ -566,6 +619,9 @@ void opt_lsm_engine::recovery() {
   rec_t.end();
   std::cout << "OPT_LSM :: Recovery duration (ms) : " << rec_t.duration()
             << std::endl;
+  if (conf.hybrid_index)
+    std::cout << "OPT_LSM :: Index rebuild (ms) : " << rebuild_duration
+              << std::endl;
 
 }
 
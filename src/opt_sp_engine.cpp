@@ -8,12 +8,11 @@ void opt_sp_engine::group_commit() {
 
   while (ready) {
 
-    if (!read_only && txn_ptr != NULL) {
+    // Write the transactions committed since the last flush
+    if (!read_only) {
       wrlock(&gc_rwlock);
 
-      assert(bt->txn_commit(txn_ptr) == BT_SUCCESS);
-      txn_ptr = bt->txn_begin(0);
-      assert(txn_ptr);
+      assert(bt->cow_btree_group_flush() == BT_SUCCESS);
 
       unlock(&gc_rwlock);
     }
@@ -34,8 +33,12 @@ opt_sp_engine::opt_sp_engine(const config& _conf, database* _db, bool _read_only
   read_only = _read_only;
 
   bt = db->dirs->t_ptr;
-  txn_ptr = bt->txn_begin(read_only);
-  assert(txn_ptr);
+
+  // Writers begin a transaction per txn_begin
+  if (read_only) {
+    txn_ptr = bt->txn_begin(read_only);
+    assert(txn_ptr);
+  }
 
   // Commit only if needed
   if (!read_only) {
@@ -51,8 +54,8 @@ opt_sp_engine::~opt_sp_engine() {
     gc.join();
   }
 
-  if (!read_only && txn_ptr != NULL) {
-    assert(bt->txn_commit(txn_ptr) == BT_SUCCESS);
+  if (!read_only) {
+    assert(bt->cow_btree_group_flush() == BT_SUCCESS);
   }
   txn_ptr = NULL;
 
@@ -66,11 +69,8 @@ std::string opt_sp_engine::select(const statement& st) {
 
   table* tab = db->tables->at(st.table_id);
   table_index* table_index = tab->indices->at(st.table_index_id);
-  std::string key_str = sr.serialize(rec_ptr, table_index->sptr);
-
-  unsigned long key_id = hasher(hash_fn(key_str), st.table_id,
-                                st.table_index_id);
-  std::string comp_key_str = std::to_string(key_id);
+  std::string comp_key_str = ke.encode_str(rec_ptr, table_index->sptr,
+                                           st.table_id, st.table_index_id);
   key.data = (void*) comp_key_str.c_str();
   key.size = comp_key_str.size();
   std::string value;
@@ -87,19 +87,88 @@ std::string opt_sp_engine::select(const statement& st) {
   return value;
 }
 
+std::vector<std::string> opt_sp_engine::scan(const statement& st) {
+  LOG_INFO("Scan");
+  struct cow_btval key, end_key, val;
+  table* tab = db->tables->at(st.table_id);
+  table_index* table_index = tab->indices->at(st.table_index_id);
+  std::vector<std::string> vals;
+  record* select_ptr;
+
+  record* end_ptr = (st.end_ptr) ? st.end_ptr : st.rec_ptr;
+  std::string comp_key_str = ke.encode_str_bound(st.rec_ptr,
+                                                 table_index->sptr,
+                                                 st.table_id,
+                                                 st.table_index_id,
+                                                 table_index->match_len,
+                                                 false);
+  std::string comp_end_key_str = ke.encode_str_bound(end_ptr,
+                                                     table_index->sptr,
+                                                     st.table_id,
+                                                     st.table_index_id,
+                                                     table_index->match_len,
+                                                     true);
+  key.data = (void*) comp_key_str.c_str();
+  key.size = comp_key_str.size();
+  key.mp = NULL;
+  end_key.data = (void*) comp_end_key_str.c_str();
+  end_key.size = comp_end_key_str.size();
+  end_key.mp = NULL;
+
+  // Walk the latest clean version with a cursor
+  struct cursor* cursor = bt->cow_btree_txn_cursor_open(txn_ptr);
+  int rc = bt->cow_btree_cursor_get(cursor, &key, &val, BT_CURSOR);
+
+  while (rc == BT_SUCCESS && vals.size() < st.limit
+      && bt->cow_btree_cmp(&key, &end_key) <= 0) {
+    memcpy(&select_ptr, val.data, sizeof(record*));
+    vals.push_back(sr.serialize(select_ptr, st.projection));
+    bt->btval_reset(&val);
+    if (key.mp == NULL)
+      delete[] (char*) key.data;
+    bt->btval_reset(&key);
+
+    rc = bt->cow_btree_cursor_get(cursor, &key, &val, BT_NEXT);
+  }
+
+  if (rc == BT_SUCCESS) {
+    bt->btval_reset(&val);
+    if (key.mp == NULL)
+      delete[] (char*) key.data;
+    bt->btval_reset(&key);
+  }
+  bt->cow_btree_cursor_close(cursor);
+
+  delete st.rec_ptr;
+  delete st.end_ptr;
+  return vals;
+}
+
+std::vector<std::string> opt_sp_engine::multi_select(const statement& st) {
+  LOG_INFO("Multi Select");
+  std::vector<std::string> vals;
+
+  for (record* rec_ptr : st.rec_ptrs)
+    vals.push_back(
+        select(
+            statement(st.transaction_id, operation_type::Select, st.table_id,
+                      rec_ptr, st.table_index_id, st.projection)));
+
+  return vals;
+}
+
 int opt_sp_engine::insert(const statement& st) {
   LOG_INFO("Insert");
   record* after_rec = st.rec_ptr;
   table* tab = db->tables->at(st.table_id);
-  plist<table_index*>* indices = tab->indices;
+  pvector<table_index*>* indices = tab->indices;
 
   unsigned int num_indices = tab->num_indices;
   unsigned int index_itr;
   struct cow_btval key, val;
 
-  std::string key_str = sr.serialize(after_rec, indices->at(0)->sptr);
-  unsigned long key_id = hasher(hash_fn(key_str), st.table_id, 0);
-  key_str = std::to_string(key_id);
+  std::string key_str = ke.encode_str(after_rec, indices->at(0)->sptr,
+                                      st.table_id, 0);
   key.data = (void*) key_str.c_str();
   key.size = key_str.size();
 
@@ -120,9 +189,8 @@ int opt_sp_engine::insert(const statement& st) {
 
   // Add entry in indices
   for (index_itr = 0; index_itr < num_indices; index_itr++) {
-    key_str = sr.serialize(after_rec, indices->at(index_itr)->sptr);
-    key_id = hasher(hash_fn(key_str), st.table_id, index_itr);
-    key_str = std::to_string(key_id);
+    key_str = ke.encode_str(after_rec, indices->at(index_itr)->sptr,
+                            st.table_id, index_itr);
 
     key.data = (void*) key_str.c_str();
     key.size = key_str.size();
@@ -138,15 +206,14 @@ int opt_sp_engine::remove(const statement& st) {
   LOG_INFO("Remove");
   record* rec_ptr = st.rec_ptr;
   table* tab = db->tables->at(st.table_id);
-  plist<table_index*>* indices = tab->indices;
+  pvector<table_index*>* indices = tab->indices;
 
   unsigned int num_indices = tab->num_indices;
   unsigned int index_itr;
   struct cow_btval key, val;
 
-  std::string key_str = sr.serialize(rec_ptr, indices->at(0)->sptr);
-  unsigned long key_id = hasher(hash_fn(key_str), st.table_id, 0);
-  key_str = std::to_string(key_id);
+  std::string key_str = ke.encode_str(rec_ptr, indices->at(0)->sptr,
+                                      st.table_id, 0);
 
   key.data = (void*) key_str.c_str();
   key.size = key_str.size();
@@ -163,9 +230,8 @@ int opt_sp_engine::remove(const statement& st) {
 
   // Remove entry in indices
   for (index_itr = 0; index_itr < num_indices; index_itr++) {
-    key_str = sr.serialize(rec_ptr, indices->at(index_itr)->sptr);
-    key_id = hasher(hash_fn(key_str), st.table_id, index_itr);
-    key_str = std::to_string(key_id);
+    key_str = ke.encode_str(rec_ptr, indices->at(index_itr)->sptr,
+                            st.table_id, index_itr);
 
     key.data = (void*) key_str.c_str();
     key.size = key_str.size();
@@ -183,15 +249,14 @@ int opt_sp_engine::update(const statement& st) {
   LOG_INFO("Update");
   record* rec_ptr = st.rec_ptr;
   table* tab = db->tables->at(st.table_id);
-  plist<table_index*>* indices = tab->indices;
+  pvector<table_index*>* indices = tab->indices;
 
   unsigned int num_indices = tab->num_indices;
   unsigned int index_itr;
   struct cow_btval key, val, update_val;
 
-  std::string key_str = sr.serialize(rec_ptr, indices->at(0)->sptr);
-  unsigned long key_id = hasher(hash_fn(key_str), st.table_id, 0);
-  key_str = std::to_string(key_id);
+  std::string key_str = ke.encode_str(rec_ptr, indices->at(0)->sptr,
+                                      st.table_id, 0);
   key.data = (void*) key_str.c_str();
   key.size = key_str.size();
 
@@ -233,9 +298,8 @@ int opt_sp_engine::update(const statement& st) {
 
   // Update entry in indices
   for (index_itr = 0; index_itr < num_indices; index_itr++) {
-    key_str = sr.serialize(after_rec, indices->at(index_itr)->sptr);
-    key_id = hasher(hash_fn(key_str), st.table_id, index_itr);
-    key_str = std::to_string(key_id);
+    key_str = ke.encode_str(after_rec, indices->at(index_itr)->sptr,
+                            st.table_id, index_itr);
 
     key.data = (void*) key_str.c_str();
     key.size = key_str.size();
@@ -255,15 +319,14 @@ void opt_sp_engine::load(const statement& st) {
   //LOG_INFO("Load");
   record* after_rec = st.rec_ptr;
   table* tab = db->tables->at(st.table_id);
-  plist<table_index*>* indices = tab->indices;
+  pvector<table_index*>* indices = tab->indices;
 
   unsigned int num_indices = tab->num_indices;
   unsigned int index_itr;
   struct cow_btval key, val;
 
-  std::string key_str = sr.serialize(after_rec, indices->at(0)->sptr);
-  unsigned long key_id = hasher(hash_fn(key_str), st.table_id, 0);
-  key_str = std::to_string(key_id);
+  std::string key_str = ke.encode_str(after_rec, indices->at(0)->sptr,
+                                      st.table_id, 0);
 
   // Activate new record
   pmemalloc_activate(after_rec);
@@ -275,9 +338,8 @@ void opt_sp_engine::load(const statement& st) {
 
   // Add entry in indices
   for (index_itr = 0; index_itr < num_indices; index_itr++) {
-    key_str = sr.serialize(after_rec, indices->at(index_itr)->sptr);
-    key_id = hasher(hash_fn(key_str), st.table_id, index_itr);
-    key_str = std::to_string(key_id);
+    key_str = ke.encode_str(after_rec, indices->at(index_itr)->sptr,
+                            st.table_id, index_itr);
 
     key.data = (void*) key_str.c_str();
     key.size = key_str.size();
@@ -291,11 +353,20 @@ void opt_sp_engine::load(const statement& st) {
 void opt_sp_engine::txn_begin() {
   if (!read_only) {
     wrlock(&gc_rwlock);
+    txn_ptr = bt->txn_begin(0);
+    assert(txn_ptr);
   }
 }
 
-void opt_sp_engine::txn_end(__attribute__((unused)) bool commit) {
+// Commits join the current group, the group commit thread makes them
+// durable together
+void opt_sp_engine::txn_end(bool commit) {
   if (!read_only) {
+    if (commit)
+      assert(bt->txn_commit_group(txn_ptr, NULL) == BT_SUCCESS);
+    else
+      bt->cow_btree_txn_abort(txn_ptr);
+    txn_ptr = NULL;
     unlock(&gc_rwlock);
   }
 }
@@ -24,37 +24,87 @@ opt_wal_engine::~opt_wal_engine() {
 std::string opt_wal_engine::select(const statement& st) {
   LOG_INFO("Select");
   record* rec_ptr = st.rec_ptr;
-  record* select_ptr = NULL;
+  index_val select_val;
   table* tab = db->tables->at(st.table_id);
   table_index* table_index = tab->indices->at(st.table_index_id);
-  std::string key_str = sr.serialize(rec_ptr, table_index->sptr);
+  index_key key = ke.encode(rec_ptr, table_index->sptr);
 
-  unsigned long key = hash_fn(key_str);
   std::string val;
 
-  table_index->pm_map->at(key, &select_ptr);
-  if (select_ptr)
-    val = sr.serialize(select_ptr, st.projection);
+  table_index->map->at(key, &select_val);
+  if (select_val.rec)
+    val = sr.serialize(select_val.rec, st.projection);
   LOG_INFO("val : %s", val.c_str());
 
   delete rec_ptr;
   return val;
 }
 
+std::vector<std::string> opt_wal_engine::scan(const statement& st) {
+  LOG_INFO("Scan");
+  table* tab = db->tables->at(st.table_id);
+  table_index* table_index = tab->indices->at(st.table_index_id);
+  std::vector<std::string> vals;
+
+  record* end_ptr = (st.end_ptr) ? st.end_ptr : st.rec_ptr;
+  index_key key = ke.encode_bound(st.rec_ptr, table_index->sptr,
+                                  table_index->match_len, false);
+  index_key end_key = ke.encode_bound(end_ptr, table_index->sptr,
+                                      table_index->match_len, true);
+
+  index_map<index_val>::iterator itr;
+  for (itr = table_index->map->lower_bound(key);
+      itr != table_index->map->end() && vals.size() < st.limit; ++itr) {
+    if (end_key < itr.key())
+      break;
+    vals.push_back(sr.serialize(itr.data().rec, st.projection));
+  }
+
+  delete st.rec_ptr;
+  delete st.end_ptr;
+  return vals;
+}
+
+std::vector<std::string> opt_wal_engine::multi_select(const statement& st) {
+  LOG_INFO("Multi Select");
+  table* tab = db->tables->at(st.table_id);
+  table_index* table_index = tab->indices->at(st.table_index_id);
+  size_t num_keys = st.rec_ptrs.size();
+
+  std::vector<index_key> keys(num_keys);
+  std::vector<index_val> select_vals(num_keys);
+  std::unique_ptr<bool[]> found(new bool[num_keys]);
+  std::vector<std::string> vals(num_keys);
+
+  for (size_t itr = 0; itr < num_keys; itr++)
+    keys[itr] = ke.encode(st.rec_ptrs[itr], table_index->sptr);
+
+  // the index walks all the lookups together
+  table_index->map->multi_at(keys.data(), num_keys, select_vals.data(),
+                             found.get());
+
+  for (size_t itr = 0; itr < num_keys; itr++) {
+    if (found[itr])
+      vals[itr] = sr.serialize(select_vals[itr].rec, st.projection);
+    delete st.rec_ptrs[itr];
+  }
+
+  return vals;
+}
+
 int opt_wal_engine::insert(const statement& st) {
   //LOG_INFO("Insert");
   record* after_rec = st.rec_ptr;
   table* tab = db->tables->at(st.table_id);
-  plist<table_index*>* indices = tab->indices;
+  pvector<table_index*>* indices = tab->indices;
 
   unsigned int num_indices = tab->num_indices;
   unsigned int index_itr;
 
-  std::string key_str = sr.serialize(after_rec, indices->at(0)->sptr);
-  unsigned long key = hash_fn(key_str);
+  index_key key = ke.encode(after_rec, indices->at(0)->sptr);
 
   // Check if key exists
-  if (indices->at(0)->pm_map->exists(key) != 0) {
+  if (indices->at(0)->map->exists(key) != 0) {
     after_rec->clear_data();
     delete after_rec;
     return EXIT_SUCCESS;
@@ -74,17 +124,19 @@ int opt_wal_engine::insert(const statement& st) {
   pm_log->push_back(entry);
 
   // Activate new record
-  pmemalloc_activate(after_rec);
-  after_rec->persist_data();
+  activation act = activation();
+  pmemalloc_activate_add(&act, after_rec);
+  after_rec->persist_data(&act);
+  pmemalloc_activate_batch(&act);
 
   tab->pm_data->push_back(after_rec);
 
   // Add entry in indices
   for (index_itr = 0; index_itr < num_indices; index_itr++) {
-    key_str = sr.serialize(after_rec, indices->at(index_itr)->sptr);
-    key = hash_fn(key_str);
+    key = ke.encode(after_rec, indices->at(index_itr)->sptr);
 
-    indices->at(index_itr)->pm_map->insert(key, after_rec);
+    indices->at(index_itr)->insert(key,
+                                   index_val(after_rec, INVALID_OFFSET));
   }
 
   return EXIT_SUCCESS;
@@ -94,21 +146,22 @@ int opt_wal_engine::remove(const statement& st) {
   LOG_INFO("Remove");
   record* rec_ptr = st.rec_ptr;
   table* tab = db->tables->at(st.table_id);
-  plist<table_index*>* indices = tab->indices;
+  pvector<table_index*>* indices = tab->indices;
 
   unsigned int num_indices = tab->num_indices;
   unsigned int index_itr;
 
-  std::string key_str = sr.serialize(rec_ptr, indices->at(0)->sptr);
-  unsigned long key = hash_fn(key_str);
-  record* before_rec = NULL;
+  index_key key = ke.encode(rec_ptr, indices->at(0)->sptr);
+  index_val before_val;
 
   // Check if key does not exist
-  if (indices->at(0)->pm_map->at(key, &before_rec) == false) {
+  if (indices->at(0)->map->at(key, &before_val) == false) {
     delete rec_ptr;
     return EXIT_SUCCESS;
   }
 
+  record* before_rec = before_val.rec;
+
   int num_cols = before_rec->sptr->num_columns;
 
   for (int field_itr = 0; field_itr < num_cols; field_itr++) {
@@ -132,14 +185,14 @@ int opt_wal_engine::remove(const statement& st) {
   pmemalloc_activate(entry);
   pm_log->push_back(entry);
 
-  tab->pm_data->erase(before_rec);
+  if (!tab->pm_data->erase(before_rec))
+    die();
 
   // Remove entry in indices
   for (index_itr = 0; index_itr < num_indices; index_itr++) {
-    key_str = sr.serialize(rec_ptr, indices->at(index_itr)->sptr);
-    key = hash_fn(key_str);
+    key = ke.encode(rec_ptr, indices->at(index_itr)->sptr);
 
-    indices->at(index_itr)->pm_map->erase(key);
+    indices->at(index_itr)->erase(key);
   }
 
   delete rec_ptr;
@@ -149,19 +202,20 @@ int opt_wal_engine::remove(const statement& st) {
 int opt_wal_engine::update(const statement& st) {
   LOG_INFO("Update");
   record* rec_ptr = st.rec_ptr;
-  plist<table_index*>* indices = db->tables->at(st.table_id)->indices;
+  pvector<table_index*>* indices = db->tables->at(st.table_id)->indices;
 
-  std::string key_str = sr.serialize(rec_ptr, indices->at(0)->sptr);
-  unsigned long key = hash_fn(key_str);
-  record* before_rec;
+  index_key key = ke.encode(rec_ptr, indices->at(0)->sptr);
+  index_val before_val;
 
   // Check if key exists. If not, return. There is nothing to update.
-  if (indices->at(0)->pm_map->at(key, &before_rec) == false) {
+  if (indices->at(0)->map->at(key, &before_val) == false) {
     rec_ptr->clear_data();
     delete rec_ptr;
     return EXIT_SUCCESS;
   }
 
+  record* before_rec = before_val.rec;
+
   void *before_field;
   int num_fields = st.field_ids.size();
 
@@ -194,6 +248,14 @@ int opt_wal_engine::update(const statement& st) {
   pmemalloc_activate(entry);
   pm_log->push_back(entry);
 
+  // Activate new fields
+  activation act = activation();
+  for (int field_itr : st.field_ids) {
+    if (rec_ptr->sptr->columns[field_itr].inlined == 0)
+      pmemalloc_activate_add(&act, rec_ptr->get_pointer(field_itr));
+  }
+  pmemalloc_activate_batch(&act);
+
   for (int field_itr : st.field_ids) {
     // Garbage collect previous field
     if (rec_ptr->sptr->columns[field_itr].inlined == 0) {
@@ -213,12 +275,11 @@ void opt_wal_engine::load(const statement& st) {
   //LOG_INFO("Load");
   record* after_rec = st.rec_ptr;
   table* tab = db->tables->at(st.table_id);
-  plist<table_index*>* indices = tab->indices;
+  pvector<table_index*>* indices = tab->indices;
 
   unsigned int num_indices = tab->num_indices;
   unsigned int index_itr;
-  std::string key_str = sr.serialize(after_rec, indices->at(0)->sptr);
-  unsigned long key = hash_fn(key_str);
+  index_key key = ke.encode(after_rec, indices->at(0)->sptr);
 
   // Add log entry
   entry_stream.str("");
@@ -233,15 +294,17 @@ void opt_wal_engine::load(const statement& st) {
   pm_log->push_back(entry);
 
   // Activate new record
-  pmemalloc_activate(after_rec);
-  after_rec->persist_data();
+  activation act = activation();
+  pmemalloc_activate_add(&act, after_rec);
+  after_rec->persist_data(&act);
+  pmemalloc_activate_batch(&act);
 
   // Add entry in indices
   for (index_itr = 0; index_itr < num_indices; index_itr++) {
-    key_str = sr.serialize(after_rec, indices->at(index_itr)->sptr);
-    key = hash_fn(key_str);
+    key = ke.encode(after_rec, indices->at(index_itr)->sptr);
 
-    indices->at(index_itr)->pm_map->insert(key, after_rec);
+    indices->at(index_itr)->insert(key,
+                                   index_val(after_rec, INVALID_OFFSET));
   }
 
 }
@@ -277,7 +340,7 @@ void opt_wal_engine::recovery() {
   int op_type, txn_id, table_id;
   unsigned int num_indices, index_itr;
   table *tab;
-  plist<table_index*>* indices;
+  pvector<table_index*>* indices;
 
   std::string ptr_str;
   record *before_rec, *after_rec;
@@ -286,6 +349,9 @@ void opt_wal_engine::recovery() {
   timer rec_t;
   rec_t.start();
 
+  // the crash lost the inner nodes of hybrid indices
+  double rebuild_duration = db->rebuild_indices();
+
   for (char* ptr : undo_log) {
     //std::cout << "entry : --" << ptr << "-- " << std::endl;
     std::stringstream entry(ptr);
@@ -302,15 +368,14 @@ void opt_wal_engine::recovery() {
         indices = tab->indices;
         num_indices = tab->num_indices;
 
+        // Not in the heap if the insert did not get that far
         tab->pm_data->erase(after_rec);
 
         // Remove entry in indices
         for (index_itr = 0; index_itr < num_indices; index_itr++) {
-          std::string key_str = sr.serialize(after_rec,
-                                             indices->at(index_itr)->sptr);
-          unsigned long key = hash_fn(key_str);
+          index_key key = ke.encode(after_rec, indices->at(index_itr)->sptr);
 
-          indices->at(index_itr)->pm_map->erase(key);
+          indices->at(index_itr)->erase(key);
         }
 
         // Free after_rec
@@ -327,15 +392,14 @@ void opt_wal_engine::recovery() {
         indices = tab->indices;
         num_indices = tab->num_indices;
 
-        tab->pm_data->push_back(after_rec);
+        tab->pm_data->push_back(before_rec);
 
         // Fix entry in indices to point to before_rec
         for (index_itr = 0; index_itr < num_indices; index_itr++) {
-          std::string key_str = sr.serialize(before_rec,
-                                             indices->at(index_itr)->sptr);
-          unsigned long key = hash_fn(key_str);
+          index_key key = ke.encode(before_rec, indices->at(index_itr)->sptr);
 
-          indices->at(index_itr)->pm_map->insert(key, before_rec);
+          indices->at(index_itr)->insert(
+              key, index_val(before_rec, INVALID_OFFSET));
         }
         break;
 
@@ -408,6 +472,9 @@ void opt_wal_engine::recovery() {
 
   rec_t.end();
   std::cout << "OPT_WAL :: Recovery duration (ms) : " << rec_t.duration() << std::endl;
+  if (conf.hybrid_index)
+    std::cout << "OPT_WAL :: Index rebuild (ms) : " << rebuild_duration
+              << std::endl;
 
 }
 
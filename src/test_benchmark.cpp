@@ -397,7 +397,7 @@ void test_benchmark::execute() {
 		}
 
 		std::cout <<"TEST TABLE STATS ::" <<std::endl;
-		std::cout<<"Index Size : "<<db->tables->at(TEST_TABLE_ID)->indices->at(0)->pm_map->size()<<std::endl;
+		std::cout<<"Index Size : "<<db->tables->at(TEST_TABLE_ID)->indices->at(0)->map->size()<<std::endl;
 
 		//std::cout << "duration :: " << tm->duration() << std::endl;
 	}
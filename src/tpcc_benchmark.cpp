@@ -3,6 +3,7 @@
 #include "tpcc_benchmark.h"
 
 #include <sys/types.h>
+#include <climits>
 #include <ctime>
 #include <iostream>
 #include <string>
@@ -16,6 +17,23 @@
 
 namespace storage {
 
+// key_order -- the key columns in SQL key order. Index keys are encoded in
+// schema column order, so range scans then follow the primary key.
+static std::vector<field_info> key_order(const std::vector<field_info>& cols,
+                                         std::vector<unsigned int> order) {
+  std::vector<field_info> key_cols;
+
+  for (unsigned int itr : order)
+    key_cols.push_back(cols[itr]);
+
+  return key_cols;
+}
+
+// point_index -- indexes that are never scanned may be hash tables
+static index_type point_index(const config& conf) {
+  return (conf.hash_index) ? HASH_INDEX : BTREE_INDEX;
+}
+
 tpcc_benchmark::tpcc_benchmark(config _conf, unsigned int tid, database* _db,
                                timer* _tm, struct static_info* _sp)
     : benchmark(tid, _db, _tm, _sp),
@@ -167,7 +185,7 @@ table* tpcc_benchmark::create_warehouse() {
   pmemalloc_activate(warehouse_index_schema);
 
   table_index* key_index = new table_index(warehouse_index_schema, cols.size(),
-                                           conf, sp);
+                                           conf, sp, point_index(conf));
   pmemalloc_activate(key_index);
   warehouse->indices->push_back(key_index);
 
@@ -263,11 +281,11 @@ table* tpcc_benchmark::create_district() {
     cols[itr].enabled = 0;
   }
 
-  schema* district_index_schema = new schema(cols);
+  schema* district_index_schema = new schema(key_order(cols, {1, 0}));
   pmemalloc_activate(district_index_schema);
 
   table_index* key_index = new table_index(district_index_schema, cols.size(),
-                                           conf, sp);
+                                           conf, sp, point_index(conf));
   pmemalloc_activate(key_index);
   district->indices->push_back(key_index);
 
@@ -342,7 +360,7 @@ table* tpcc_benchmark::create_item() {
   pmemalloc_activate(item_index_schema);
 
   table_index* key_index = new table_index(item_index_schema, cols.size(), conf,
-                                           sp);
+                                           sp, point_index(conf));
   pmemalloc_activate(key_index);
   item->indices->push_back(key_index);
 
@@ -481,23 +499,24 @@ table* tpcc_benchmark::create_customer() {
     cols[itr].enabled = 0;
   }
 
-  schema* customer_index_schema = new schema(cols);
+  schema* customer_index_schema = new schema(key_order(cols, {2, 1, 0}));
   pmemalloc_activate(customer_index_schema);
 
   table_index* p_index = new table_index(customer_index_schema, cols.size(),
-                                         conf, sp);
+                                         conf, sp, point_index(conf));
   pmemalloc_activate(p_index);
   customer->indices->push_back(p_index);
 
-  // SECONDARY INDEX
-  cols[0].enabled = 0;
+  // SECONDARY INDEX, non-unique on name, c_id tells the entries apart
   cols[3].enabled = 1;
 
-  schema* customer_name_index_schema = new schema(cols);
+  schema* customer_name_index_schema = new schema(
+      key_order(cols, {2, 1, 3, 0}));
   pmemalloc_activate(customer_name_index_schema);
 
   table_index* s_index = new table_index(customer_name_index_schema,
-                                         cols.size(), conf, sp);
+                                         cols.size(), conf, sp, BTREE_INDEX,
+                                         3);
   pmemalloc_activate(s_index);
   customer->indices->push_back(s_index);
 
@@ -588,7 +607,7 @@ table* tpcc_benchmark::create_history() {
   pmemalloc_activate(history_index_schema);
 
   table_index* p_index = new table_index(history_index_schema, cols.size(),
-                                         conf, sp);
+                                         conf, sp, point_index(conf));
   pmemalloc_activate(p_index);
   history->indices->push_back(p_index);
 
@@ -683,11 +702,11 @@ table* tpcc_benchmark::create_stock() {
     cols[itr].enabled = 0;
   }
 
-  schema* stock_index_schema = new schema(cols);
+  schema* stock_index_schema = new schema(key_order(cols, {1, 0}));
   pmemalloc_activate(stock_index_schema);
 
   table_index* p_index = new table_index(stock_index_schema, cols.size(), conf,
-                                         sp);
+                                         sp, point_index(conf));
   pmemalloc_activate(p_index);
   stock->indices->push_back(p_index);
 
@@ -778,21 +797,22 @@ table* tpcc_benchmark::create_orders() {
   }
   cols[1].enabled = 0;
 
-  schema* p_index_schema = new schema(cols);
+  schema* p_index_schema = new schema(key_order(cols, {3, 2, 0}));
   pmemalloc_activate(p_index_schema);
 
-  table_index* p_index = new table_index(p_index_schema, cols.size(), conf, sp);
+  table_index* p_index = new table_index(p_index_schema, cols.size(), conf,
+                                         sp, point_index(conf));
   pmemalloc_activate(p_index);
   orders->indices->push_back(p_index);
 
-  // SECONDARY INDEX
-  cols[0].enabled = 0;
+  // SECONDARY INDEX, non-unique on customer, o_id tells the entries apart
   cols[1].enabled = 1;
 
-  schema* s_index_schema = new schema(cols);
+  schema* s_index_schema = new schema(key_order(cols, {3, 2, 1, 0}));
   pmemalloc_activate(s_index_schema);
 
-  table_index* s_index = new table_index(s_index_schema, cols.size(), conf, sp);
+  table_index* s_index = new table_index(s_index_schema, cols.size(), conf,
+                                         sp, BTREE_INDEX, 3);
   pmemalloc_activate(s_index);
   orders->indices->push_back(s_index);
 
@@ -846,10 +866,7 @@ table* tpcc_benchmark::create_new_order() {
   pmemalloc_activate(new_order);
 
   // PRIMARY INDEX
-  // XXX alter pkey
-  cols[0].enabled = 0;
-
-  schema* new_order_index_schema = new schema(cols);
+  schema* new_order_index_schema = new schema(key_order(cols, {1, 2, 0}));
   pmemalloc_activate(new_order_index_schema);
 
   table_index* new_order_index = new table_index(new_order_index_schema,
@@ -945,20 +962,19 @@ table* tpcc_benchmark::create_order_line() {
     cols[itr].enabled = 0;
   }
 
-  schema* p_index_schema = new schema(cols);
+  schema* p_index_schema = new schema(key_order(cols, {2, 1, 0, 3}));
   pmemalloc_activate(p_index_schema);
 
   table_index* p_index = new table_index(p_index_schema, cols.size(), conf, sp);
   pmemalloc_activate(p_index);
   order_line->indices->push_back(p_index);
 
-  // SECONDARY INDEX
-  cols[3].enabled = 0;
-
-  schema* s_index_schema = new schema(cols);
+  // SECONDARY INDEX, non-unique on order, ol_number tells the entries apart
+  schema* s_index_schema = new schema(key_order(cols, {2, 1, 0, 3}));
   pmemalloc_activate(s_index_schema);
 
-  table_index* s_index = new table_index(s_index_schema, cols.size(), conf, sp);
+  table_index* s_index = new table_index(s_index_schema, cols.size(), conf, sp,
+                                         BTREE_INDEX, 3);
   pmemalloc_activate(s_index);
   order_line->indices->push_back(s_index);
 
@@ -1281,10 +1297,11 @@ void tpcc_benchmark::do_delivery(engine* ee) {
    "updateCustomer": "UPDATE CUSTOMER SET C_BALANCE = C_BALANCE + ? WHERE C_ID = ? AND C_D_ID = ? AND C_W_ID = ?", # ol_total, c_id, d_id, w_id
    */
 
-  record* rec_ptr;
+  record* rec_ptr, *end_ptr;
   statement st;
   std::vector<int> field_ids;
   std::string empty;
+  std::vector<std::string> new_order_strs, order_line_strs;
 
   txn_id++;
   TIMER(ee->txn_begin());
@@ -1294,23 +1311,26 @@ void tpcc_benchmark::do_delivery(engine* ee) {
   int w_id = get_rand_int(0, warehouse_count);
   int o_carrier_id = get_rand_int(orders_min_carrier_id, orders_max_carrier_id);
   double ol_delivery_ts = static_cast<double>(time(NULL));
-  std::string new_order_str, orders_str, order_line_str, customer_str;
+  std::string new_order_str, orders_str, customer_str;
 
   for (d_itr = 0; d_itr < districts_per_warehouse; d_itr++) {
     LOG_INFO("d_itr :: %d  w_id :: %d ", d_itr, w_id);
 
     // getNewOrder
     rec_ptr = new new_order_record(new_order_table_schema, 0, d_itr, w_id);
+    end_ptr = new new_order_record(new_order_table_schema, INT_MAX, d_itr,
+                                   w_id);
 
-    st = statement(txn_id, operation_type::Select, NEW_ORDER_TABLE_ID, rec_ptr,
-                   0, new_order_table_schema);
+    st = statement(txn_id, operation_type::Scan, NEW_ORDER_TABLE_ID, rec_ptr,
+                   end_ptr, 0, new_order_table_schema, 1);
 
-    TIMER(new_order_str = ee->select(st))
+    TIMER(new_order_strs = ee->scan(st))
 
-    if (new_order_str.empty()) {
+    if (new_order_strs.empty()) {
       TIMER(ee->txn_end(false));
       return;
     }
+    new_order_str = new_order_strs[0];
     LOG_INFO("new_order :: %s", new_order_str.c_str());
 
     // deleteNewOrder
@@ -1372,20 +1392,25 @@ void tpcc_benchmark::do_delivery(engine* ee) {
     rec_ptr = new order_line_record(order_line_table_schema, o_id, d_itr, w_id,
                                     0, 0, 0, 0, 0, 0, empty);
 
-    st = statement(txn_id, operation_type::Select, ORDER_LINE_TABLE_ID, rec_ptr,
-                   0, order_line_table_schema);
+    st = statement(txn_id, operation_type::Scan, ORDER_LINE_TABLE_ID, rec_ptr,
+                   1, order_line_table_schema, orders_max_ol_cnt + 1);
+
+    TIMER(order_line_strs = ee->scan(st))
+
+    double ol_amount = 0;
+    for (std::string& order_line_str : order_line_strs) {
+      LOG_INFO("order_line :: %s ", order_line_str.c_str());
 
-    TIMER(order_line_str = ee->select(st))
+      rec_ptr = sr.deserialize(order_line_str, order_line_table_schema);
+      ol_amount += std::stod(rec_ptr->get_data(8));
+
+      delete rec_ptr;
+    }
 
-    if (order_line_str.empty()) {
+    if (order_line_strs.empty()) {
       TIMER(ee->txn_end(false));
       return;
     }
-    LOG_INFO("order_line :: %s ", order_line_str.c_str());
-
-    rec_ptr = sr.deserialize(order_line_str, order_line_table_schema);
-
-    double ol_amount = std::stod(rec_ptr->get_data(8));
     LOG_INFO("ol_amount :: %.2lf ", ol_amount);
 
     // updateCustomer
@@ -1712,7 +1737,8 @@ void tpcc_benchmark::do_order_status(engine* ee) {
   int c_id = get_rand_int(0, customers_per_district);
   std::string c_name = get_rand_astring(name_len);
   bool lookup_by_name = get_rand_bool(0.8);
-  std::string customer_str, orders_str, order_line_str;
+  std::string customer_str, orders_str;
+  std::vector<std::string> customer_strs, orders_strs, order_line_strs;
 
   if (lookup_by_name) {
     // getCustomerByCustomerId
@@ -1736,15 +1762,18 @@ void tpcc_benchmark::do_order_status(engine* ee) {
                                   empty, empty, empty, 0, 0, 0, 0, 0, 0, 0,
                                   empty);
 
-    st = statement(txn_id, operation_type::Select, CUSTOMER_TABLE_ID, rec_ptr,
-                   1, customer_table_schema);
+    st = statement(txn_id, operation_type::Scan, CUSTOMER_TABLE_ID, rec_ptr,
+                   1, customer_table_schema, INT_MAX);
 
-    TIMER(customer_str = ee->select(st))
+    TIMER(customer_strs = ee->scan(st))
 
-    if (customer_str.empty()) {
+    if (customer_strs.empty()) {
       TIMER(ee->txn_end(false));
       return;
     }
+
+    // the middle one of the customers with that name
+    customer_str = customer_strs[(customer_strs.size() - 1) / 2];
     LOG_INFO("customer by name :: %s ", customer_str.c_str());
 
     rec_ptr = sr.deserialize(customer_str, customer_table_schema);
@@ -1758,43 +1787,42 @@ void tpcc_benchmark::do_order_status(engine* ee) {
   rec_ptr = new orders_record(orders_table_schema, 0, c_id, d_itr, w_id, 0, 0,
                               0, 0);
 
-  st = statement(txn_id, operation_type::Select, ORDERS_TABLE_ID, rec_ptr, 1,
-                 orders_table_schema);
+  st = statement(txn_id, operation_type::Scan, ORDERS_TABLE_ID, rec_ptr, 1,
+                 orders_table_schema, INT_MAX);
 
-  TIMER(orders_str = ee->select(st)
-  ;
-  )
+  TIMER(orders_strs = ee->scan(st))
 
-  if (orders_str.empty()) {
+  if (orders_strs.empty()) {
     TIMER(ee->txn_end(false));
     return;
   }
 
+  // the customer's orders come in o_id order
+  orders_str = orders_strs.back();
+
   LOG_INFO("orders :: %s ", orders_str.c_str());
 
   rec_ptr = sr.deserialize(orders_str, orders_table_schema);
 
-  c_id = std::stoi(rec_ptr->get_data(0));
+  int o_id = std::stoi(rec_ptr->get_data(0));
 
-  LOG_INFO("c_id :: %d ", c_id);
+  LOG_INFO("o_id :: %d ", o_id);
 
 // getOrderLines
-  rec_ptr = new order_line_record(order_line_table_schema, c_id, d_itr, w_id, 0,
+  rec_ptr = new order_line_record(order_line_table_schema, o_id, d_itr, w_id, 0,
                                   0, 0, 0, 0, 0, empty);
 
-  st = statement(txn_id, operation_type::Select, ORDER_LINE_TABLE_ID, rec_ptr,
-                 1, order_line_table_schema);
+  st = statement(txn_id, operation_type::Scan, ORDER_LINE_TABLE_ID, rec_ptr, 1,
+                 order_line_table_schema, orders_max_ol_cnt + 1);
 
-  TIMER(order_line_str = ee->select(st)
-  ;
-  )
+  TIMER(order_line_strs = ee->scan(st))
 
-  if (order_line_str.empty()) {
+  if (order_line_strs.empty()) {
     TIMER(ee->txn_end(false));
     return;
   }
 
-  LOG_INFO("order_line :: %s", order_line_str.c_str());
+  LOG_INFO("order_lines :: %lu", order_line_strs.size());
 
   TIMER(ee->txn_end(true));
 
@@ -1830,6 +1858,7 @@ void tpcc_benchmark::do_payment(engine* ee) {
   int c_w_id, c_d_id, c_id = 0;
   std::string c_name;
   std::string customer_str;
+  std::vector<std::string> customer_strs;
 
   if (pay_local) {
     c_w_id = w_id;
@@ -1869,15 +1898,18 @@ void tpcc_benchmark::do_payment(engine* ee) {
                                   empty, empty, empty, 0, 0, 0, 0, 0, 0, 0,
                                   empty);
 
-    st = statement(txn_id, operation_type::Select, CUSTOMER_TABLE_ID, rec_ptr,
-                   1, customer_table_schema);
+    st = statement(txn_id, operation_type::Scan, CUSTOMER_TABLE_ID, rec_ptr,
+                   1, customer_table_schema, INT_MAX);
 
-    TIMER(customer_str = ee->select(st))
+    TIMER(customer_strs = ee->scan(st))
 
-    if (customer_str.empty()) {
+    if (customer_strs.empty()) {
       TIMER(ee->txn_end(false));
       return;
     }
+
+    // the middle one of the customers with that name
+    customer_str = customer_strs[(customer_strs.size() - 1) / 2];
     LOG_INFO("customer by name :: %s", customer_str.c_str());
 
     rec_ptr = sr.deserialize(customer_str, customer_table_schema);
@@ -2047,7 +2079,7 @@ void tpcc_benchmark::do_stock_level(engine* ee) {
 
   LOG_INFO("Stock Level ");
 
-  record* rec_ptr;
+  record* rec_ptr, *end_ptr;
   statement st;
   std::vector<int> field_ids;
   std::string empty;
@@ -2056,7 +2088,8 @@ void tpcc_benchmark::do_stock_level(engine* ee) {
   int w_id = get_rand_int(0, warehouse_count);
   int d_id = get_rand_int(0, districts_per_warehouse);
   int threshold = get_rand_int(stock_min_threshold, stock_max_threshold);
-  std::string district_str, order_line_str, stock_str;
+  std::string district_str, stock_str;
+  std::vector<std::string> order_line_strs;
 
   txn_id++;
   TIMER(ee->txn_begin());
@@ -2084,32 +2117,35 @@ void tpcc_benchmark::do_stock_level(engine* ee) {
 
 // getStockCount
   std::set<int> items;
+  std::set<int> s_i_ids;
   int min_o_id = std::max(0, d_next_o_id - 20);
 
-  for (int o_id = min_o_id; o_id < d_next_o_id; o_id++) {
-    LOG_INFO("o_id :: %d ", o_id);
-
-    rec_ptr = new order_line_record(order_line_table_schema, o_id, d_id, w_id,
-                                    0, 0, 0, 0, 0, 0, empty);
-
-    st = statement(txn_id, operation_type::Select, ORDER_LINE_TABLE_ID, rec_ptr,
-                   1, order_line_table_schema);
+  rec_ptr = new order_line_record(order_line_table_schema, min_o_id, d_id, w_id,
+                                  0, 0, 0, 0, 0, 0, empty);
+  end_ptr = new order_line_record(order_line_table_schema, d_next_o_id - 1,
+                                  d_id, w_id, orders_max_ol_cnt, 0, 0, 0, 0, 0,
+                                  empty);
 
-    TIMER(order_line_str = ee->select(st))
+  st = statement(txn_id, operation_type::Scan, ORDER_LINE_TABLE_ID, rec_ptr,
+                 end_ptr, 0, order_line_table_schema,
+                 20 * (orders_max_ol_cnt + 1));
 
-    if (order_line_str.empty())
-      break;
+  TIMER(order_line_strs = ee->scan(st))
 
+  for (std::string& order_line_str : order_line_strs) {
     LOG_INFO("order_line :: %s ", order_line_str.c_str());
 
     rec_ptr = sr.deserialize(order_line_str, order_line_table_schema);
+    s_i_ids.insert(std::stoi(rec_ptr->get_data(4)));
 
-    int s_i_id = std::stoi(rec_ptr->get_data(4));
+    delete rec_ptr;
+  }
 
+  for (int s_i_id : s_i_ids) {
     LOG_INFO("s_i_id :: %d ", s_i_id);
 
-    rec_ptr = new stock_record(stock_table_schema, o_id, w_id, 0, empty_v, 0, 0,
-                               0, empty);
+    rec_ptr = new stock_record(stock_table_schema, s_i_id, w_id, 0, empty_v, 0,
+                               0, 0, empty);
 
     st = statement(txn_id, operation_type::Select, STOCK_TABLE_ID, rec_ptr, 0,
                    stock_table_do_stock_level_schema);
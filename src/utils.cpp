@@ -6,6 +6,7 @@
 #include <iomanip>
 #include <ctime>
 #include <cassert>
+#include <atomic>
 
 #include <stdio.h>
 #include <unistd.h>
@@ -13,6 +14,7 @@
 
 #include "utils.h"
 #include "record.h"
+#include "key_search.h"
 
 namespace storage {
 
@@ -77,6 +79,67 @@ namespace storage {
         return tuple;
     }
 
+    // NVM EMULATION
+    double tsc_per_ns = nvm_calibrate();
+    bool nvm_emulate = false;
+    nvm_config nvm = { 0, NVM_FENCE_LATENCY, 0, 0 };
+    nvm_cycles nvm_cyc = { 0, (unsigned long) (NVM_FENCE_LATENCY * tsc_per_ns),
+        0, 0 };
+
+    // tsc cycle by which the emulated media is busy with earlier writes
+    static std::atomic<unsigned long> nvm_busy_until(0);
+
+    static inline unsigned long clock_ns() {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+        return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+    }
+
+    // measure the tsc rate against the monotonic clock over a short window
+    double nvm_calibrate() {
+        unsigned long sns, ens, stsc, etsc;
+
+        sns = clock_ns();
+        stsc = read_tsc();
+        do {
+            ens = clock_ns();
+        } while (ens - sns < 10000000UL);
+        etsc = read_tsc();
+
+        return (double) (etsc - stsc) / (ens - sns);
+    }
+
+    void nvm_configure(const nvm_config& cfg) {
+        nvm = cfg;
+
+        nvm_cyc.write = (unsigned long) (cfg.write_latency * tsc_per_ns);
+        nvm_cyc.fence = (unsigned long) (cfg.fence_latency * tsc_per_ns);
+        nvm_cyc.read = (unsigned long) (cfg.read_latency * tsc_per_ns);
+        // MB/s is bytes/us
+        nvm_cyc.line = 0;
+        if (cfg.bandwidth)
+            nvm_cyc.line = (unsigned long) (NVM_LINE_SIZE * 1000.0 * tsc_per_ns
+                / cfg.bandwidth);
+
+        nvm_emulate = true;
+    }
+
+    // queue the lines behind all earlier writes from any thread, and wait
+    // until the media would have absorbed them
+    void nvm_throttle(unsigned long lines) {
+        unsigned long cost = lines * nvm_cyc.line;
+        unsigned long now = read_tsc();
+        unsigned long busy = nvm_busy_until.load(std::memory_order_relaxed);
+        unsigned long done;
+
+        do {
+            done = std::max(busy, now) + cost;
+        } while (!nvm_busy_until.compare_exchange_weak(busy, done));
+
+        while (read_tsc() < done)
+            cpu_pause();
+    }
+
     // TIMER
 
     void display_stats(engine_type etype, double duration, int num_txns) {
@@ -244,5 +307,22 @@ namespace storage {
         }
     }
 
+    // KEY SEARCH
+    const char* key_search_names[KEY_SEARCH_TYPES] = { "scalar", "sse4.2",
+        "avx2" };
+
+    // widest vector compare of 64-bit integers this cpu has
+    int key_search_detect() {
+        __builtin_cpu_init();
+
+        if (__builtin_cpu_supports("avx2"))
+            return KEY_SEARCH_AVX2;
+        if (__builtin_cpu_supports("sse4.2"))
+            return KEY_SEARCH_SSE42;
+        return KEY_SEARCH_SCALAR;
+    }
+
+    int key_search_isa = key_search_detect();
+
 }
 
@@ -0,0 +1,228 @@
+// vmem -- thread caching allocator for volatile objects
+
+#include <stdlib.h>
+#include <sys/mman.h>
+
+#include <mutex>
+#include <atomic>
+
+#include "vmem.h"
+
+namespace storage {
+
+#define VMEM_NUM_CLASSES 22
+#define VMEM_BATCH 32 /* objects moved between a thread and the central lists */
+#define VMEM_CACHE_MAX (2 * VMEM_BATCH)
+
+// 16B steps up to 256B, then 128B steps up to VMEM_MAX_SMALL
+static const unsigned int vmem_class_size[VMEM_NUM_CLASSES] = { 16, 32, 48,
+    64, 80, 96, 112, 128, 144, 160, 176, 192, 208, 224, 240, 256, 384, 512,
+    640, 768, 896, 1024 };
+
+// vmem_class -- size class of an object of the given size
+static inline unsigned int vmem_class(size_t size) {
+  if (size <= 256)
+    return size ? (size - 1) / 16 : 0;
+
+  return 16 + (size - 257) / 128;
+}
+
+// free objects are linked through their first word
+struct vobj {
+  struct vobj* next;
+};
+
+// central free lists, shared by all threads
+static std::mutex vmem_mutex;
+static struct vobj* vmem_central[VMEM_NUM_CLASSES];
+
+// class + 1 of every carved span, indexed by its offset in the heap
+static unsigned char vmem_span_class[VMEM_MAX_SIZE / VMEM_SPAN_SIZE];
+static size_t vmem_top;
+
+// 0 until the heap range is mapped, -1 if that failed
+static int vmem_state;
+
+/*
+ * each thread caches free objects per class, so the fast paths are a
+ * list pop or push without a lock. caches overflow to and refill from
+ * the central lists in batches.
+ */
+struct vcache {
+  struct vobj* head[VMEM_NUM_CLASSES];
+  unsigned int count[VMEM_NUM_CLASSES];
+  bool armed;
+  bool closed;
+};
+
+static thread_local struct vcache local_cache;
+
+// vmem_reserve -- map the heap range, with vmem_mutex held
+static bool vmem_reserve() {
+  void *base;
+
+  if (vmem_state != 0)
+    return (vmem_state == 1);
+
+  base = mmap((void *) VMEM_BASE, VMEM_MAX_SIZE, PROT_READ | PROT_WRITE,
+  MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+              -1, 0);
+
+  if (base == (void *) VMEM_BASE) {
+    vmem_state = 1;
+  } else {
+    if (base != MAP_FAILED)
+      munmap(base, VMEM_MAX_SIZE);
+    vmem_state = -1;
+  }
+
+  return (vmem_state == 1);
+}
+
+// vmem_carve -- split a new span into free objects, with vmem_mutex held
+static bool vmem_carve(unsigned int cls) {
+  size_t size = vmem_class_size[cls];
+  char *span, *obj;
+
+  if (!vmem_reserve() || vmem_top + VMEM_SPAN_SIZE > VMEM_MAX_SIZE)
+    return false;
+
+  span = (char *) VMEM_BASE + vmem_top;
+  vmem_span_class[vmem_top / VMEM_SPAN_SIZE] = cls + 1;
+  vmem_top += VMEM_SPAN_SIZE;
+
+  for (obj = span; obj + size <= span + VMEM_SPAN_SIZE; obj += size) {
+    ((struct vobj *) obj)->next = vmem_central[cls];
+    vmem_central[cls] = (struct vobj *) obj;
+  }
+
+  return true;
+}
+
+// vmem_take -- move up to count objects of a class off the central list
+static struct vobj* vmem_take(unsigned int cls, unsigned int count,
+                              unsigned int* taken) {
+  struct vobj *head, *tail;
+  unsigned int itr = 1;
+
+  std::lock_guard<std::mutex> lock(vmem_mutex);
+
+  if (vmem_central[cls] == NULL && !vmem_carve(cls))
+    return NULL;
+
+  head = tail = vmem_central[cls];
+  while (itr < count && tail->next != NULL) {
+    tail = tail->next;
+    itr++;
+  }
+
+  vmem_central[cls] = tail->next;
+  tail->next = NULL;
+
+  *taken = itr;
+  return head;
+}
+
+// vmem_give -- push a list of count objects back on the central list
+static void vmem_give(unsigned int cls, struct vobj* head, unsigned int count) {
+  struct vobj *tail = head;
+
+  while (--count)
+    tail = tail->next;
+
+  std::lock_guard<std::mutex> lock(vmem_mutex);
+  tail->next = vmem_central[cls];
+  vmem_central[cls] = head;
+}
+
+// vmem_flush -- hand every cached object back to the central lists
+static void vmem_flush(struct vcache* c) {
+  unsigned int cls;
+
+  for (cls = 0; cls < VMEM_NUM_CLASSES; cls++) {
+    if (c->count[cls])
+      vmem_give(cls, c->head[cls], c->count[cls]);
+    c->head[cls] = NULL;
+    c->count[cls] = 0;
+  }
+}
+
+// flush the cache when its thread exits
+struct vcache_guard {
+  ~vcache_guard() {
+    vmem_flush(&local_cache);
+    local_cache.closed = true;
+  }
+  bool armed;
+};
+
+static thread_local struct vcache_guard local_cache_guard;
+
+// vmem_alloc -- allocate an object, contents undefined
+void *vmem_alloc(size_t size) {
+  struct vcache* c = &local_cache;
+  struct vobj* obj;
+  unsigned int cls, taken;
+
+  if (size > VMEM_MAX_SMALL)
+    return malloc(size);
+
+  cls = vmem_class(size);
+  obj = c->head[cls];
+
+  if (obj == NULL) {
+    // a thread past its exit flush takes objects one at a time
+    if (c->closed) {
+      if ((obj = vmem_take(cls, 1, &taken)) == NULL)
+        return malloc(size);
+      return obj;
+    }
+
+    if (!c->armed) {
+      local_cache_guard.armed = true;
+      c->armed = true;
+    }
+
+    if ((obj = vmem_take(cls, VMEM_BATCH, &taken)) == NULL)
+      return malloc(size);
+    c->count[cls] = taken;
+  }
+
+  c->head[cls] = obj->next;
+  c->count[cls]--;
+  return obj;
+}
+
+// vmem_free -- release an object from vmem_alloc, inside the heap range
+void vmem_free(void *ptr) {
+  struct vcache* c = &local_cache;
+  struct vobj* obj = (struct vobj *) ptr;
+  struct vobj* batch;
+  unsigned int cls, itr;
+
+  cls = vmem_span_class[((uintptr_t) ptr - VMEM_BASE) / VMEM_SPAN_SIZE] - 1;
+
+  if (c->closed) {
+    obj->next = NULL;
+    vmem_give(cls, obj, 1);
+    return;
+  }
+
+  obj->next = c->head[cls];
+  c->head[cls] = obj;
+  c->count[cls]++;
+
+  // cache is full, return a batch to the central list
+  if (c->count[cls] > VMEM_CACHE_MAX) {
+    batch = c->head[cls];
+    obj = batch;
+    for (itr = 1; itr < VMEM_BATCH; itr++)
+      obj = obj->next;
+
+    c->head[cls] = obj->next;
+    c->count[cls] -= VMEM_BATCH;
+    vmem_give(cls, batch, VMEM_BATCH);
+  }
+}
+
+}
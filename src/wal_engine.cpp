@@ -51,38 +51,87 @@ wal_engine::~wal_engine() {
 std::string wal_engine::select(const statement& st) {
   LOG_INFO("Select");
   record* rec_ptr = st.rec_ptr;
-  record* select_ptr = NULL;
+  index_val select_val;
   table* tab = db->tables->at(st.table_id);
   table_index* table_index = tab->indices->at(st.table_index_id);
-  std::string key_str = sr.serialize(rec_ptr, table_index->sptr);
+  index_key key = ke.encode(rec_ptr, table_index->sptr);
 
-  unsigned long key = hash_fn(key_str);
   std::string val;
 
-  table_index->pm_map->at(key, &select_ptr);
-  if (select_ptr)
-    val = sr.serialize(select_ptr, st.projection);
+  table_index->map->at(key, &select_val);
+  if (select_val.rec)
+    val = sr.serialize(select_val.rec, st.projection);
   LOG_INFO("val : %s", val.c_str());
 
   delete rec_ptr;
   return val;
 }
 
+std::vector<std::string> wal_engine::scan(const statement& st) {
+  LOG_INFO("Scan");
+  table* tab = db->tables->at(st.table_id);
+  table_index* table_index = tab->indices->at(st.table_index_id);
+  std::vector<std::string> vals;
+
+  record* end_ptr = (st.end_ptr) ? st.end_ptr : st.rec_ptr;
+  index_key key = ke.encode_bound(st.rec_ptr, table_index->sptr,
+                                  table_index->match_len, false);
+  index_key end_key = ke.encode_bound(end_ptr, table_index->sptr,
+                                      table_index->match_len, true);
+
+  index_map<index_val>::iterator itr;
+  for (itr = table_index->map->lower_bound(key);
+      itr != table_index->map->end() && vals.size() < st.limit; ++itr) {
+    if (end_key < itr.key())
+      break;
+    vals.push_back(sr.serialize(itr.data().rec, st.projection));
+  }
+
+  delete st.rec_ptr;
+  delete st.end_ptr;
+  return vals;
+}
+
+std::vector<std::string> wal_engine::multi_select(const statement& st) {
+  LOG_INFO("Multi Select");
+  table* tab = db->tables->at(st.table_id);
+  table_index* table_index = tab->indices->at(st.table_index_id);
+  size_t num_keys = st.rec_ptrs.size();
+
+  std::vector<index_key> keys(num_keys);
+  std::vector<index_val> select_vals(num_keys);
+  std::unique_ptr<bool[]> found(new bool[num_keys]);
+  std::vector<std::string> vals(num_keys);
+
+  for (size_t itr = 0; itr < num_keys; itr++)
+    keys[itr] = ke.encode(st.rec_ptrs[itr], table_index->sptr);
+
+  // the index walks all the lookups together
+  table_index->map->multi_at(keys.data(), num_keys, select_vals.data(),
+                             found.get());
+
+  for (size_t itr = 0; itr < num_keys; itr++) {
+    if (found[itr])
+      vals[itr] = sr.serialize(select_vals[itr].rec, st.projection);
+    delete st.rec_ptrs[itr];
+  }
+
+  return vals;
+}
+
 int wal_engine::insert(const statement& st) {
   LOG_INFO("Insert");
   record* after_rec = st.rec_ptr;
   table* tab = db->tables->at(st.table_id);
-  plist<table_index*>* indices = tab->indices;
+  pvector<table_index*>* indices = tab->indices;
 
   unsigned int num_indices = tab->num_indices;
   unsigned int index_itr;
 
-  std::string key_str = sr.serialize(after_rec, indices->at(0)->sptr);
-  LOG_INFO("key_str :: %s", key_str.c_str());
-  unsigned long key = hash_fn(key_str);
+  index_key key = ke.encode(after_rec, indices->at(0)->sptr);
 
   // Check if key present
-  if (indices->at(0)->pm_map->exists(key) != 0) {
+  if (indices->at(0)->map->exists(key) != 0) {
     after_rec->clear_data();
     delete after_rec;
     return EXIT_SUCCESS;
@@ -104,11 +153,10 @@ int wal_engine::insert(const statement& st) {
 
   // Add entry in indices
   for (index_itr = 0; index_itr < num_indices; index_itr++) {
-    key_str = sr.serialize(after_rec, indices->at(index_itr)->sptr);
-    key = hash_fn(key_str);
+    key = ke.encode(after_rec, indices->at(index_itr)->sptr);
 
-    indices->at(index_itr)->pm_map->insert(key, after_rec);
-    indices->at(index_itr)->off_map->insert(key, storage_offset);
+    indices->at(index_itr)->insert(key,
+                                   index_val(after_rec, storage_offset));
   }
 
   return EXIT_SUCCESS;
@@ -118,21 +166,22 @@ int wal_engine::remove(const statement& st) {
   LOG_INFO("Remove");
   record* rec_ptr = st.rec_ptr;
   table* tab = db->tables->at(st.table_id);
-  plist<table_index*>* indices = tab->indices;
+  pvector<table_index*>* indices = tab->indices;
 
   unsigned int num_indices = tab->num_indices;
   unsigned int index_itr;
-  record* before_rec = NULL;
+  index_val before_val;
 
-  std::string key_str = sr.serialize(rec_ptr, indices->at(0)->sptr);
-  unsigned long key = hash_fn(key_str);
+  index_key key = ke.encode(rec_ptr, indices->at(0)->sptr);
 
   // Check if key does not exist
-  if (indices->at(0)->pm_map->at(key, &before_rec) == false) {
+  if (indices->at(0)->map->at(key, &before_val) == false) {
 	delete rec_ptr;
     return EXIT_SUCCESS;
   }
 
+  record* before_rec = before_val.rec;
+
   // Add log entry
   entry_stream.str("");
   entry_stream << st.transaction_id << " " << st.op_type << " " << st.table_id
@@ -141,15 +190,14 @@ int wal_engine::remove(const statement& st) {
   entry_str = entry_stream.str();
   fs_log.push_back(entry_str);
 
-  tab->pm_data->erase(before_rec);
+  if (!tab->pm_data->erase(before_rec))
+    die();
 
   // Remove entry in indices
   for (index_itr = 0; index_itr < num_indices; index_itr++) {
-    key_str = sr.serialize(rec_ptr, indices->at(index_itr)->sptr);
-    key = hash_fn(key_str);
+    key = ke.encode(rec_ptr, indices->at(index_itr)->sptr);
 
-    indices->at(index_itr)->pm_map->erase(key);
-    indices->at(index_itr)->off_map->erase(key);
+    indices->at(index_itr)->erase(key);
   }
 
   before_rec->clear_data();
@@ -163,19 +211,20 @@ int wal_engine::update(const statement& st) {
   LOG_INFO("Update");
   record* rec_ptr = st.rec_ptr;
   table* tab = db->tables->at(st.table_id);
-  plist<table_index*>* indices = db->tables->at(st.table_id)->indices;
+  pvector<table_index*>* indices = db->tables->at(st.table_id)->indices;
 
-  std::string key_str = sr.serialize(rec_ptr, indices->at(0)->sptr);
-  unsigned long key = hash_fn(key_str);
-  record* before_rec;
+  index_key key = ke.encode(rec_ptr, indices->at(0)->sptr);
+  index_val before_val;
 
   // Check if key does not exist
-  if (indices->at(0)->pm_map->at(key, &before_rec) == false) {
+  if (indices->at(0)->map->at(key, &before_val) == false) {
 	rec_ptr->clear_data();
     delete rec_ptr;
     return EXIT_SUCCESS;
   }
 
+  record* before_rec = before_val.rec;
+
   entry_stream.str("");
   entry_stream << st.transaction_id << " " << st.op_type << " " << st.table_id
                << " ";
@@ -199,9 +248,8 @@ int wal_engine::update(const statement& st) {
   entry_str = entry_stream.str();
   fs_log.push_back(entry_str);
 
-  off_t storage_offset = 0;
-  indices->at(0)->off_map->at(key, &storage_offset);
-  tab->fs_data.update(storage_offset, before_tuple);
+  if (before_val.offset != INVALID_OFFSET)
+    tab->fs_data.update(before_val.offset, before_tuple);
 
   delete rec_ptr;
   return EXIT_SUCCESS;
@@ -217,13 +265,12 @@ void wal_engine::load(const statement& st) {
   //LOG_INFO("Load");
   record* after_rec = st.rec_ptr;
   table* tab = db->tables->at(st.table_id);
-  plist<table_index*>* indices = tab->indices;
+  pvector<table_index*>* indices = tab->indices;
 
   unsigned int num_indices = tab->num_indices;
   unsigned int index_itr;
 
-  std::string key_str = sr.serialize(after_rec, indices->at(0)->sptr);
-  unsigned long key = hash_fn(key_str);
+  index_key key = ke.encode(after_rec, indices->at(0)->sptr);
 
   std::string after_tuple = sr.serialize(after_rec, after_rec->sptr);
 
@@ -243,11 +290,10 @@ void wal_engine::load(const statement& st) {
 
   // Add entry in indices
   for (index_itr = 0; index_itr < num_indices; index_itr++) {
-    key_str = sr.serialize(after_rec, indices->at(index_itr)->sptr);
-    key = hash_fn(key_str);
+    key = ke.encode(after_rec, indices->at(index_itr)->sptr);
 
-    indices->at(index_itr)->pm_map->insert(key, after_rec);
-    indices->at(index_itr)->off_map->insert(key, storage_offset);
+    indices->at(index_itr)->insert(key,
+                                   index_val(after_rec, storage_offset));
   }
 
 }
@@ -270,13 +316,13 @@ void wal_engine::recovery() {
   fs_log.sync();
   fs_log.disable();
 
-  // Clear off_map and rebuild it
+  // Clear the offsets and rebuild them
   std::vector<table*> tables = db->tables->get_data();
   for (table* tab : tables) {
     std::vector<table_index*> indices = tab->indices->get_data();
 
     for (table_index* index : indices) {
-      index->off_map->clear();
+      index->drop_offsets();
     }
   }
 
@@ -61,7 +61,7 @@ table* create_usertable(config& conf) {
 
   table_index* key_index = new ((table_index*) pmalloc(sizeof(table_index))) table_index(user_table_index_schema,	\
                                            					conf.ycsb_num_val_fields + 1, conf,	\
-                                           						sp);
+                                           						sp, (conf.hash_index) ? HASH_INDEX : BTREE_INDEX);
   pmemalloc_activate(key_index);
   user_table->indices->push_back(key_index);
 
@@ -195,6 +195,8 @@ void ycsb_benchmark::do_read(engine* ee) {
   std::string empty;
   std::string rc;
 
+  std::vector<record*> rec_ptrs;
+
   TIMER(ee->txn_begin())
 
   for (int stmt_itr = 0; stmt_itr < conf.ycsb_tuples_per_txn; stmt_itr++) {
@@ -203,12 +205,14 @@ void ycsb_benchmark::do_read(engine* ee) {
 
     record* rec_ptr = new usertable_record(user_table_schema, key, empty,
                                            conf.ycsb_num_val_fields, false);
+    rec_ptrs.push_back(rec_ptr);
+  }
 
-    statement st(txn_id, operation_type::Select, USER_TABLE_ID, rec_ptr, 0,
-                 user_table_schema);
+  // all the keys of the txn in one batched lookup
+  statement st(txn_id, operation_type::MultiSelect, USER_TABLE_ID, rec_ptrs, 0,
+               user_table_schema);
 
-    TIMER(ee->select(st))
-  }
+  TIMER(ee->multi_select(st))
 
   TIMER(ee->txn_end(true))
 }
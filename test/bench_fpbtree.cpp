@@ -0,0 +1,103 @@
+#include <iostream>
+#include <iomanip>
+#include <memory>
+#include <random>
+#include <vector>
+#include <cstdlib>
+#include <algorithm>
+#include <unistd.h>
+
+#include "fpbtree.h"
+#include "timer.h"
+
+namespace storage {
+
+#define NUM_LOOKUPS (4 * 1024 * 1024)
+
+typedef fpbtree<unsigned long, unsigned long> tree_type;
+
+// point selects of random present keys, batch at a time through multi_at
+// or one by one through at, returns million lookups per second
+double run(tree_type* tree, const std::vector<unsigned long>& keys,
+           size_t batch) {
+  std::mt19937_64 gen(42);
+  std::vector<unsigned long> lookup_keys(batch), vals(batch);
+  std::unique_ptr<bool[]> found(new bool[batch]);
+  unsigned long hits = 0;
+  timer tm;
+
+  tm.start();
+  for (unsigned long itr = 0; itr < NUM_LOOKUPS; itr += batch) {
+    for (size_t i = 0; i < batch; i++)
+      lookup_keys[i] = keys[gen() % keys.size()];
+
+    if (batch == 1)
+      hits += tree->at(lookup_keys[0], &vals[0]);
+    else
+      hits += tree->multi_at(lookup_keys.data(), batch, vals.data(),
+                             found.get());
+  }
+  tm.end();
+
+  if (hits != NUM_LOOKUPS)
+    std::cout << "missed " << NUM_LOOKUPS - hits << " keys" << std::endl;
+
+  return NUM_LOOKUPS / (tm.duration() * 1000);
+}
+
+void bench_fpbtree(std::vector<unsigned long> sizes) {
+  const char* path = "./zfile_bench_fpbtree";
+  std::vector<unsigned long> keys;
+  std::mt19937_64 gen(7);
+
+  // cleanup
+  unlink(path);
+
+  long pmp_size = 64 * 1024 * 1024;
+  if ((pmp = pmemalloc_init(path, pmp_size)) == NULL)
+    std::cout << "pmemalloc_init on :" << path << std::endl;
+
+  sp = (struct static_info *) pmemalloc_static_area();
+
+  // one tree grows through the sizes, with random 64-bit keys
+  tree_type* tree = new ((tree_type*) pmalloc(sizeof(tree_type))) tree_type(
+      &sp->ptrs[0]);
+
+  std::sort(sizes.begin(), sizes.end());
+  for (unsigned long num_keys : sizes) {
+    while (keys.size() < num_keys) {
+      keys.push_back(gen());
+      tree->insert(keys.back(), keys.size());
+    }
+
+    std::cout << std::setw(11) << num_keys;
+    for (size_t batch : { 1, 4, 16 })
+      std::cout << std::setw(12) << run(tree, keys, batch);
+    std::cout << std::endl;
+  }
+
+  unlink(path);
+  for (int i = 1; i <= PMEM_MAX_EXTENTS; i++)
+    unlink((std::string(path) + "." + std::to_string(i)).c_str());
+}
+
+}
+
+// key counts to test, 1M and 10M by default
+int main(int argc, char* argv[]) {
+  std::vector<unsigned long> sizes = { 1000000, 10000000 };
+
+  if (argc > 1) {
+    sizes.clear();
+    for (int i = 1; i < argc; i++)
+      sizes.push_back(strtoul(argv[i], NULL, 10));
+  }
+
+  std::cout << std::fixed << std::setprecision(2);
+  std::cout << "       keys       at(Mops/s) multi_at(4)  multi_at(16)"
+            << std::endl;
+
+  storage::bench_fpbtree(sizes);
+
+  return 0;
+}
@@ -0,0 +1,94 @@
+#include <iostream>
+#include <iomanip>
+#include <random>
+#include <vector>
+#include <cstdlib>
+#include <algorithm>
+#include <unistd.h>
+
+#include "pbtree.h"
+#include "timer.h"
+
+namespace storage {
+
+#define NUM_LOOKUPS (4 * 1024 * 1024)
+
+// point selects of random present keys, returns million lookups per second
+double run(pbtree<unsigned long, unsigned long>* tree,
+           const std::vector<unsigned long>& keys) {
+  std::mt19937_64 gen(42);
+  unsigned long val, found = 0;
+  timer tm;
+
+  tm.start();
+  for (unsigned long itr = 0; itr < NUM_LOOKUPS; itr++)
+    found += tree->at(keys[gen() % keys.size()], &val);
+  tm.end();
+
+  if (found != NUM_LOOKUPS)
+    std::cout << "missed " << NUM_LOOKUPS - found << " keys" << std::endl;
+
+  return NUM_LOOKUPS / (tm.duration() * 1000);
+}
+
+void bench_pbtree(std::vector<unsigned long> sizes) {
+  const char* path = "./zfile_bench_pbtree";
+  std::vector<unsigned long> keys;
+  std::mt19937_64 gen(7);
+  int detected = key_search_isa;
+
+  // cleanup
+  unlink(path);
+
+  // leaves hold 30 pairs in 512 bytes, the pool grows past this
+  long pmp_size = 64 * 1024 * 1024;
+  if ((pmp = pmemalloc_init(path, pmp_size)) == NULL)
+    std::cout << "pmemalloc_init on :" << path << std::endl;
+
+  sp = (struct static_info *) pmemalloc_static_area();
+
+  // one tree grows through the sizes, with random 64-bit keys like the
+  // hashed keys of table indices
+  pbtree<unsigned long, unsigned long>* tree =
+      new pbtree<unsigned long, unsigned long>(&sp->ptrs[0]);
+
+  std::sort(sizes.begin(), sizes.end());
+  for (unsigned long num_keys : sizes) {
+    while (keys.size() < num_keys) {
+      keys.push_back(gen());
+      tree->insert(keys.back(), keys.size());
+    }
+
+    for (int isa = 0; isa <= detected; isa++) {
+      key_search_isa = isa;
+      std::cout << std::setw(11) << num_keys << std::setw(10)
+                << key_search_names[isa] << std::setw(14) << run(tree, keys)
+                << std::endl;
+    }
+  }
+
+  key_search_isa = detected;
+  unlink(path);
+  for (int i = 1; i <= PMEM_MAX_EXTENTS; i++)
+    unlink((std::string(path) + "." + std::to_string(i)).c_str());
+}
+
+}
+
+// key counts to test, 1M and 10M by default, up to 100M fits in a few GB
+int main(int argc, char* argv[]) {
+  std::vector<unsigned long> sizes = { 1000000, 10000000 };
+
+  if (argc > 1) {
+    sizes.clear();
+    for (int i = 1; i < argc; i++)
+      sizes.push_back(strtoul(argv[i], NULL, 10));
+  }
+
+  std::cout << std::fixed << std::setprecision(2);
+  std::cout << "       keys    search  lookup(Mops/s)" << std::endl;
+
+  storage::bench_pbtree(sizes);
+
+  return 0;
+}
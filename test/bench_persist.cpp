@@ -0,0 +1,82 @@
+#include <iostream>
+#include <iomanip>
+#include <unistd.h>
+
+#include "libpm.h"
+#include "timer.h"
+
+namespace storage {
+
+#define REGION_SIZE (16 * 1024 * 1024)
+#define NUM_LINES (REGION_SIZE / ALIGN)
+#define ROUNDS 8
+
+// dirty every line, then write it back with a drain every batch lines
+double run(char* region, unsigned int batch, unsigned long* lines) {
+  timer tm;
+
+  for (unsigned int round = 0; round < ROUNDS; round++) {
+    for (unsigned long line = 0; line < NUM_LINES; line++)
+      region[line * ALIGN] = (char) round;
+
+    tm.start();
+    for (unsigned long line = 0; line < NUM_LINES; line += batch) {
+      pmem_flush(region + line * ALIGN, batch * ALIGN);
+      pmem_drain();
+    }
+    tm.end();
+
+    *lines += NUM_LINES;
+  }
+
+  return tm.duration();
+}
+
+void bench_persist() {
+  const char* path = "./zfile";
+
+  // cleanup
+  unlink(path);
+
+  long pmp_size = 64 * 1024 * 1024;
+  if ((pmp = pmemalloc_init(path, pmp_size)) == NULL)
+    std::cout << "pmemalloc_init on :" << path << std::endl;
+
+  sp = (struct static_info *) pmemalloc_static_area();
+
+  char* region = (char*) pmalloc(REGION_SIZE);
+  int detected = pmem_flush_type;
+  unsigned int batches[] = { 1, 8, 64 };
+
+  std::cout << "detected primitive : " << pmem_flush_names[detected]
+            << std::endl;
+  std::cout << std::fixed << std::setprecision(2);
+  std::cout << " primitive  lines/drain        lines    time(ms)   ns/line"
+            << std::endl;
+
+  for (int type = 0; type < PMEM_FLUSH_TYPES; type++) {
+    if (!pmem_flush_supported(type))
+      continue;
+
+    pmem_flush_type = type;
+    for (unsigned int batch : batches) {
+      unsigned long lines = 0;
+      double dur = run(region, batch, &lines);
+
+      std::cout << std::setw(10) << pmem_flush_names[type] << std::setw(13)
+                << batch << std::setw(13) << lines << std::setw(12) << dur
+                << std::setw(10) << (dur * 1000000.0 / lines) << std::endl;
+    }
+  }
+
+  pmem_flush_type = detected;
+  pfree(region);
+  unlink(path);
+}
+
+}
+
+int main() {
+  storage::bench_persist();
+  return 0;
+}
@@ -0,0 +1,95 @@
+#include <iostream>
+#include <iomanip>
+#include <thread>
+#include <vector>
+#include <mutex>
+#include <unistd.h>
+
+#include "libpm.h"
+#include "timer.h"
+
+extern std::mutex pmp_mutex;
+
+namespace storage {
+
+#define OPS_PER_THREAD (1024 * 256)
+#define LIVE_OBJECTS 256
+
+// alloc/free churn with a small live set, like records and log entries
+void churn(bool shared, unsigned int seed) {
+  std::vector<void*> live(LIVE_OBJECTS, nullptr);
+  size_t sz;
+
+  for (unsigned int itr = 0; itr < OPS_PER_THREAD; itr++) {
+    unsigned int slot = rand_r(&seed) % LIVE_OBJECTS;
+    sz = 16 + rand_r(&seed) % 512;
+
+    if (shared) {
+      pmp_mutex.lock();
+      pmemalloc_free(live[slot]);
+      live[slot] = pmemalloc_reserve(sz);
+      pmp_mutex.unlock();
+    } else {
+      pfree(live[slot]);
+      live[slot] = pmalloc(sz);
+    }
+  }
+
+  for (void* ptr : live) {
+    if (shared) {
+      pmp_mutex.lock();
+      pmemalloc_free(ptr);
+      pmp_mutex.unlock();
+    } else {
+      pfree(ptr);
+    }
+  }
+}
+
+double run(bool shared, unsigned int num_threads) {
+  std::vector<std::thread> threads;
+  timer tm;
+
+  tm.start();
+  for (unsigned int i = 0; i < num_threads; i++)
+    threads.push_back(std::thread(churn, shared, i));
+  for (unsigned int i = 0; i < num_threads; i++)
+    threads[i].join();
+  tm.end();
+
+  // million alloc/free pairs per second
+  return (num_threads * (double) OPS_PER_THREAD) / (tm.duration() * 1000);
+}
+
+void bench_pmalloc() {
+  const char* path = "./zfile";
+
+  // cleanup
+  unlink(path);
+
+  long pmp_size = 1024 * 1024 * 1024;
+  if ((pmp = pmemalloc_init(path, pmp_size)) == NULL)
+    std::cout << "pmemalloc_init on :" << path << std::endl;
+
+  sp = (struct static_info *) pmemalloc_static_area();
+
+  std::cout << std::fixed << std::setprecision(2);
+  std::cout << "threads   shared(Mops/s)   arena(Mops/s)" << std::endl;
+
+  for (unsigned int num_threads = 1; num_threads <= 8; num_threads *= 2) {
+    double shared = run(true, num_threads);
+    double arena = run(false, num_threads);
+
+    std::cout << std::setw(7) << num_threads << std::setw(17) << shared
+              << std::setw(16) << arena << std::endl;
+  }
+
+  unlink(path);
+}
+
+}
+
+int main() {
+  storage::bench_pmalloc();
+  return 0;
+}
@@ -0,0 +1,76 @@
+#include <iostream>
+#include <iomanip>
+#include <thread>
+#include <vector>
+#include <cstdlib>
+
+#include "vmem.h"
+#include "timer.h"
+
+namespace storage {
+
+#define OPS_PER_THREAD (1024 * 1024)
+#define LIVE_OBJECTS 1024
+
+// alloc/free churn with a small live set, like serialized strings and
+// statement field lists
+void churn(bool use_calloc, unsigned int seed) {
+  std::vector<void*> live(LIVE_OBJECTS, nullptr);
+  size_t sz;
+
+  for (unsigned int itr = 0; itr < OPS_PER_THREAD; itr++) {
+    unsigned int slot = rand_r(&seed) % LIVE_OBJECTS;
+    sz = 8 + rand_r(&seed) % 256;
+
+    if (use_calloc) {
+      free(live[slot]);
+      live[slot] = calloc(1, sz);
+    } else {
+      if (live[slot] != nullptr)
+        vmem_free(live[slot]);
+      live[slot] = vmem_alloc(sz);
+    }
+  }
+
+  for (void* ptr : live) {
+    if (use_calloc)
+      free(ptr);
+    else if (ptr != nullptr)
+      vmem_free(ptr);
+  }
+}
+
+double run(bool use_calloc, unsigned int num_threads) {
+  std::vector<std::thread> threads;
+  timer tm;
+
+  tm.start();
+  for (unsigned int i = 0; i < num_threads; i++)
+    threads.push_back(std::thread(churn, use_calloc, i));
+  for (unsigned int i = 0; i < num_threads; i++)
+    threads[i].join();
+  tm.end();
+
+  // million alloc/free pairs per second
+  return (num_threads * (double) OPS_PER_THREAD) / (tm.duration() * 1000);
+}
+
+void bench_vmalloc() {
+  std::cout << std::fixed << std::setprecision(2);
+  std::cout << "threads   calloc(Mops/s)    vmem(Mops/s)" << std::endl;
+
+  for (unsigned int num_threads = 1; num_threads <= 8; num_threads *= 2) {
+    double calloc_path = run(true, num_threads);
+    double vmem_path = run(false, num_threads);
+
+    std::cout << std::setw(7) << num_threads << std::setw(17) << calloc_path
+              << std::setw(16) << vmem_path << std::endl;
+  }
+}
+
+}
+
+int main() {
+  storage::bench_vmalloc();
+  return 0;
+}
@@ -0,0 +1,149 @@
+#include <iostream>
+#include <cassert>
+#include <thread>
+#include <vector>
+#include <atomic>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "cpbtree.h"
+
+namespace storage {
+
+#define NUM_THREADS 4
+#define NUM_KEYS (NUM_THREADS * 20000)
+
+typedef cpbtree<unsigned long, unsigned long> tree_type;
+
+// keys go in out of order, so leaves and inner nodes split in the middle
+static inline unsigned long key_of(unsigned long i) {
+  return (i * 7919) % NUM_KEYS;
+}
+
+// insert this thread's keys from where it last stopped, threads share
+// leaves as their keys interleave
+void writer(tree_type* tree, unsigned long* done) {
+  unsigned long val;
+
+  for (unsigned long i = (*done); i < NUM_KEYS; i += NUM_THREADS) {
+    // the insert cut short by the last crash may have landed
+    assert(tree->insert(key_of(i), i) || i == (*done));
+    assert(tree->at(key_of(i), &val) && val == i);
+    assert(tree->insert(key_of(i), 0) == false);
+
+    (*done) = i + NUM_THREADS;
+    pmem_persist(done, sizeof(unsigned long), 0);
+  }
+}
+
+// erase the even keys of this thread while others read the odd ones
+void eraser(tree_type* tree, unsigned long tid) {
+  unsigned long val;
+
+  for (unsigned long i = tid; i < NUM_KEYS; i += NUM_THREADS) {
+    if (key_of(i) % 2 == 0)
+      assert(tree->erase(key_of(i)) == 1);
+    else
+      assert(tree->at(key_of(i), &val) && val == i);
+  }
+}
+
+// run the writers in a child process until a timer kills it
+void write_until_killed(tree_type* tree, long usec) {
+  std::vector<std::thread> threads;
+  struct itimerval timer = { { 0, 0 }, { 0, usec } };
+  pid_t pid = fork();
+
+  if (pid != 0) {
+    waitpid(pid, NULL, 0);
+    return;
+  }
+
+  if (usec > 0)
+    setitimer(ITIMER_REAL, &timer, NULL);
+
+  for (unsigned long tid = 0; tid < NUM_THREADS; tid++)
+    threads.push_back(std::thread(writer, tree,
+                                  (unsigned long*) &sp->ptrs[2 + tid]));
+  for (std::thread& t : threads)
+    t.join();
+  _exit(0);
+}
+
+void test_cpbtree() {
+  const char* path = "./zfile_cpbtree";
+  std::vector<std::thread> threads;
+  unsigned long val, count;
+  bool finished = false;
+
+  // cleanup
+  unlink(path);
+
+  long pmp_size = 64 * 1024 * 1024;
+  if ((pmp = pmemalloc_init(path, pmp_size)) == NULL)
+    std::cout << "pmemalloc_init on :" << path << std::endl;
+
+  sp = (struct static_info *) pmemalloc_static_area();
+
+  tree_type* tree = new ((tree_type*) pmalloc(sizeof(tree_type))) tree_type(&sp->ptrs[0]);
+  pmemalloc_activate(tree);
+  sp->ptrs[1] = tree;
+  for (unsigned long tid = 0; tid < NUM_THREADS; tid++)
+    sp->ptrs[2 + tid] = (void*) tid;
+  pmem_persist(&sp->ptrs[1], (1 + NUM_THREADS) * sizeof(void*), 0);
+
+  // crash the writers at random points, amid leaf and inner node splits
+  // too, and check the repaired tree after each reopen
+  srand(1);
+  for (int round = 0; !finished; round++) {
+    write_until_killed(tree, (round < 200) ? 200 + rand() % 5000 : 0);
+
+    if ((pmp = pmemalloc_init(path, pmp_size)) == NULL)
+      std::cout << "pmemalloc_init on :" << path << std::endl;
+
+    sp = (struct static_info *) pmemalloc_static_area();
+    tree = (tree_type*) sp->ptrs[1];
+
+    // each thread's inserts before its counter landed, the next one may
+    finished = true;
+    count = 0;
+    for (unsigned long i = 0; i < NUM_KEYS; i++) {
+      unsigned long done = (unsigned long) sp->ptrs[2 + i % NUM_THREADS];
+      bool found = tree->at(key_of(i), &val);
+
+      assert(found == (i < done) || (i == done && val == i));
+      assert(!found || val == i);
+      count += found;
+      finished = finished && (done >= NUM_KEYS);
+    }
+    assert(tree->size() == count);
+  }
+
+  for (unsigned long tid = 0; tid < NUM_THREADS; tid++)
+    threads.push_back(std::thread(eraser, tree, tid));
+  for (std::thread& t : threads)
+    t.join();
+
+  assert(tree->size() == NUM_KEYS / 2);
+
+  // reopen, the tree is checked and recounted on first use
+  if ((pmp = pmemalloc_init(path, pmp_size)) == NULL)
+    std::cout << "pmemalloc_init on :" << path << std::endl;
+
+  sp = (struct static_info *) pmemalloc_static_area();
+  tree = (tree_type*) sp->ptrs[1];
+
+  assert(tree->size() == NUM_KEYS / 2);
+  for (unsigned long i = 0; i < NUM_KEYS; i++)
+    assert(tree->at(i, &val) == (i % 2 == 1));
+
+  unlink(path);
+}
+
+}
+
+int main() {
+  storage::test_cpbtree();
+  return 0;
+}
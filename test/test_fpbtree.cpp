@@ -0,0 +1,143 @@
+#include <iostream>
+#include <cassert>
+#include <cstdlib>
+#include <memory>
+#include <vector>
+#include <signal.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "fpbtree.h"
+
+namespace storage {
+
+#define NUM_KEYS 100000
+
+typedef fpbtree<unsigned long, unsigned long> tree_type;
+
+// keys go in out of order, so leaves and inner nodes split in the middle
+static inline unsigned long key_of(unsigned long i) {
+  return (i * 7919) % NUM_KEYS;
+}
+
+// a child inserts from where the last one stopped until a timer kills it
+void insert_until_killed(tree_type* tree, unsigned long* done, long usec) {
+  struct itimerval timer = { { 0, 0 }, { 0, usec } };
+
+  if (usec > 0)
+    setitimer(ITIMER_REAL, &timer, NULL);
+
+  for (unsigned long i = (*done); i < NUM_KEYS; i++) {
+    tree->insert(key_of(i), i);
+    (*done) = i + 1;
+    pmem_persist(done, sizeof(unsigned long), 0);
+  }
+
+  _exit(0);
+}
+
+void test_fpbtree() {
+  const char* path = "./zfile_fpbtree";
+  unsigned long val, prev = 0, count;
+  int detected = key_search_isa;
+
+  // cleanup
+  unlink(path);
+
+  long pmp_size = 64 * 1024 * 1024;
+  if ((pmp = pmemalloc_init(path, pmp_size)) == NULL)
+    std::cout << "pmemalloc_init on :" << path << std::endl;
+
+  sp = (struct static_info *) pmemalloc_static_area();
+
+  tree_type* tree = new ((tree_type*) pmalloc(sizeof(tree_type))) tree_type(&sp->ptrs[0]);
+  pmemalloc_activate(tree);
+  sp->ptrs[1] = tree;
+  sp->ptrs[2] = NULL;
+  pmem_persist(&sp->ptrs[1], 2 * sizeof(void*), 0);
+
+  // crash the inserts at random points, including amid leaf and inner
+  // splits, and check what the reopened tree holds each time
+  srand(1);
+  for (int round = 0; (unsigned long) sp->ptrs[2] < NUM_KEYS; round++) {
+    pid_t pid = fork();
+    if (pid == 0)
+      insert_until_killed(tree, (unsigned long*) &sp->ptrs[2],
+                          (round < 200) ? 200 + rand() % 5000 : 0);
+    waitpid(pid, NULL, 0);
+
+    if ((pmp = pmemalloc_init(path, pmp_size)) == NULL)
+      std::cout << "pmemalloc_init on :" << path << std::endl;
+
+    sp = (struct static_info *) pmemalloc_static_area();
+    tree = (tree_type*) sp->ptrs[1];
+
+    // the insert in flight may or may not have landed
+    unsigned long done = (unsigned long) sp->ptrs[2];
+    for (unsigned long i = 0; i < NUM_KEYS; i++)
+      assert(tree->at(key_of(i), &val) == (i < done)
+          || (i == done && val == i));
+    assert(tree->size() == done || tree->size() == done + 1);
+  }
+
+  // the unsorted leaves come out in key order
+  count = 0;
+  for (tree_type::iterator itr = tree->begin(); itr != tree->end(); itr++) {
+    assert(count == 0 || prev < (*itr).first);
+    prev = (*itr).first;
+    count++;
+  }
+  assert(count == NUM_KEYS);
+
+  for (unsigned long i = 0; i < NUM_KEYS; i += 2)
+    assert(tree->erase(i) == 1);
+  assert(tree->erase(0) == 0);
+  assert(tree->update(0, 0) == -1);
+  assert(tree->at(1, &val) && tree->update(1, val) == 0);
+  assert(tree->lower_bound(0).key() == 1);
+
+  // fingerprints are matched with every instruction set
+  std::vector<unsigned long> keys, vals(NUM_KEYS);
+  std::unique_ptr<bool[]> found(new bool[NUM_KEYS]);
+  for (unsigned long i = 0; i < NUM_KEYS; i++)
+    keys.push_back(i);
+
+  for (int isa = 0; isa <= detected; isa++) {
+    key_search_isa = isa;
+    assert(tree->multi_at(keys.data(), NUM_KEYS, vals.data(), found.get())
+        == NUM_KEYS / 2);
+    for (unsigned long i = 0; i < NUM_KEYS; i++)
+      assert(found[i] == (i % 2 == 1) && (i % 2 == 0 || key_of(vals[i]) == i));
+  }
+  key_search_isa = detected;
+
+  // hybrid tree, the inner nodes are rebuilt from the leaves on reopen
+  tree_type* htree = new ((tree_type*) pmalloc(sizeof(tree_type))) tree_type(&sp->ptrs[3]);
+  pmemalloc_activate(htree);
+  htree->enable_hybrid();
+  sp->ptrs[4] = htree;
+  pmem_persist(&sp->ptrs[4], sizeof(void*), 0);
+
+  for (unsigned long i = 0; i < NUM_KEYS; i++)
+    htree->insert(key_of(i), i);
+
+  if ((pmp = pmemalloc_init(path, pmp_size)) == NULL)
+    std::cout << "pmemalloc_init on :" << path << std::endl;
+
+  sp = (struct static_info *) pmemalloc_static_area();
+  htree = (tree_type*) sp->ptrs[4];
+
+  assert(htree->size() == NUM_KEYS);
+  for (unsigned long i = 0; i < NUM_KEYS; i++)
+    assert(htree->at(key_of(i), &val) && val == i);
+
+  unlink(path);
+}
+
+}
+
+int main() {
+  storage::test_fpbtree();
+  return 0;
+}
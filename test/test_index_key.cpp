@@ -0,0 +1,128 @@
+#include <iostream>
+#include <cassert>
+#include <tuple>
+#include <vector>
+#include <unistd.h>
+
+#include "fpbtree.h"
+#include "index_key.h"
+
+namespace storage {
+
+typedef std::tuple<int, double, std::string> columns;
+
+static const int ints[] = { -70000, -1, 0, 1, 255, 256, 70000 };
+static const double doubles[] = { -2.5, -0.5, 0, 0.5, 2.5 };
+static const char* strs[] = { "", "a", "ab", "abcdefgh", "b" };
+
+// key bytes sort like the columns, and match only equal columns
+void check(const key_encoder& ke, schema* sptr, std::vector<record*>& recs,
+           std::vector<columns>& vals) {
+  for (size_t i = 0; i < recs.size(); i++) {
+    index_key ki = ke.encode(recs[i], sptr);
+    std::string si = ke.encode_str(recs[i], sptr, 1, 2);
+    assert(si.size() == 2 + key_encoder::key_len(sptr));
+
+    for (size_t j = 0; j < recs.size(); j++) {
+      index_key kj = ke.encode(recs[j], sptr);
+      std::string sj = ke.encode_str(recs[j], sptr, 1, 2);
+
+      assert((ki < kj) == (vals[i] < vals[j]));
+      assert((ki == kj) == (vals[i] == vals[j]));
+      assert((si < sj) == (vals[i] < vals[j]));
+    }
+  }
+}
+
+void test_index_key() {
+  const char* path = "./zfile_index_key";
+  std::vector<field_info> cols;
+  std::vector<record*> recs;
+  std::vector<columns> vals;
+  key_encoder ke;
+  off_t offset = 0;
+
+  // cleanup
+  unlink(path);
+
+  long pmp_size = 64 * 1024 * 1024;
+  if ((pmp = pmemalloc_init(path, pmp_size)) == NULL)
+    std::cout << "pmemalloc_init on :" << path << std::endl;
+
+  sp = (struct static_info *) pmemalloc_static_area();
+
+  cols.push_back(field_info(offset, 10, 10, field_type::INTEGER, 1, 1));
+  offset += cols.back().ser_len;
+  cols.push_back(field_info(offset, 15, 15, field_type::DOUBLE, 1, 1));
+  offset += cols.back().ser_len;
+  cols.push_back(field_info(offset, 12, 8, field_type::VARCHAR, 0, 1));
+
+  schema* sptr = new schema(cols);
+  assert(key_encoder::key_len(sptr) == 4 + 8 + 8);
+
+  for (int ival : ints)
+    for (double dval : doubles)
+      for (const char* str : strs) {
+        record* rec = new record(sptr);
+        rec->set_int(0, ival);
+        rec->set_double(1, dval);
+        rec->set_varchar(2, str);
+
+        recs.push_back(rec);
+        vals.push_back(columns(ival, dval, str));
+      }
+
+  check(ke, sptr, recs, vals);
+
+  // the index tree keeps them in column order
+  fpbtree<index_key, unsigned long>* tree = new fpbtree<index_key,
+      unsigned long>(&sp->ptrs[0]);
+
+  for (size_t i = 0; i < recs.size(); i++)
+    assert(tree->insert(ke.encode(recs[i], sptr), i));
+  for (size_t i = 0; i < recs.size(); i++)
+    assert(tree->insert(ke.encode(recs[i], sptr), i) == false);
+
+  size_t count = 0;
+  fpbtree<index_key, unsigned long>::iterator itr;
+  for (itr = tree->begin(); itr != tree->end(); itr++, count++)
+    assert(itr.data() == count);
+  assert(count == recs.size());
+
+  // bounds on the integer column cover the keys that share it
+  size_t prefix_len = key_encoder::prefix_len(sptr, 1);
+  assert(prefix_len == 4);
+
+  for (size_t i = 0; i < recs.size(); i++) {
+    index_key lo = ke.encode_bound(recs[i], sptr, prefix_len, false);
+    index_key hi = ke.encode_bound(recs[i], sptr, prefix_len, true);
+    std::string slo = ke.encode_str_bound(recs[i], sptr, 1, 2, prefix_len,
+                                          false);
+    std::string shi = ke.encode_str_bound(recs[i], sptr, 1, 2, prefix_len,
+                                          true);
+
+    for (size_t j = 0; j < recs.size(); j++) {
+      index_key kj = ke.encode(recs[j], sptr);
+      std::string sj = ke.encode_str(recs[j], sptr, 1, 2);
+      bool match = (std::get<0>(vals[i]) == std::get<0>(vals[j]));
+
+      assert((!(kj < lo) && !(hi < kj)) == match);
+      assert((slo <= sj && sj <= shi) == match);
+    }
+
+    count = 0;
+    for (itr = tree->lower_bound(lo); itr != tree->end(); itr++, count++)
+      if (hi < itr.key())
+        break;
+    assert(count == recs.size() / (sizeof(ints) / sizeof(ints[0])));
+  }
+
+  unlink(path);
+}
+
+}
+
+int main() {
+  storage::test_index_key();
+  return 0;
+}
@@ -34,6 +34,31 @@ void test_pbtree() {
   assert(tree->size() == ops - 1);
 
   delete tree;
+
+  // 64-bit keys go through the vector search, check it against every
+  // instruction set with keys on both sides of the sign bit
+  pbtree<unsigned long, unsigned long>* ltree = new pbtree<unsigned long,
+      unsigned long>(&sp->ptrs[1]);
+  unsigned long lkey, val;
+  int detected = key_search_isa;
+
+  for (unsigned long i = 0; i < 1000; i++) {
+    lkey = i * 0x9e3779b97f4a7c15UL;
+    ltree->insert(lkey, i);
+  }
+
+  for (int isa = 0; isa <= detected; isa++) {
+    key_search_isa = isa;
+    for (unsigned long i = 0; i < 1000; i++) {
+      lkey = i * 0x9e3779b97f4a7c15UL;
+      assert(ltree->at(lkey, &val) && val == i);
+      assert(ltree->at(lkey + 1, &val) == false);
+    }
+    assert(ltree->at(~0UL, &val) == false);
+  }
+
+  key_search_isa = detected;
+  delete ltree;
 }
 
 }
@@ -0,0 +1,68 @@
+#include <iostream>
+#include <cstring>
+#include <string>
+#include <cassert>
+#include <unistd.h>
+
+#include "libpm.h"
+
+namespace storage {
+
+#define BLOCK_SIZE (1024 * 1024)
+#define NUM_BLOCKS 48
+
+void test_pgrow() {
+  const char* path = "./zfile_grow";
+  std::string extent;
+
+  // cleanup
+  unlink(path);
+
+  long pmp_size = 16 * 1024 * 1024;
+  if ((pmp = pmemalloc_init(path, pmp_size)) == NULL)
+    std::cout << "pmemalloc_init on :" << path << std::endl;
+
+  sp = (struct static_info *) pmemalloc_static_area();
+
+  // three times the first file, so the pool has to grow twice
+  char* blocks[NUM_BLOCKS];
+  for (int i = 0; i < NUM_BLOCKS; i++) {
+    blocks[i] = (char*) pmalloc(BLOCK_SIZE);
+    assert(blocks[i] != NULL);
+    assert(pmem_in_pool(blocks[i]));
+
+    memset(blocks[i], 'a' + i % 26, BLOCK_SIZE);
+    pmemalloc_activate(blocks[i]);
+  }
+
+  sp->ptrs[0] = blocks[NUM_BLOCKS - 1];
+  pmem_flush(&sp->ptrs[0], sizeof(void*));
+  pmem_drain();
+
+  // freed blocks in the extents are reused
+  delete blocks[NUM_BLOCKS - 2];
+  assert(pmalloc(BLOCK_SIZE) == blocks[NUM_BLOCKS - 2]);
+
+  // reopen, the extents are mapped back after the first file
+  if ((pmp = pmemalloc_init(path, pmp_size)) == NULL)
+    std::cout << "pmemalloc_init on :" << path << std::endl;
+
+  sp = (struct static_info *) pmemalloc_static_area();
+  char* last = (char*) sp->ptrs[0];
+  assert(last == blocks[NUM_BLOCKS - 1]);
+  assert(last[0] == 'a' + (NUM_BLOCKS - 1) % 26);
+  assert(last[BLOCK_SIZE - 1] == 'a' + (NUM_BLOCKS - 1) % 26);
+
+  unlink(path);
+  for (int i = 1; i <= 4; i++) {
+    extent = std::string(path) + "." + std::to_string(i);
+    unlink(extent.c_str());
+  }
+}
+
+}
+
+int main() {
+  storage::test_pgrow();
+  return 0;
+}
@@ -0,0 +1,131 @@
+#include <iostream>
+#include <cassert>
+#include <cstdlib>
+#include <memory>
+#include <vector>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "phash.h"
+#include "index_map.h"
+
+namespace storage {
+
+#define NUM_KEYS 200000
+
+typedef phash<unsigned long, unsigned long> hash_type;
+
+// the same calls reach the hash table through a table index map
+void check_map() {
+  index_map<off_t>* map = new ((index_map<off_t>*) pmalloc(
+      sizeof(index_map<off_t>))) index_map<off_t>(HASH_INDEX, &sp->ptrs[2]);
+  index_key key = index_key();
+  off_t val;
+  int status;
+
+  for (int i = 0; i < 1000; i++) {
+    key.words[0] = i;
+    assert(map->insert(key, i));
+  }
+
+  // a hash index cannot be scanned, lower_bound() must not pass for one
+  pid_t pid = fork();
+  if (pid == 0) {
+    map->lower_bound(key);
+    _exit(0);
+  }
+  waitpid(pid, &status, 0);
+  assert(map->is_hashed() && WIFSIGNALED(status));
+
+  key.words[0] = 500;
+  assert(map->at(key, &val) && val == 500);
+  assert(map->erase(key) == 1 && map->exists(key) == false);
+}
+
+void test_phash() {
+  const char* path = "./zfile_phash";
+  unsigned long val, done = 0, count;
+
+  // cleanup
+  unlink(path);
+
+  long pmp_size = 64 * 1024 * 1024;
+  if ((pmp = pmemalloc_init(path, pmp_size)) == NULL)
+    std::cout << "pmemalloc_init on :" << path << std::endl;
+
+  sp = (struct static_info *) pmemalloc_static_area();
+
+  hash_type* hash = new ((hash_type*) pmalloc(sizeof(hash_type))) hash_type();
+  pmemalloc_activate(hash);
+  sp->ptrs[1] = hash;
+  pmem_persist(&sp->ptrs[1], sizeof(void*), 0);
+
+  size_t initial = hash->capacity();
+  srand(1);
+
+  // kill the inserts at random points, in the middle of moves and resizes
+  // too, and check that the reopened table holds every committed key once
+  for (int round = 0; done < NUM_KEYS; round++) {
+    pid_t pid = fork();
+
+    if (pid == 0) {
+      for (unsigned long i = done; i < NUM_KEYS; i++)
+        hash->insert(i, i);
+      _exit(0);
+    }
+
+    if (round < 100) {
+      usleep(100 + rand() % 2000);
+      kill(pid, SIGKILL);
+    }
+    waitpid(pid, NULL, 0);
+
+    if ((pmp = pmemalloc_init(path, pmp_size)) == NULL)
+      std::cout << "pmemalloc_init on :" << path << std::endl;
+
+    sp = (struct static_info *) pmemalloc_static_area();
+    hash = (hash_type*) sp->ptrs[1];
+
+    // keys go in in order, so the committed ones are a prefix
+    for (done = 0; done < NUM_KEYS && hash->at(done, &val); done++)
+      assert(val == done);
+    for (unsigned long i = done; i < NUM_KEYS; i++)
+      assert(hash->exists(i) == false);
+
+    count = 0;
+    for (hash_type::iterator itr = hash->begin(); itr != hash->end(); itr++)
+      count++;
+    assert(count == done && hash->size() == done);
+  }
+
+  assert(hash->capacity() >= 8 * initial);
+
+  // batched lookups agree with single ones, the upper half misses
+  std::vector<unsigned long> keys, vals(2 * NUM_KEYS);
+  std::unique_ptr<bool[]> found(new bool[2 * NUM_KEYS]);
+  for (unsigned long i = 0; i < 2 * NUM_KEYS; i++)
+    keys.push_back(i);
+
+  assert(hash->multi_at(keys.data(), 2 * NUM_KEYS, vals.data(), found.get())
+      == NUM_KEYS);
+  for (unsigned long i = 0; i < 2 * NUM_KEYS; i++)
+    assert(found[i] == (i < NUM_KEYS) && (i >= NUM_KEYS || vals[i] == i));
+
+  assert(hash->update(1, 2) == 0 && hash->at(1, &val) && val == 2);
+  assert(hash->update(NUM_KEYS, 0) == -1);
+
+  check_map();
+
+  hash->clear();
+  assert(hash->size() == 0 && hash->capacity() == initial);
+
+  unlink(path);
+}
+
+}
+
+int main() {
+  storage::test_phash();
+  return 0;
+}
@@ -2,6 +2,8 @@
 #include <cstring>
 #include <string>
 #include <cassert>
+#include <algorithm>
+#include <sys/wait.h>
 #include <unistd.h>
 
 #include "libpm.h"
@@ -9,6 +11,23 @@
 
 namespace storage {
 
+// clump header in front of an allocation, size word then back link
+static inline size_t* clump_of(void* ptr) {
+  return (size_t*) ((uintptr_t) ptr - ALIGN);
+}
+
+// pmemalloc_check maps the pool over ours, so it runs in a child
+static size_t free_runs(const char* path) {
+  int status;
+  pid_t pid = fork();
+
+  if (pid == 0)
+    _exit(std::min(pmemalloc_check(path), (size_t) 255));
+  waitpid(pid, &status, 0);
+
+  return WEXITSTATUS(status);
+}
+
 void test_pmem() {
   const char* path = "./zfile";
 
@@ -24,16 +43,61 @@ void test_pmem() {
   int ops = 1024;
   size_t sz;
 
+  // the defragmenter walks the pool while it is being churned
+  pmemalloc_defrag_start(1);
+
   for (int i = 0; i < ops; i++) {
     sz = rand() % 1024;
 
-    char* vc = new char[sz];
+    char* vc = (char*) pmalloc(sz);
     if (sz % 4 == 0)
       pmemalloc_activate(vc);
 
     if (sz % 16 == 0)
       delete vc;
   }
+
+  pmemalloc_defrag_stop();
+
+  struct pmem_stats st;
+  pmemalloc_stats(&st);
+  assert(st.free_bytes + st.active_bytes <= st.total_bytes);
+
+  // frees merge with their neighbours, so build the run a torn free
+  // leaves: b is freed while a, already free, still reads as reserved
+  char* guard = (char*) pmalloc(4096);
+  char* a = (char*) pmalloc(4096);
+  char* b = (char*) pmalloc(4096);
+  char* c = (char*) pmalloc(4096);
+  sz = clump_of(a)[0] & ~(ALIGN - 1);
+  assert(a == guard + sz && b == a + sz && c == b + sz);
+
+  size_t reserved = clump_of(a)[0];
+  pfree(a);
+  size_t freed = clump_of(a)[0];
+  clump_of(a)[0] = reserved;
+  pfree(b);
+  clump_of(a)[0] = freed;
+  pmem_persist(clump_of(a), sizeof(size_t), 0);
+  assert(free_runs(path) == 1);
+
+  // one pass of the defragmenter merges the pair
+  unsigned long passes = st.defrag_passes, merges = st.defrag_merges;
+  pmemalloc_defrag_start(1000);
+  do {
+    pmemalloc_stats(&st);
+  } while (st.defrag_passes == passes);
+  pmemalloc_defrag_stop();
+
+  assert(st.defrag_merges == merges + 1);
+  assert((clump_of(a)[0] & ~(ALIGN - 1)) == 2 * sz);
+  assert(clump_of(c)[1] == 2 * sz);
+  assert(free_runs(path) == 0);
+
+  // freed clumps are handed out again from their size class
+  void* ptr = pmalloc(100);
+  pfree(ptr);
+  assert(pmalloc(100) == ptr);
 }
 
 }
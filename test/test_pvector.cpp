@@ -0,0 +1,81 @@
+#include <iostream>
+#include <cstring>
+#include <string>
+#include <cassert>
+#include <unistd.h>
+
+#include "libpm.h"
+#include "pvector.h"
+
+namespace storage {
+
+#define NUM_VALS 100
+
+int test_pvector() {
+  const char* path = "./zfile_pvector";
+
+  // cleanup
+  unlink(path);
+
+  long pmp_size = 10 * 1024 * 1024;
+  if ((pmp = pmemalloc_init(path, pmp_size)) == NULL)
+    std::cout << "pmemalloc_init on :" << path << std::endl;
+
+  sp = (struct static_info *) pmemalloc_static_area();
+
+  pvector<char*>* vec = new ((pvector<char*>*) pmalloc(sizeof(pvector<char*>))) pvector<char*>(&sp->ptrs[0]);
+  pmemalloc_activate(vec);
+  sp->ptrs[1] = vec;
+  pmem_persist(&sp->ptrs[1], sizeof(void*), 0);
+
+  char* vals[NUM_VALS];
+  for (int i = 0; i < NUM_VALS; i++) {
+    vals[i] = (char*) pmalloc(3);
+    pmemalloc_activate(vals[i]);
+    snprintf(vals[i], 3, "%02d", i);
+
+    assert(vec->push_back(vals[i]) == i);
+  }
+
+  assert(vec->size() == NUM_VALS);
+  for (int i = 0; i < NUM_VALS; i++)
+    assert(vec->at(i) == vals[i]);
+  assert(vec->at(NUM_VALS) == NULL);
+
+  char* updated_val = (char*) pmalloc(3);
+  pmemalloc_activate(updated_val);
+  strcpy(updated_val, "ab");
+
+  vec->update(2, updated_val);
+  assert(vec->at(2) == updated_val);
+
+  // reopen, the lookup cache is rebuilt from the pool
+  if ((pmp = pmemalloc_init(path, pmp_size)) == NULL)
+    std::cout << "pmemalloc_init on :" << path << std::endl;
+
+  sp = (struct static_info *) pmemalloc_static_area();
+  vec = (pvector<char*>*) sp->ptrs[1];
+
+  assert(vec->size() == NUM_VALS);
+  assert(vec->at(2) == updated_val);
+  assert(strcmp(vec->at(NUM_VALS - 1), "99") == 0);
+
+  std::vector<char*> data = vec->get_data();
+  assert(data.size() == NUM_VALS);
+  assert(data[0] == vals[0]);
+
+  vec->clear();
+  assert(vec->empty());
+
+  int ret = std::remove(path);
+
+  return ret;
+}
+
+}
+
+int main() {
+  storage::test_pvector();
+
+  return 0;
+}